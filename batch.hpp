@@ -0,0 +1,283 @@
+#pragma once
+
+#include "machine.hpp"
+#include "cli.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Batch runs
+// A manifest lists independent jobs, one per line as key=value pairs
+// (a bare first word is the BIOS image), and '#' starts a comment:
+//
+//   bios=a.out ata=disk.img memory=1M instructions=100M time=2.5
+//
+// cores and quantum set up multicore boards (see machine.hpp), their
+// cores run on threads of their own on top of the pool's, unless
+// deterministic=1 (with an optional schedule seed=<n>).
+//
+// Jobs run on a pool of worker threads, each one on a machine of its
+// own. instructions and time (in seconds) limit how long a job runs,
+// jobs without limits run until the guest stops. Terminal output goes
+// to output=<file> or is dropped, and terminal input is played back
+// from replay=<log> or reads as no key. BIOS images are read once and
+// shared by every job using them.
+//
+// Results are written a line per job as jobs finish, jobs are named
+// by their line in the manifest.
+
+struct batch_job_t {
+    size_t line;
+
+    machine_config_t config;
+
+    // No limit if 0
+    hyu64_t instructions = 0;
+    double  time = 0;
+
+    std::string output;
+    std::string replay;
+
+    // Why the line couldn't be parsed, if it couldn't
+    std::string error;
+};
+
+class batch_t {
+    std::vector <batch_job_t> jobs;
+
+    std::atomic <size_t> next;
+
+    std::ostream* results;
+
+    // Guards results and images
+    std::mutex lock;
+
+    std::unordered_map <std::string, dev_bios_image_t> images;
+
+    // Guests see no key pressed
+    static int no_input() {
+        return 0;
+    }
+
+    static bool parse_job(batch_job_t& job, const std::string& key, const std::string& value) {
+        if      (key == "bios"         ) job.config.bios_image    = value;
+        else if (key == "ata"          ) job.config.ata_image     = value;
+        else if (key == "memory"       ) job.config.memory_size   = hs::parse_size(value);
+        else if (key == "cores"        ) job.config.cores         = hs::parse_size(value);
+        else if (key == "quantum"      ) job.config.quantum       = hs::parse_size(value);
+        else if (key == "seed"         ) job.config.seed          = hs::parse_size(value);
+        else if (key == "deterministic") job.config.deterministic = std::stoi(value);
+        else if (key == "instructions" ) job.instructions         = hs::parse_size(value);
+        else if (key == "time"         ) job.time                 = std::stod(value);
+        else if (key == "output"       ) job.output               = value;
+        else if (key == "replay"       ) job.replay               = value;
+        else return false;
+
+        return true;
+    }
+
+    dev_bios_image_t image(const std::string& path) {
+        std::lock_guard <std::mutex> guard(lock);
+
+        dev_bios_image_t& image = images[path];
+
+        if (!image) image = dev_bios_t::load_image(path, MACHINE_BIOS_SIZE);
+
+        return image;
+    }
+
+    void report(const batch_job_t& job, const char* stop, hyu32_t a0, hyu64_t retired, double seconds) {
+        char line[0x200];
+
+        std::snprintf(line, sizeof(line), "job=%zu stop=%s a0=0x%08x instructions=%llu time=%.3f mips=%.2f",
+            job.line,
+            stop,
+            a0,
+            (unsigned long long)retired,
+            seconds,
+            seconds ? (retired / seconds / 1e6) : 0.0
+        );
+
+        std::lock_guard <std::mutex> guard(lock);
+
+        *results << line << std::endl;
+    }
+
+    void run_job(const batch_job_t& job) {
+        auto begin = std::chrono::steady_clock::now();
+
+        auto elapsed = [&begin]() {
+            return std::chrono::duration <double>(std::chrono::steady_clock::now() - begin).count();
+        };
+
+        if (job.error.size()) {
+            _log(error, "Job %zu: %s", job.line, job.error.c_str());
+
+            report(job, "error", 0, 0, 0);
+
+            return;
+        }
+
+        // Too big for worker stacks
+        std::unique_ptr <machine_t> machine(new machine_t);
+
+        machine_config_t config = job.config;
+
+        config.bios_rom = image(config.bios_image);
+
+        if (!machine->create(config)) {
+            report(job, "error", 0, 0, elapsed());
+
+            return;
+        }
+
+        std::ofstream output;
+        std::ostream discard(nullptr);
+
+        if (job.output.size()) {
+            output.open(job.output, std::ios::binary | std::ios::trunc);
+
+            if (!output.is_open()) {
+                _log(error, "Job %zu: couldn't open \"%s\" for writing", job.line, job.output.c_str());
+
+                report(job, "error", 0, 0, elapsed());
+
+                return;
+            }
+        }
+
+        machine->terminal.attach_output(job.output.size() ? (std::ostream*)&output : &discard);
+        machine->terminal.attach_input(no_input);
+
+        if (job.replay.size()) {
+            if (!machine->replay.replay(job.replay, &machine->cpu.internal.retired, machine_key(config))) {
+                _log(error, "Job %zu: couldn't play back input log \"%s\"", job.line, job.replay.c_str());
+
+                report(job, "error", 0, 0, elapsed());
+
+                return;
+            }
+
+            machine->attach_replay();
+        }
+
+        const char* stop = nullptr;
+
+        // Slices short enough to check the time limit often
+        while (!stop) {
+            hyu64_t budget = 0x100000;
+
+            if (job.instructions) {
+                hyu64_t left = job.instructions - machine->retired();
+
+                if (!left) {
+                    stop = "instructions";
+
+                    break;
+                }
+
+                if (left < budget) budget = left;
+            }
+
+            switch (machine->run(budget)) {
+                case MACHINE_DEBUG  : stop = "debug"; break;
+                case MACHINE_ILLEGAL: stop = "illegal"; break;
+                case MACHINE_BUDGET : break;
+            }
+
+            if (!stop && job.time && (elapsed() >= job.time)) stop = "time";
+        }
+
+        report(job, stop, machine->stopped_core()->internal.r[24], machine->retired(), elapsed());
+    }
+
+    void worker() {
+        size_t i;
+
+        while ((i = next++) < jobs.size())
+            run_job(jobs[i]);
+    }
+
+public:
+    // Jobs start off base and change whatever their line sets. Lines
+    // that can't be parsed are kept and reported as errors
+    bool load(const std::string& path, const machine_config_t& base) {
+        std::ifstream file(path);
+
+        if (!file.is_open()) return false;
+
+        jobs.clear();
+
+        std::string text;
+
+        for (size_t line = 1; std::getline(file, text); line++) {
+            text = text.substr(0, text.find('#'));
+
+            std::istringstream words(text);
+
+            std::string word;
+
+            batch_job_t job;
+
+            job.line   = line;
+            job.config = base;
+
+            bool empty = true;
+
+            while (words >> word) {
+                size_t eq = word.find('=');
+
+                try {
+                    if (eq == std::string::npos) {
+                        if (!empty) throw std::invalid_argument(word);
+
+                        job.config.bios_image = word;
+                    } else if (!parse_job(job, word.substr(0, eq), word.substr(eq + 1))) {
+                        throw std::invalid_argument(word);
+                    }
+                } catch (const std::exception&) {
+                    if (job.error.empty()) job.error  = "bad setting \"" + word + "\"";
+                }
+
+                empty = false;
+            }
+
+            if (!empty) jobs.push_back(job);
+        }
+
+        return true;
+    }
+
+    size_t size() const {
+        return jobs.size();
+    }
+
+    // Runs every job, on as many threads as the host has cores if
+    // threads is 0
+    void run(std::ostream& results, unsigned threads = 0) {
+        this->results = &results;
+
+        next = 0;
+
+        if (!threads) threads = std::thread::hardware_concurrency();
+        if (!threads) threads = 1;
+        if (threads > jobs.size()) threads = jobs.size();
+
+        std::vector <std::thread> pool;
+
+        for (unsigned t = 0; t < threads; t++)
+            pool.emplace_back(&batch_t::worker, this);
+
+        for (std::thread& thread : pool)
+            thread.join();
+    }
+};
\ No newline at end of file
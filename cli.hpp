@@ -1,40 +1,71 @@
 #pragma once
 
+#include <cctype>
+#include <cstdint>
+#include <stdexcept>
 #include <vector>
 #include <string>
 #include <unordered_map>
 
 namespace hs {
+    // Parses sizes like "65536", "0x10000", "64K" or "256M", throws
+    // std::invalid_argument or std::out_of_range on anything else
+    inline uint64_t parse_size(const std::string& str, int base = 0) {
+        size_t end = 0;
+
+        uint64_t size = std::stoull(str, &end, base);
+
+        int suffix = (end < str.size()) ? std::toupper(str[end++]) : 0;
+
+        if (end < str.size()) throw std::invalid_argument(str);
+
+        switch (suffix) {
+            case 0  : return size;
+            case 'K': return size << 10;
+            case 'M': return size << 20;
+            case 'G': return size << 30;
+        }
+
+        throw std::invalid_argument(str);
+    }
+
     enum cli_switch_t {
         SW_VERSION,
         SW_QUIET,
         SW_VERBOSE,
-        SW_ASSEMBLE,
-        SW_OUTPUT_ASSEMBLY,
         SW_LOG,
         SW_HELP,
-        SW_ONLY_SYMBOLS,
-        SW_DEBUG_LEXER_OUTPUT,
-        SW_DEBUG_PARSER_OUTPUT,
-        SW_DEBUG_IR_OUTPUT,
-        SW_DEBUG_IRT_OUTPUT,
-        SW_DEBUG_ALL,
-        SW_STDIN,
-        SW_STDOUT,
-        SW_STDIO,
-        SW_PRINT_SUCCESS,
-        SW_OUTPUT_SYMBOLS
+        SW_FUNCTIONAL,
+        SW_JIT,
+        SW_JIT_VERIFY,
+        SW_FASTMEM,
+        SW_REVERSE,
+        SW_DETERMINISTIC
     };
 
     enum cli_setting_t {
         ST_BIOS,
         ST_ATA_DRIVE,
-        ST_OUTPUT,
-        ST_OUTPUT_FORMAT,
-        ST_TARGET_ARCH,
-        ST_SYSTEM_INCLUDE,
-        ST_XLAT,
-        ST_HELP_TARGET
+        ST_MEMORY_SIZE,
+        ST_SAVE_STATE,
+        ST_LOAD_STATE,
+        ST_CHECKPOINT_INTERVAL,
+        ST_BOOT_CACHE,
+        ST_RECORD,
+        ST_REPLAY,
+        ST_REVERSE_BUDGET,
+        ST_BATCH,
+        ST_RESULTS,
+        ST_THREADS,
+        ST_FORK_SERVER,
+        ST_INJECT,
+        ST_CASE_LIMIT,
+        ST_COVERAGE,
+        ST_FUZZ,
+        ST_FUZZ_CASES,
+        ST_CORES,
+        ST_QUANTUM,
+        ST_SCHEDULE_SEED
     };
 
     class cli_parser_t {
@@ -55,32 +86,39 @@ namespace hs {
             WSHORTHAND("-v", "--version"             , SW_VERSION            ),
             WSHORTHAND("-q", "--quiet"               , SW_QUIET              ),
             WSHORTHAND("-V", "--verbose"             , SW_VERBOSE            ),
-            WSHORTHAND("-a", "--assemble"            , SW_ASSEMBLE           ),
             WSHORTHAND("-L", "--log"                 , SW_LOG                ),
-            WSHORTHAND("-A", "--output-assembly"     , SW_OUTPUT_ASSEMBLY    ),
-            WSHORTHAND("-S", "--output-symbols"      , SW_OUTPUT_SYMBOLS     ),
-            LONG_ONLY (      "--help"                , SW_HELP               ),
-            LONG_ONLY (      "--only-symbols"        , SW_ONLY_SYMBOLS       ),
-            LONG_ONLY (      "--debug-lexer-output"  , SW_DEBUG_LEXER_OUTPUT ),
-            LONG_ONLY (      "--debug-parser-output" , SW_DEBUG_PARSER_OUTPUT),
-            LONG_ONLY (      "--debug-ir-output"     , SW_DEBUG_IR_OUTPUT    ),
-            LONG_ONLY (      "--debug-irt-output"    , SW_DEBUG_IRT_OUTPUT   ),
-            LONG_ONLY (      "--debug-all"           , SW_DEBUG_ALL          ),
-            LONG_ONLY (      "--stdin"               , SW_STDIN              ),
-            LONG_ONLY (      "--stdout"              , SW_STDOUT             ),
-            LONG_ONLY (      "--stdio"               , SW_STDIO              ),
-            LONG_ONLY (      "--print-success"       , SW_PRINT_SUCCESS      ),
+            WSHORTHAND("-f", "--functional"          , SW_FUNCTIONAL         ),
+            WSHORTHAND("-j", "--jit"                 , SW_JIT                ),
+            LONG_ONLY (      "--jit-verify"          , SW_JIT_VERIFY         ),
+            LONG_ONLY (      "--fastmem"             , SW_FASTMEM            ),
+            LONG_ONLY (      "--reverse"             , SW_REVERSE            ),
+            LONG_ONLY (      "--deterministic"       , SW_DETERMINISTIC      ),
+            LONG_ONLY (      "--help"                , SW_HELP               )
         };
 
         std::unordered_map <std::string, cli_setting_t> m_settings_map = {
-            WSHORTHAND("-I", "--include-paths"       , ST_INCLUDE_PATHS      ),
-            WSHORTHAND("-i", "--input"               , ST_INPUT              ),
-            WSHORTHAND("-o", "--output"              , ST_OUTPUT             ),
-            WSHORTHAND("-F", "--output-format"       , ST_OUTPUT_FORMAT      ),
-            WSHORTHAND("-T", "--target-arch"         , ST_TARGET_ARCH        ),
-            LONG_ONLY (      "--Xlat"                , ST_XLAT               ),
-            LONG_ONLY (      "--system-include"      , ST_SYSTEM_INCLUDE     ),
-            LONG_ONLY (      "--help-target"         , ST_HELP_TARGET        )
+            WSHORTHAND("-b", "--bios"                , ST_BIOS               ),
+            WSHORTHAND("-d", "--ata-drive"           , ST_ATA_DRIVE          ),
+            WSHORTHAND("-m", "--memory"              , ST_MEMORY_SIZE        ),
+            WSHORTHAND("-s", "--save-state"          , ST_SAVE_STATE         ),
+            WSHORTHAND("-l", "--load-state"          , ST_LOAD_STATE         ),
+            LONG_ONLY (      "--checkpoint-every"    , ST_CHECKPOINT_INTERVAL),
+            LONG_ONLY (      "--boot-cache"          , ST_BOOT_CACHE         ),
+            LONG_ONLY (      "--record"              , ST_RECORD             ),
+            LONG_ONLY (      "--replay"              , ST_REPLAY             ),
+            LONG_ONLY (      "--reverse-budget"      , ST_REVERSE_BUDGET     ),
+            LONG_ONLY (      "--batch"               , ST_BATCH              ),
+            LONG_ONLY (      "--results"             , ST_RESULTS            ),
+            LONG_ONLY (      "--threads"             , ST_THREADS            ),
+            LONG_ONLY (      "--fork-server"         , ST_FORK_SERVER        ),
+            LONG_ONLY (      "--inject"              , ST_INJECT             ),
+            LONG_ONLY (      "--case-limit"          , ST_CASE_LIMIT         ),
+            LONG_ONLY (      "--coverage"            , ST_COVERAGE           ),
+            LONG_ONLY (      "--fuzz"                , ST_FUZZ               ),
+            LONG_ONLY (      "--fuzz-cases"          , ST_FUZZ_CASES         ),
+            WSHORTHAND("-c", "--cores"               , ST_CORES              ),
+            LONG_ONLY (      "--quantum"             , ST_QUANTUM            ),
+            LONG_ONLY (      "--schedule-seed"       , ST_SCHEDULE_SEED      )
         };
 
 #undef WSHORTHAND
@@ -93,17 +131,25 @@ namespace hs {
         }
 
         bool get_switch(cli_switch_t sw) {
-            return m_switches.contains(sw);
+            return m_switches.count(sw);
         }
 
         bool is_set(cli_setting_t st) {
-            return m_settings.contains(st);
+            return m_settings.count(st);
         }
 
         std::string get_setting(cli_setting_t st) {
             return m_settings[st];
         }
 
+        // Long name of a setting, for error messages
+        std::string get_name(cli_setting_t st) {
+            for (const auto& [name, setting] : m_settings_map)
+                if ((setting == st) && (name.size() > 2)) return name;
+
+            return "";
+        }
+
         bool parse() {
             if (m_argc == 1) {
                 return false;
@@ -112,20 +158,21 @@ namespace hs {
             for (int i = 1; i < m_argc; i++) {
                 std::string arg(m_argv[i]);
 
-                if (m_switches_map.contains(arg)) {
+                if (m_switches_map.count(arg)) {
                     m_switches[m_switches_map[arg]] = true;
 
                     continue;
                 }
 
-                if (m_settings_map.contains(arg)) {
+                if (m_settings_map.count(arg) && ((i + 1) < m_argc)) {
                     m_settings[m_settings_map[arg]] = std::string(m_argv[++i]);
 
                     continue;
                 }
 
-                if (!m_settings.contains(ST_INPUT)) {
-                    m_settings[ST_INPUT] = arg;
+                // Positional argument is the BIOS image
+                if (!m_settings.count(ST_BIOS)) {
+                    m_settings[ST_BIOS] = arg;
                 }
             }
 
@@ -4,18 +4,53 @@
 
 #include "device.hpp"
 
+#include <cstring>
 #include <fstream>
+#include <memory>
 #include <vector>
 
+// Images can be shared between instances (see attach_image), reads
+// go to the shared copy until the guest first writes to the BIOS,
+// and it gets a private one then. Shared images are never exposed
+// through host_pointer, the CPU could write to them through it.
+typedef std::shared_ptr <const std::vector <hyu8_t>> dev_bios_image_t;
+
 class dev_bios_t : public device_t {
     hyrisc_ext_t* proc;
 
     std::vector <hyu8_t> buf;
+    std::vector <hyu8_t> saved;
+
+    dev_bios_image_t shared;
+
+    // Current contents, shared or private
+    const hyu8_t* rom = nullptr;
+
+    size_t size = 0;
 
     hyu32_t base;
 
+    void own() {
+        if (!shared) return;
+
+        buf.assign(shared->begin(), shared->end());
+
+        shared.reset();
+
+        rom = buf.data();
+    }
+
+    // Goes back to private contents only if they'd differ
+    void set_contents(const hyu8_t* data) {
+        if (shared && !std::memcmp(shared->data(), data, size)) return;
+
+        own();
+
+        std::memcpy(buf.data(), data, size);
+    }
+
     hyu8_t read8(hyu32_t addr) {
-        return buf[addr];
+        return rom[addr];
     }
 
     hyu16_t read16(hyu32_t addr) {
@@ -27,6 +62,8 @@ class dev_bios_t : public device_t {
     }
 
     void write8(hyu32_t addr, hyu32_t value) {
+        own();
+
         buf[addr] = value & 0xff;
     }
 
@@ -44,9 +81,41 @@ public:
     void create(size_t size, hyu32_t base) {
         buf.resize(size);
 
+        shared.reset();
+
+        rom = buf.data();
+
+        this->size = size;
         this->base = base;
     }
 
+    // Reads an image to share between instances, padded or cut to
+    // size like load does
+    static dev_bios_image_t load_image(std::string fn, size_t size, bool strip_elf = false) {
+        std::vector <hyu8_t> image(size);
+
+        std::ifstream file(fn, std::ios::binary);
+
+        if (strip_elf) for (int i = 0; i < 0x34; i++) file.get();
+
+        file.read((char*)image.data(), image.size());
+
+        return std::make_shared <const std::vector <hyu8_t>>(std::move(image));
+    }
+
+    // Returns false if the image isn't the size of the BIOS
+    bool attach_image(dev_bios_image_t image) {
+        if (!image || (image->size() != size)) return false;
+
+        shared = image;
+        rom    = shared->data();
+
+        buf.clear();
+        buf.shrink_to_fit();
+
+        return true;
+    }
+
     hyu32_t read(hyu32_t addr, hyint_t size) {
         switch (size) {
             case AS_BYTE   : return read8(addr);
@@ -72,6 +141,8 @@ public:
     }
 
     void load(std::string fn, bool strip_elf = false) {
+        own();
+
         std::ifstream file(fn, std::ios::binary);
 
         if (strip_elf) for (int i = 0; i < 0x34; i++) file.get();
@@ -79,18 +150,69 @@ public:
         file.read((char*)buf.data(), buf.size());
     }
 
-    void update() override {
-        bool address_in_range = (proc->bci.a >= base) && (proc->bci.a <= (base + buf.size()));
+    bool access(hyu32_t addr, hyu32_t& data, hybool_t rw, hyint_t size) override {
+        bool address_in_range = (addr >= base) && ((hyu64_t)(addr - base) < this->size);
+
+        if (!address_in_range) return false;
+
+        bool partial = device_partial_access(addr - base, this->size, data, rw, size,
+            [this](hyu32_t offset) { return this->read8(offset); },
+            [this](hyu32_t offset, hyu32_t value) { this->write8(offset, value); }
+        );
+
+        if (partial) return true;
+
+        switch (rw) {
+            case RW_READ : data = read(addr - base, size); break;
+            case RW_WRITE: write(addr - base, data, size); break;
+        }
+
+        return true;
+    }
+
+    hyu8_t* host_pointer(hyu32_t addr, hyu32_t size) override {
+        if (shared || (addr < base) || ((hyu64_t)(addr - base) + size > this->size)) return nullptr;
+
+        return &buf[addr - base];
+    }
+
+    void snapshot() override {
+        saved.assign(rom, rom + size);
+    }
 
-        if (!address_in_range) return;
+    void restore() override {
+        if (saved.size() == size) set_contents(saved.data());
+    }
+
+    void save(hyrisc_state_writer_t& w) override {
+        w.begin("BIOS", 1);
+        w.u32(base);
+        w.u32(size);
+        w.bytes(rom, size);
+        w.end();
+    }
+
+    bool load(hyrisc_state_reader_t& r) override {
+        if (!r.expect("BIOS")) return false;
+
+        if ((r.u32() != base) || (r.u32() != size)) return false;
+
+        std::vector <hyu8_t> data(size);
+
+        r.bytes(data.data(), size);
+
+        if (!r.good()) return false;
+
+        set_contents(data.data());
+
+        return true;
+    }
+
+    void update() override {
         if (!proc->bci.busreq) return;
+        if (!access(proc->bci.a, proc->bci.d, proc->bci.rw, proc->bci.s)) return;
 
         proc->bci.busack = true;
         proc->bci.be = 0x0;
-        
-        switch (proc->bci.rw) {
-            case 0: proc->bci.d = read(proc->bci.a - base, proc->bci.s); break;
-            case 1: write(proc->bci.a - base, proc->bci.d, proc->bci.s); break;
-        }
     }
 };
\ No newline at end of file
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "../hyrisc/state.hpp"
+
+#include "device.hpp"
+
+#include <vector>
+
+// System bus
+// Page-granular table from address to the single device decoding
+// it, filled as devices are mapped. Transactions go straight to
+// their owner, and devices see nothing on cycles without a bus
+// request, so adding devices doesn't slow down every instruction.
+//
+// The table has two levels. 4 MiB regions owned by a single device
+// (or none) are one entry, only regions shared between devices get
+// a table of pages, so a board takes a few KiB of it instead of a
+// pointer for every page in the address space.
+
+#define BUS_PAGE_SHIFT   12
+#define BUS_REGION_SHIFT 22
+#define BUS_REGION_PAGES (1 << (BUS_REGION_SHIFT - BUS_PAGE_SHIFT))
+#define BUS_REGION_COUNT (1 << (32 - BUS_REGION_SHIFT))
+
+class dev_bus_t : public device_t {
+    struct region_t {
+        device_t* owner = nullptr;
+
+        // Empty if owner has the whole region
+        std::vector <device_t*> pages;
+    };
+
+    hyrisc_ext_t* proc;
+
+    std::vector <region_t>  regions;
+    std::vector <device_t*> devices;
+
+public:
+    void init(hyrisc_ext_t* proc) override {
+        this->proc = proc;
+
+        regions.assign(BUS_REGION_COUNT, region_t());
+    }
+
+    // Devices mapped later take over pages they share with others
+    void map(device_t* dev, hyu32_t base, hyu32_t size) {
+        hyu32_t first = base >> BUS_PAGE_SHIFT;
+        hyu32_t last = (base + (size - 1)) >> BUS_PAGE_SHIFT;
+
+        for (hyu32_t page = first; page <= last;) {
+            region_t& region = regions[page / BUS_REGION_PAGES];
+
+            hyu32_t index = page % BUS_REGION_PAGES;
+
+            // Covers the whole region
+            if (!index && ((last - page) >= (BUS_REGION_PAGES - 1))) {
+                region.owner = dev;
+                region.pages.clear();
+
+                page += BUS_REGION_PAGES;
+
+                continue;
+            }
+
+            if (region.pages.empty()) region.pages.assign(BUS_REGION_PAGES, region.owner);
+
+            region.pages[index] = dev;
+
+            page++;
+        }
+
+        for (device_t* mapped : devices)
+            if (mapped == dev) return;
+
+        devices.push_back(dev);
+    }
+
+    // In the order they were mapped
+    const std::vector <device_t*>& get_devices() const {
+        return devices;
+    }
+
+    inline device_t* decode(hyu32_t addr) {
+        const region_t& region = regions[addr >> BUS_REGION_SHIFT];
+
+        if (region.pages.empty()) return region.owner;
+
+        return region.pages[(addr >> BUS_PAGE_SHIFT) & (BUS_REGION_PAGES - 1)];
+    }
+
+    bool access(hyu32_t addr, hyu32_t& data, hybool_t rw, hyint_t size) override {
+        device_t* dev = decode(addr);
+
+        if (!dev) return false;
+
+        return dev->access(addr, data, rw, size);
+    }
+
+    hyu8_t* host_pointer(hyu32_t addr, hyu32_t size) override {
+        device_t* dev = decode(addr);
+
+        if (!dev) return nullptr;
+
+        return dev->host_pointer(addr, size);
+    }
+
+    void snapshot() override {
+        for (device_t* dev : devices)
+            dev->snapshot();
+    }
+
+    void restore() override {
+        for (device_t* dev : devices)
+            dev->restore();
+    }
+
+    // Devices are saved in the order they were mapped
+    void save(hyrisc_state_writer_t& w) override {
+        for (device_t* dev : devices)
+            dev->save(w);
+    }
+
+    bool load(hyrisc_state_reader_t& r) override {
+        for (device_t* dev : devices)
+            if (!dev->load(r)) return false;
+
+        return true;
+    }
+
+    void update() override {
+        if (!proc->bci.busreq) return;
+
+        device_t* dev = decode(proc->bci.a);
+
+        if (dev) dev->update();
+    }
+};
\ No newline at end of file
@@ -1,6 +1,35 @@
 #pragma once
 
 #include "../hyrisc/state.hpp"
+#include "../hyrisc/savestate.hpp"
+
+// Bytes covered by an access of the given size (byte, short, long
+// or execute)
+inline hyu32_t device_access_bytes(hyint_t size) {
+    return (size >= 2) ? 4 : (1 << size);
+}
+
+// Accesses starting at offset that run past the end of a device only
+// reach the bytes in range, the rest read as open bus (0) and drop
+// writes. Returns false if the whole access fits
+template <class Read8, class Write8>
+inline bool device_partial_access(hyu32_t offset, hyu64_t end, hyu32_t& data, hybool_t rw, hyint_t size, Read8 read8, Write8 write8) {
+    if (((hyu64_t)offset + device_access_bytes(size)) <= end) return false;
+
+    hyu32_t value = 0;
+
+    for (hyu32_t i = 0; ((hyu64_t)offset + i) < end; i++) {
+        if (rw) {
+            write8(offset + i, (data >> (i * 8)) & 0xff);
+        } else {
+            value |= read8(offset + i) << (i * 8);
+        }
+    }
+
+    if (!rw) data = value;
+
+    return true;
+}
 
 class device_t {
 public:
@@ -8,4 +37,21 @@ public:
     //virtual void write(hyu32_t addr, hyu32_t value, hyint_t size) {};
     virtual void init(hyrisc_ext_t* proc) {};
     virtual void update() {};
+
+    // Functional access, used when the CPU bypasses the BCI handshake.
+    // Returns false if the address isn't decoded by this device
+    virtual bool access(hyu32_t addr, hyu32_t& data, hybool_t rw, hyint_t size) { return false; };
+
+    // Host memory backing [addr, addr + size), if the device is plain
+    // memory and covers the whole range. Lets the CPU skip access()
+    virtual hyu8_t* host_pointer(hyu32_t addr, hyu32_t size) { return nullptr; };
+
+    // Captures the device state, restore brings back the last one
+    virtual void snapshot() {};
+    virtual void restore() {};
+
+    // Save-states, see hyrisc/savestate.hpp. load returns false if
+    // the saved state doesn't fit this device
+    virtual void save(hyrisc_state_writer_t& w) {};
+    virtual bool load(hyrisc_state_reader_t& r) { return true; };
 };
\ No newline at end of file
@@ -11,6 +11,7 @@ class dev_flash_t : public device_t {
     hyrisc_ext_t* proc;
 
     std::vector <hyu8_t> buf;
+    std::vector <hyu8_t> saved;
 
     hyu32_t base;
 
@@ -77,18 +78,63 @@ public:
         file.read((char*)buf.data(), buf.size());
     }
 
-    void update() override {
-        bool address_in_range = (proc->bci.a >= base) && (proc->bci.a <= (base + buf.size()));
+    bool access(hyu32_t addr, hyu32_t& data, hybool_t rw, hyint_t size) override {
+        bool address_in_range = (addr >= base) && ((hyu64_t)(addr - base) < buf.size());
+
+        if (!address_in_range) return false;
+
+        bool partial = device_partial_access(addr - base, buf.size(), data, rw, size,
+            [this](hyu32_t offset) { return this->read8(offset); },
+            [this](hyu32_t offset, hyu32_t value) { this->write8(offset, value); }
+        );
+
+        if (partial) return true;
+
+        switch (rw) {
+            case RW_READ : data = read(addr - base, size); break;
+            case RW_WRITE: write(addr - base, data, size); break;
+        }
+
+        return true;
+    }
+
+    hyu8_t* host_pointer(hyu32_t addr, hyu32_t size) override {
+        if ((addr < base) || ((hyu64_t)(addr - base) + size > buf.size())) return nullptr;
+
+        return &buf[addr - base];
+    }
+
+    void snapshot() override {
+        saved = buf;
+    }
+
+    void restore() override {
+        if (saved.size() == buf.size()) buf = saved;
+    }
+
+    void save(hyrisc_state_writer_t& w) override {
+        w.begin("FLSH", 1);
+        w.u32(base);
+        w.u32(buf.size());
+        w.bytes(buf.data(), buf.size());
+        w.end();
+    }
+
+    bool load(hyrisc_state_reader_t& r) override {
+        if (!r.expect("FLSH")) return false;
 
-        if (!address_in_range) return;
+        if ((r.u32() != base) || (r.u32() != buf.size())) return false;
+
+        r.bytes(buf.data(), buf.size());
+
+        return r.good();
+    }
+
+    void update() override {
         if (!proc->bci.busreq) return;
+        if (!access(proc->bci.a, proc->bci.d, proc->bci.rw, proc->bci.s)) return;
 
         proc->bci.busack = true;
         proc->bci.be = 0x0;
-        
-        switch (proc->bci.rw) {
-            case 0: proc->bci.d = read(proc->bci.a - base, proc->bci.s); break;
-            case 1: write(proc->bci.a - base, proc->bci.d, proc->bci.s); break;
-        }
     }
 };
\ No newline at end of file
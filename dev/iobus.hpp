@@ -9,13 +9,14 @@
 
 #include <vector>
 
-#define IN_RANGE(base, size) ((proc->bci.a >= base) && (proc->bci.a <= (base + (size - 1))))
+#define IN_RANGE(addr, base, size) ((addr >= base) && (addr <= (base + (size - 1))))
 #define IOBUS_PORT 0xfffffffe
 #define IOBUS_DATA 0xffffffff
 
 class dev_iobus_t : public device_t {
     hyrisc_ext_t* proc;
     iobus_ext_t ext;
+    iobus_ext_t saved;
 
     std::vector <iobus_device_t*> devices;
 
@@ -36,30 +37,27 @@ public:
             dev->init(&ext);
     }
 
-    void update() override {
-        if (!(proc->bci.busreq && IN_RANGE(base, size))) return;
-
-        proc->bci.busack = true;
-        proc->bci.be = 0x0;
+    bool access(hyu32_t addr, hyu32_t& data, hybool_t rw, hyint_t size) override {
+        if (!IN_RANGE(addr, base, this->size)) return false;
 
-        switch (proc->bci.a) {
+        switch (addr) {
             case IOBUS_PORT: {
-                switch (proc->bci.rw) {
+                switch (rw) {
                     case RW_WRITE: {
-                        ext.port = proc->bci.d;
+                        ext.port = data;
                     } break;
                     case RW_READ : {
-                        proc->bci.d = ext.port;
+                        data = ext.port;
                     } break;
                 }
             } break;
 
             case IOBUS_DATA: {
-                switch (proc->bci.rw) {
+                switch (rw) {
                     case RW_WRITE: {
-                        ext.data = proc->bci.d;
+                        ext.data = data;
                         ext.rw   = RW_WRITE;
-                        ext.size = proc->bci.s;
+                        ext.size = size;
 
                         for (iobus_device_t* dev : devices)
                             dev->update();
@@ -67,15 +65,67 @@ public:
 
                     case RW_READ: {
                         ext.rw = RW_READ;
-                        ext.size = proc->bci.s;
+                        ext.size = size;
 
                         for (iobus_device_t* dev : devices)
                             dev->update();
                         
-                        proc->bci.d = ext.data;
+                        data = ext.data;
                     } break;
                 }
             } break;
         }
+
+        return true;
+    }
+
+    void snapshot() override {
+        saved = ext;
+
+        for (iobus_device_t* dev : devices)
+            dev->snapshot();
+    }
+
+    void restore() override {
+        ext = saved;
+
+        for (iobus_device_t* dev : devices)
+            dev->restore();
+    }
+
+    void save(hyrisc_state_writer_t& w) override {
+        w.begin("IOBS", 1);
+        w.u32(ext.port);
+        w.u32(ext.data);
+        w.u8 (ext.rw);
+        w.u32(ext.size);
+        w.end();
+
+        for (iobus_device_t* dev : devices)
+            dev->save(w);
+    }
+
+    bool load(hyrisc_state_reader_t& r) override {
+        if (!r.expect("IOBS")) return false;
+
+        ext.port = r.u32();
+        ext.data = r.u32();
+        ext.rw   = r.u8();
+        ext.size = r.u32();
+
+        if (!r.good()) return false;
+
+        for (iobus_device_t* dev : devices)
+            if (!dev->load(r)) return false;
+
+        return true;
+    }
+
+    void update() override {
+        if (!proc->bci.busreq) return;
+        if (!access(proc->bci.a, proc->bci.d, proc->bci.rw, proc->bci.s)) return;
+
+        proc->bci.busack = true;
+        proc->bci.be = 0x0;
     }
 };
\ No newline at end of file
@@ -20,12 +20,14 @@
 
 #include <string>
 #include <iostream>
+#include <cstring>
 
 #include "device.hpp"
 #include "pci/device.hpp"
 #include "../../hyrisc/state.hpp"
 
 #include "../block.hpp"
+#include "../../log.hpp"
 
 #define IOBUS_ATA_PRI_IO   0x1f0
 #define IOBUS_ATA_PRI_CTRL 0x3f6
@@ -144,6 +146,24 @@ class iobus_dev_ata_t : public iobus_device_t {
     hyu16_t iobus_sec_io_base;
     hyu16_t iobus_sec_ctrl_base;
 
+    // Snapshot, drive images aren't part of it
+    struct {
+        pci_device_t dev;
+        int          index;
+        hyu16_t      ports[4];
+        int          drive_number[2];
+
+        struct {
+            hyu64_t rw_base_lba;
+            hyu16_t rw_sectors;
+            size_t  rw_pending_bytes;
+            uint8_t rw_buf[ATA_SECTOR_SIZE];
+            bool    rw_direction;
+            uint8_t error;
+            uint8_t status;
+        } drive[2][2];
+    } saved;
+
 #define ATA_ID_CFG_RESERVED1  0b0000000000000001
 #define ATA_ID_CFG_UNUSED3    0b0000000000000010
 #define ATA_ID_CFG_INCOMPLETE 0b0000000000000100 // 0 - Complete response, 1 - Incomplete response
@@ -788,6 +808,142 @@ public:
         dev.bar[3]   = PCI_BAR_IO | (iobus_sec_ctrl_base << 2); // Secondary Channel CTRL
     }
 
+    void snapshot() override {
+        saved.dev      = dev;
+        saved.index    = index;
+        saved.ports[0] = iobus_pri_io_base;
+        saved.ports[1] = iobus_pri_ctrl_base;
+        saved.ports[2] = iobus_sec_io_base;
+        saved.ports[3] = iobus_sec_ctrl_base;
+
+        for (int c = 0; c < 2; c++) {
+            saved.drive_number[c] = channel[c].drive_number;
+
+            for (int d = 0; d < 2; d++) {
+                auto& src = channel[c].drive[d];
+                auto& dst = saved.drive[c][d];
+
+                dst.rw_base_lba      = src.rw_base_lba;
+                dst.rw_sectors       = src.rw_sectors;
+                dst.rw_pending_bytes = src.rw_pending_bytes;
+                dst.rw_direction     = src.rw_direction;
+                dst.error            = src.error;
+                dst.status           = src.status;
+
+                std::memcpy(dst.rw_buf, src.rw_buf, ATA_SECTOR_SIZE);
+            }
+        }
+    }
+
+    void restore() override {
+        dev                 = saved.dev;
+        index               = saved.index;
+        iobus_pri_io_base   = saved.ports[0];
+        iobus_pri_ctrl_base = saved.ports[1];
+        iobus_sec_io_base   = saved.ports[2];
+        iobus_sec_ctrl_base = saved.ports[3];
+
+        for (int c = 0; c < 2; c++) {
+            channel[c].drive_number = saved.drive_number[c];
+
+            for (int d = 0; d < 2; d++) {
+                auto& src = saved.drive[c][d];
+                auto& dst = channel[c].drive[d];
+
+                dst.rw_base_lba      = src.rw_base_lba;
+                dst.rw_sectors       = src.rw_sectors;
+                dst.rw_pending_bytes = src.rw_pending_bytes;
+                dst.rw_direction     = src.rw_direction;
+                dst.error            = src.error;
+                dst.status           = src.status;
+
+                std::memcpy(dst.rw_buf, src.rw_buf, ATA_SECTOR_SIZE);
+            }
+        }
+    }
+
+    // Drive images aren't saved, only their size, to check the same
+    // ones are attached when loading
+    void save(hyrisc_state_writer_t& w) override {
+        w.begin("ATA ", 1);
+
+        w.u8 (dev.disabled);
+        w.u32(dev.status);
+        w.u32(dev.command);
+
+        for (int b = 0; b < 6; b++) w.u32(dev.bar[b]);
+
+        w.u32(index);
+        w.u16(iobus_pri_io_base);
+        w.u16(iobus_pri_ctrl_base);
+        w.u16(iobus_sec_io_base);
+        w.u16(iobus_sec_ctrl_base);
+
+        for (int c = 0; c < 2; c++) {
+            w.u32(channel[c].drive_number);
+
+            for (int d = 0; d < 2; d++) {
+                auto& drive = channel[c].drive[d];
+
+                w.u8 (drive.blk.is_open());
+                w.u64(drive.blk.is_open() ? drive.blk.m_bytes : 0);
+                w.u64(drive.rw_base_lba);
+                w.u16(drive.rw_sectors);
+                w.u64(drive.rw_pending_bytes);
+                w.u8 (drive.rw_direction);
+                w.u8 (drive.error);
+                w.u8 (drive.status);
+                w.bytes(drive.rw_buf, ATA_SECTOR_SIZE);
+            }
+        }
+
+        w.end();
+    }
+
+    bool load(hyrisc_state_reader_t& r) override {
+        if (!r.expect("ATA ")) return false;
+
+        dev.disabled = r.u8();
+        dev.status   = r.u32();
+        dev.command  = r.u32();
+
+        for (int b = 0; b < 6; b++) dev.bar[b] = r.u32();
+
+        index               = r.u32();
+        iobus_pri_io_base   = r.u16();
+        iobus_pri_ctrl_base = r.u16();
+        iobus_sec_io_base   = r.u16();
+        iobus_sec_ctrl_base = r.u16();
+
+        for (int c = 0; c < 2; c++) {
+            channel[c].drive_number = r.u32();
+
+            for (int d = 0; d < 2; d++) {
+                auto& drive = channel[c].drive[d];
+
+                bool    open  = r.u8();
+                hyu64_t bytes = r.u64();
+
+                if ((open != drive.blk.is_open()) || (open && (bytes != drive.blk.m_bytes))) {
+                    _log(error, "ATA drive %u:%u doesn't match the saved state", c, d);
+
+                    return false;
+                }
+
+                drive.rw_base_lba      = r.u64();
+                drive.rw_sectors       = r.u16();
+                drive.rw_pending_bytes = r.u64();
+                drive.rw_direction     = r.u8();
+                drive.error            = r.u8();
+                drive.status           = r.u8();
+
+                r.bytes(drive.rw_buf, ATA_SECTOR_SIZE);
+            }
+        }
+
+        return r.good();
+    }
+
     // ATA has two buses, a "Primary" bus, and a "Secondary" bus
     // supporting up to two drives each, named "Master" and "Slave"
     void update() override {
@@ -2,8 +2,16 @@
 
 #include "ext.hpp"
 
+#include "../../hyrisc/savestate.hpp"
+
 class iobus_device_t {
 public:
     virtual void init(iobus_ext_t* iobus) {};
     virtual void update() {};
+
+    // Same as device_t
+    virtual void snapshot() {};
+    virtual void restore() {};
+    virtual void save(hyrisc_state_writer_t& w) {};
+    virtual bool load(hyrisc_state_reader_t& r) { return true; };
 };
\ No newline at end of file
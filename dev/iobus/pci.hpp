@@ -43,6 +43,9 @@ public:
     hyu8_t bus, device, function, reg;
     bool enable;
 
+    // Everything else is decoded from addr on every access
+    hyu32_t saved_addr;
+
     void register_device(pci_device_t* dev, int bus, int device) {
         dev->bus    = bus;
         dev->device = device;
@@ -54,6 +57,28 @@ public:
         this->iobus = iobus;
     }
 
+    void snapshot() override {
+        saved_addr = addr;
+    }
+
+    void restore() override {
+        addr = saved_addr;
+    }
+
+    void save(hyrisc_state_writer_t& w) override {
+        w.begin("PCI ", 1);
+        w.u32(addr);
+        w.end();
+    }
+
+    bool load(hyrisc_state_reader_t& r) override {
+        if (!r.expect("PCI ")) return false;
+
+        addr = r.u32();
+
+        return r.good();
+    }
+
     void update() override {
         switch (iobus->port) {
             case IOBUS_PCI_CFG_ADDR: {
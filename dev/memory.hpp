@@ -4,16 +4,331 @@
 
 #include "device.hpp"
 
-#include <fstream>
+#include "../log.hpp"
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#endif
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define MEMORY_COW_SNAPSHOTS
+
+// PAGEMAP_SCAN from linux/fs.h (6.7), older headers don't have it
+#define MEMORY_PAGE_IS_FILE    (1 << 2)
+#define MEMORY_PAGE_IS_PRESENT (1 << 3)
+#define MEMORY_PAGE_IS_SWAPPED (1 << 4)
+
+struct memory_page_region_t {
+    hyu64_t start;
+    hyu64_t end;
+    hyu64_t categories;
+};
+
+struct memory_pm_scan_arg_t {
+    hyu64_t size;
+    hyu64_t flags;
+    hyu64_t start;
+    hyu64_t end;
+    hyu64_t walk_end;
+    hyu64_t vec;
+    hyu64_t vec_len;
+    hyu64_t max_pages;
+    hyu64_t category_inverted;
+    hyu64_t category_mask;
+    hyu64_t category_anyof_mask;
+    hyu64_t return_mask;
+};
+
+#define MEMORY_PAGEMAP_SCAN _IOWR('f', 16, memory_pm_scan_arg_t)
+#endif
+
+// RAM
+// Backed by a host reservation of the whole region, pages are only
+// committed (and zeroed) by the host on first touch, so large RAM
+// sizes start instantly and only cost what the guest actually uses.
+// Regions of 2 MiB or more are aligned for transparent huge pages.
+// RAM can also be placed at a fixed host address, like a fastmem
+// region, and turns back into guard pages when released.
+//
+// Snapshots
+// On Linux RAM is a private mapping of a memfd holding the last
+// snapshot, pages the guest writes to become private copies. Taking
+// a snapshot writes those back to the memfd (found through
+// /proc/self/pagemap), restoring drops them, so both only cost as
+// much as the pages dirtied since. Elsewhere snapshots are copies.
+// Private copies are always small pages, so RAM only gets huge pages
+// without snapshots or for pages the guest never writes to.
+//
+// Save-states
+// Only pages holding data are saved, as runs of PAGE chunks. On Linux
+// saves also move the snapshot to the saved state, so incremental
+// saves only hold the pages dirtied since the last save made to the
+// same stream.
+//
+// Deltas
+// Reverse execution (see dev/reverse.hpp) moves the snapshot forward
+// through deltas, which hand back what the dirtied pages held before
+// so it can be rolled back later. Linux only.
+
+#define MEMORY_HUGE_PAGE_SIZE 0x200000
+#define MEMORY_STATE_RUN      0x100000 // Largest PAGE chunk
+
 class dev_memory_t : public device_t {
     hyrisc_ext_t* proc;
 
-    std::vector <hyu8_t> phys;
+    hyu8_t* phys = nullptr;
+    hyu64_t size = 0;
+
+    // Host mapping, may be larger than the region for alignment
+    void*  mapping = nullptr;
+    size_t mapping_size = 0;
+    bool   placed = false;
 
     hyu32_t base;
 
+    // Snapshot backing, see above
+    int  fd = -1;
+    bool saved = false;
+
+    // Kept open between snapshots, it belongs to the process that
+    // opened it (forked children need their own)
+    int   pagemap = -1;
+    pid_t pagemap_pid = 0;
+    bool  pagemap_scan = true;
+
+    // Writer the snapshot was last saved to, incremental saves are
+    // only possible on that one
+    const hyrisc_state_writer_t* checkpoint = nullptr;
+
+    std::vector <hyu8_t> copy;
+
+#ifdef MEMORY_COW_SNAPSHOTS
+    // Runs of dirty pages through PAGEMAP_SCAN (Linux 6.7), the kernel
+    // only walks the page tables that are there
+    template <class F> bool scan_dirty(F& fn) {
+        memory_page_region_t regions[0x40];
+
+        memory_pm_scan_arg_t arg;
+
+        std::memset(&arg, 0, sizeof(arg));
+
+        arg.size    = sizeof(arg);
+        arg.start   = (uintptr_t)phys;
+        arg.end     = (uintptr_t)phys + size;
+        arg.vec     = (uintptr_t)regions;
+        arg.vec_len = 0x40;
+
+        // Anonymous (not file backed) and present, or swapped out
+        arg.category_inverted   = MEMORY_PAGE_IS_FILE;
+        arg.category_mask       = MEMORY_PAGE_IS_FILE;
+        arg.category_anyof_mask = MEMORY_PAGE_IS_PRESENT | MEMORY_PAGE_IS_SWAPPED;
+
+        while (arg.start < arg.end) {
+            int count = ioctl(pagemap, MEMORY_PAGEMAP_SCAN, &arg);
+
+            if (count < 0) {
+                pagemap_scan = (errno != ENOTTY) && (errno != EINVAL);
+
+                return false;
+            }
+
+            for (int i = 0; i < count; i++)
+                if (!fn(regions[i].start - (uintptr_t)phys, regions[i].end - regions[i].start))
+                    return false;
+
+            arg.start = arg.walk_end;
+        }
+
+        return true;
+    }
+
+    // Runs of dirty pages from the whole pagemap
+    template <class F> bool read_dirty(F& fn) {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t pages = size / page_size;
+        size_t first = (uintptr_t)phys / page_size;
+
+        hyu64_t entries[0x200];
+
+        hyu64_t run_start = 0, run_size = 0;
+
+        for (size_t i = 0; i < pages; i += 0x200) {
+            size_t count = ((pages - i) < 0x200) ? (pages - i) : 0x200;
+            size_t bytes = count * sizeof(hyu64_t);
+
+            if (pread(pagemap, entries, bytes, (first + i) * sizeof(hyu64_t)) != (ssize_t)bytes) return false;
+
+            for (size_t j = 0; j < count; j++) {
+                // Present anonymous pages (not file backed), or swapped out
+                bool present = (entries[j] >> 63) & 1;
+                bool swapped = (entries[j] >> 62) & 1;
+                bool file    = (entries[j] >> 61) & 1;
+
+                if (!swapped && !(present && !file)) continue;
+
+                hyu64_t offset = (i + j) * page_size;
+
+                if (run_size && ((run_start + run_size) == offset)) {
+                    run_size += page_size;
+
+                    continue;
+                }
+
+                if (run_size && !fn(run_start, run_size)) return false;
+
+                run_start = offset;
+                run_size  = page_size;
+            }
+        }
+
+        return !run_size || fn(run_start, run_size);
+    }
+
+    // Calls fn(offset, bytes) for every run of pages privately copied
+    // since the last snapshot, returns false if they couldn't be found
+    // or fn failed
+    template <class F> bool for_each_dirty(F fn) {
+        if ((pagemap >= 0) && (pagemap_pid != getpid())) {
+            close(pagemap);
+
+            pagemap = -1;
+        }
+
+        if (pagemap < 0) {
+            pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+            pagemap_pid = getpid();
+        }
+
+        if (pagemap < 0) return false;
+
+        if (pagemap_scan) {
+            if (scan_dirty(fn)) return true;
+
+            // Falls back if the kernel doesn't have it
+            if (pagemap_scan) return false;
+        }
+
+        return read_dirty(fn);
+    }
+
+    // Drops private copies, RAM goes back to what the memfd holds
+    void drop(hyu64_t offset, hyu64_t bytes) {
+        madvise(phys + offset, bytes, MADV_DONTNEED);
+    }
+
+    void drop_dirty() {
+        bool found = for_each_dirty([this](hyu64_t offset, hyu64_t bytes) {
+            drop(offset, bytes);
+
+            return true;
+        });
+
+        if (!found) drop(0, size);
+    }
+
+    bool write_back(hyu64_t offset, hyu64_t bytes) {
+        return pwrite(fd, phys + offset, bytes, offset) == (ssize_t)bytes;
+    }
+#endif
+
+    void save_run(hyrisc_state_writer_t& w, hyu64_t offset, hyu64_t bytes) {
+        while (bytes) {
+            hyu64_t run = (bytes < MEMORY_STATE_RUN) ? bytes : MEMORY_STATE_RUN;
+
+            w.begin("PAGE", 1);
+            w.u64(offset);
+            w.bytes(phys + offset, run);
+            w.end();
+
+            offset += run;
+            bytes  -= run;
+        }
+    }
+
+    // Every page holding data
+    void save_full(hyrisc_state_writer_t& w) {
+#ifdef MEMORY_COW_SNAPSHOTS
+        if (fd >= 0) {
+            // Everything is in the memfd after a snapshot, data runs
+            // can be found without looking at the pages
+            snapshot();
+
+            off_t offset = 0;
+
+            while ((offset = lseek(fd, offset, SEEK_DATA)) >= 0) {
+                off_t hole = lseek(fd, offset, SEEK_HOLE);
+
+                if ((hole < 0) || ((hyu64_t)hole > size)) hole = size;
+
+                save_run(w, offset, hole - offset);
+
+                offset = hole;
+            }
+
+            checkpoint = &w;
+
+            return;
+        }
+#endif
+
+        // Skip pages that are all zeros
+        for (hyu64_t offset = 0; offset < size; offset += 0x1000) {
+            hyu64_t bytes = ((size - offset) < 0x1000) ? (size - offset) : 0x1000;
+
+            bool zero = true;
+
+            for (hyu64_t i = 0; zero && (i < bytes); i++)
+                zero = !phys[offset + i];
+
+            if (!zero) save_run(w, offset, bytes);
+        }
+    }
+
+    void release() {
+        if (!mapping) return;
+
+#ifdef MEMORY_COW_SNAPSHOTS
+        if (fd >= 0) close(fd);
+        if (pagemap >= 0) close(pagemap);
+
+        fd = -1;
+        pagemap = -1;
+#endif
+
+        saved = false;
+
+        copy.clear();
+
+#ifdef _WIN32
+        VirtualFree(mapping, 0, MEM_RELEASE);
+#else
+        if (placed) {
+            mmap(mapping, mapping_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        } else {
+            munmap(mapping, mapping_size);
+        }
+#endif
+
+        mapping = nullptr;
+        phys = nullptr;
+    }
+
     hyu8_t read8(hyu32_t addr) {
         return phys[addr];
     }
@@ -41,10 +356,279 @@ class dev_memory_t : public device_t {
     }
 
 public:
-    void create(size_t size, hyu32_t base) {
-        phys.resize(size);
+    ~dev_memory_t() {
+        release();
+    }
+
+    // Returns false if the host couldn't reserve the region. at is
+    // an optional page-aligned host address to map it at
+    bool create(hyu64_t size, hyu32_t base, hyu8_t* at = nullptr) {
+        release();
 
+        this->size = size;
         this->base = base;
+
+        placed = at != nullptr;
+
+        bool huge = size >= MEMORY_HUGE_PAGE_SIZE;
+
+        mapping_size = size + ((huge && !placed) ? MEMORY_HUGE_PAGE_SIZE : 0);
+
+#ifdef _WIN32
+        if (placed) return false;
+
+        mapping = VirtualAlloc(nullptr, mapping_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (placed ? MAP_FIXED : 0);
+
+        mapping = mmap(at, mapping_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+        if (mapping == MAP_FAILED) mapping = nullptr;
+#endif
+
+        if (!mapping) return false;
+
+        uintptr_t start = (uintptr_t)mapping;
+
+        if (huge && !placed) start = (start + (MEMORY_HUGE_PAGE_SIZE - 1)) & ~(uintptr_t)(MEMORY_HUGE_PAGE_SIZE - 1);
+
+        phys = (hyu8_t*)start;
+
+#ifdef MADV_HUGEPAGE
+        if (huge) madvise(phys, size & ~(hyu64_t)(MEMORY_HUGE_PAGE_SIZE - 1), MADV_HUGEPAGE);
+#endif
+
+#ifdef MEMORY_COW_SNAPSHOTS
+        // Swap the anonymous pages for a private view of an (empty)
+        // memfd, snapshots fall back to copies if that doesn't work
+        fd = memfd_create("hyrisc-ram", MFD_CLOEXEC);
+
+        if ((fd >= 0) && ftruncate(fd, size)) {
+            close(fd);
+
+            fd = -1;
+        }
+
+        if (fd >= 0) {
+            void* view = mmap(phys, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, fd, 0);
+
+            if (view == MAP_FAILED) {
+                mmap(phys, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+                close(fd);
+
+                fd = -1;
+            }
+
+            // The advice went with the mapping that was replaced
+#ifdef MADV_HUGEPAGE
+            if (huge) madvise(phys, size & ~(hyu64_t)(MEMORY_HUGE_PAGE_SIZE - 1), MADV_HUGEPAGE);
+#endif
+        }
+#endif
+
+        return true;
+    }
+
+    void snapshot() override {
+        saved = true;
+
+#ifdef MEMORY_COW_SNAPSHOTS
+        if (fd >= 0) {
+            // Once the memfd matches RAM, private copies can go
+            bool found = for_each_dirty([this](hyu64_t offset, hyu64_t bytes) {
+                if (!write_back(offset, bytes)) return false;
+
+                drop(offset, bytes);
+
+                return true;
+            });
+
+            // Couldn't find the dirty pages, write everything back
+            if (!found) {
+                if (!write_back(0, size)) {
+                    _log(error, "Couldn't write RAM snapshot");
+                }
+
+                drop(0, size);
+            }
+
+            checkpoint = nullptr;
+
+            return;
+        }
+#endif
+
+        copy.assign(phys, phys + size);
+    }
+
+    // True if deltas are supported, the dirty pages have to be found
+    // for them
+    bool has_deltas() {
+#ifdef MEMORY_COW_SNAPSHOTS
+        return (fd >= 0) && for_each_dirty([](hyu64_t, hyu64_t) { return true; });
+#else
+        return false;
+#endif
+    }
+
+    // Moves the snapshot to the current state, like snapshot(), and
+    // appends the previous contents of the pages dirtied since to
+    // offsets and data. Returns false if they couldn't be found, the
+    // snapshot still moves but the delta is incomplete
+    bool take_delta(std::vector <hyu64_t>& offsets, std::vector <hyu8_t>& data) {
+#ifdef MEMORY_COW_SNAPSHOTS
+        if (fd < 0) return false;
+
+        size_t page_size = sysconf(_SC_PAGESIZE);
+
+        bool found = for_each_dirty([&](hyu64_t offset, hyu64_t bytes) {
+            size_t end = data.size();
+
+            data.resize(end + bytes);
+
+            if (pread(fd, data.data() + end, bytes, offset) != (ssize_t)bytes) return false;
+
+            for (hyu64_t page = 0; page < bytes; page += page_size)
+                offsets.push_back(offset + page);
+
+            if (!write_back(offset, bytes)) return false;
+
+            drop(offset, bytes);
+
+            return true;
+        });
+
+        // Pages still private would be lost when dropped
+        if (!found) {
+            if (!write_back(0, size)) {
+                _log(error, "Couldn't write RAM snapshot");
+            }
+
+            drop(0, size);
+        }
+
+        saved = true;
+        checkpoint = nullptr;
+
+        return found;
+#else
+        return false;
+#endif
+    }
+
+    // Rolls the snapshot back through a delta, RAM is left holding
+    // the snapshot
+    bool undo_delta(const std::vector <hyu64_t>& offsets, const std::vector <hyu8_t>& data) {
+#ifdef MEMORY_COW_SNAPSHOTS
+        if (fd < 0) return false;
+
+        size_t page_size = sysconf(_SC_PAGESIZE);
+
+        drop_dirty();
+
+        for (size_t i = 0; i < offsets.size(); i++)
+            if (pwrite(fd, data.data() + i * page_size, page_size, offsets[i]) != (ssize_t)page_size)
+                return false;
+
+        checkpoint = nullptr;
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void save(hyrisc_state_writer_t& w) override {
+        bool incremental = false;
+
+#ifdef MEMORY_COW_SNAPSHOTS
+        incremental = w.is_incremental() && (fd >= 0) && (checkpoint == &w);
+#endif
+
+        w.begin("RAM ", 1);
+        w.u32(base);
+        w.u64(size);
+        w.u8 (incremental);
+        w.end();
+
+        if (!incremental) {
+            save_full(w);
+
+            return;
+        }
+
+#ifdef MEMORY_COW_SNAPSHOTS
+        bool found = for_each_dirty([&](hyu64_t offset, hyu64_t bytes) {
+            save_run(w, offset, bytes);
+
+            if (!write_back(offset, bytes)) return false;
+
+            drop(offset, bytes);
+
+            return true;
+        });
+
+        // The next save has to be a full one
+        if (!found) {
+            _log(error, "Couldn't find RAM pages dirtied since the last save");
+
+            checkpoint = nullptr;
+
+            drop(0, size);
+        }
+#endif
+    }
+
+    bool load(hyrisc_state_reader_t& r) override {
+        if (!r.expect("RAM ")) return false;
+
+        if ((r.u32() != base) || (r.u64() != size)) return false;
+
+        bool incremental = r.u8();
+
+        if (!incremental) {
+#ifdef MEMORY_COW_SNAPSHOTS
+            if (fd >= 0) {
+                // Empty the memfd and drop private copies
+                if (ftruncate(fd, 0) || ftruncate(fd, size)) return false;
+
+                drop_dirty();
+            } else
+#endif
+            std::memset(phys, 0, size);
+        }
+
+        while (r.peek("PAGE")) {
+            r.expect("PAGE");
+
+            hyu64_t offset = r.u64();
+            hyu64_t bytes = r.remaining();
+
+            if ((offset > size) || (bytes > (size - offset))) return false;
+
+            r.bytes(phys + offset, bytes);
+        }
+
+        // The loaded state is the new snapshot, but it isn't the last
+        // state saved to whatever stream is written next
+        snapshot();
+
+        return r.good();
+    }
+
+    void restore() override {
+        if (!saved) return;
+
+#ifdef MEMORY_COW_SNAPSHOTS
+        if (fd >= 0) {
+            drop_dirty();
+
+            return;
+        }
+#endif
+
+        std::memcpy(phys, copy.data(), size);
     }
 
     hyu32_t read(hyu32_t addr, hyint_t size) {
@@ -71,18 +655,37 @@ public:
         this->proc = proc;
     }
 
-    void update() override {
-        bool address_in_range = (proc->bci.a >= base) && (proc->bci.a < (base + phys.size()));
+    bool access(hyu32_t addr, hyu32_t& data, hybool_t rw, hyint_t size) override {
+        bool address_in_range = (addr >= base) && ((hyu64_t)(addr - base) < this->size);
 
-        if (!address_in_range) return;
+        if (!address_in_range) return false;
+
+        bool partial = device_partial_access(addr - base, this->size, data, rw, size,
+            [this](hyu32_t offset) { return this->read8(offset); },
+            [this](hyu32_t offset, hyu32_t value) { this->write8(offset, value); }
+        );
+
+        if (partial) return true;
+
+        switch (rw) {
+            case RW_READ : data = read(addr - base, size); break;
+            case RW_WRITE: write(addr - base, data, size); break;
+        }
+
+        return true;
+    }
+
+    hyu8_t* host_pointer(hyu32_t addr, hyu32_t size) override {
+        if ((addr < base) || ((hyu64_t)(addr - base) + size > this->size)) return nullptr;
+
+        return phys + (addr - base);
+    }
+
+    void update() override {
         if (!proc->bci.busreq) return;
+        if (!access(proc->bci.a, proc->bci.d, proc->bci.rw, proc->bci.s)) return;
 
         proc->bci.busack = true;
         proc->bci.be = 0x0;
-        
-        switch (proc->bci.rw) {
-            case 0: proc->bci.d = read(proc->bci.a - base, proc->bci.s); break;
-            case 1: write(proc->bci.a - base, proc->bci.d, proc->bci.s); break;
-        }
     }
 };
\ No newline at end of file
@@ -0,0 +1,357 @@
+#pragma once
+
+#include "../hyrisc/hyrisc.hpp"
+
+#include "bus.hpp"
+#include "memory.hpp"
+
+#include <chrono>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
+
+// Reverse execution
+// Checkpoints of the CPU and devices are taken every so many retired
+// instructions while running. RAM only keeps the snapshot the last
+// checkpoint left in it, plus an undo delta per checkpoint holding
+// what the pages dirtied until the next one held before. Going back
+// rolls RAM back through the deltas to the nearest checkpoint and
+// runs forward from there to the exact instruction.
+//
+// Spacing follows the host's speed so that running forward from a
+// checkpoint takes about REVERSE_TARGET_NS. When checkpoints take up
+// more than the memory budget, the ones closest to their neighbours
+// relative to their age are merged away, so recent history stays
+// dense and older history gets sparser.
+//
+// Execution has to be deterministic between checkpoints: host input
+// has to be played back (see hyrisc_replay_t::set_rewindable), and
+// nothing else may move the RAM snapshot while this is in use.
+
+#define REVERSE_TARGET_NS    50000000ull // Leaves room for restoring
+#define REVERSE_MIN_INTERVAL 0x1000
+#define REVERSE_MAX_INTERVAL 0x100000000ull
+
+class dev_reverse_t {
+    struct checkpoint_t {
+        hyu64_t           at;
+        hyrisc_snapshot_t cpu;
+        std::string       devices;
+
+        // Undo delta to the next checkpoint
+        std::vector <hyu64_t> offsets;
+        std::vector <hyu8_t>  pages;
+    };
+
+    hyrisc_t*     proc;
+    dev_bus_t*    bus;
+    dev_memory_t* memory;
+
+    std::vector <checkpoint_t> history;
+
+    hyu64_t budget;
+    hyu64_t used = 0;
+    hyu64_t interval = REVERSE_MIN_INTERVAL;
+
+    // Host speed, in instructions retired and time spent running
+    hyu64_t run_instructions = 0;
+    hyu64_t run_ns = 0;
+
+    static hyu64_t cost(const checkpoint_t& c) {
+        return sizeof(checkpoint_t) + c.devices.size() + c.pages.size() + c.offsets.size() * sizeof(hyu64_t);
+    }
+
+    void save_devices(checkpoint_t& c) {
+        std::ostringstream out(std::ios::binary);
+
+        hyrisc_state_writer_t w;
+
+        w.open(out);
+
+        for (device_t* dev : bus->get_devices())
+            if (dev != memory) dev->save(w);
+
+        c.devices = out.str();
+    }
+
+    bool load_devices(const checkpoint_t& c) {
+        std::istringstream in(c.devices, std::ios::binary);
+
+        hyrisc_state_reader_t r;
+
+        if (!r.open(in)) return false;
+
+        for (device_t* dev : bus->get_devices())
+            if ((dev != memory) && !dev->load(r)) return false;
+
+        return true;
+    }
+
+    // Folds checkpoint i into the one before it, the delta of the
+    // one before has to cover both intervals
+    void merge(size_t i) {
+        checkpoint_t& prev = history[i - 1];
+        checkpoint_t& next = history[i];
+
+        used -= cost(prev) + cost(next);
+
+        std::unordered_set <hyu64_t> covered(prev.offsets.begin(), prev.offsets.end());
+
+        size_t page = next.offsets.empty() ? 0 : next.pages.size() / next.offsets.size();
+
+        // Pages only dirtied later still held the same at prev
+        for (size_t p = 0; p < next.offsets.size(); p++) {
+            if (covered.count(next.offsets[p])) continue;
+
+            prev.offsets.push_back(next.offsets[p]);
+            prev.pages.insert(prev.pages.end(), next.pages.begin() + p * page, next.pages.begin() + (p + 1) * page);
+        }
+
+        used += cost(prev);
+
+        history.erase(history.begin() + i);
+    }
+
+    void trim() {
+        while ((used > budget) && (history.size() > 2)) {
+            hyu64_t now = proc->internal.retired;
+
+            // Never the first (the oldest reachable point) or the
+            // last (RAM holds its snapshot)
+            size_t victim = 0;
+            double best = 0;
+
+            for (size_t i = 1; (i + 1) < history.size(); i++) {
+                double span = history[i + 1].at - history[i - 1].at;
+                double score = span / (double)(now - history[i].at + 1);
+
+                if (!victim || (score < best)) {
+                    victim = i;
+                    best = score;
+                }
+            }
+
+            // Only the first and last are left
+            if (!victim) break;
+
+            merge(victim);
+        }
+
+        // Still over, history has to start later
+        while ((used > budget) && (history.size() > 2)) {
+            used -= cost(history.front());
+
+            history.erase(history.begin());
+        }
+    }
+
+    void adapt() {
+        if (!run_ns) return;
+
+        double rate = (double)run_instructions / (double)run_ns;
+
+        hyu64_t target = rate * REVERSE_TARGET_NS;
+
+        if (target < REVERSE_MIN_INTERVAL) target = REVERSE_MIN_INTERVAL;
+        if (target > REVERSE_MAX_INTERVAL) target = REVERSE_MAX_INTERVAL;
+
+        interval = target;
+    }
+
+    // Brings back checkpoint i, everything after it is dropped
+    bool rewind(size_t i) {
+        for (size_t c = history.size() - 1; c-- > i;) {
+            if (!memory->undo_delta(history[c].offsets, history[c].pages)) return false;
+        }
+
+        // Dropping the private pages is all the last one needs
+        if ((i + 1) == history.size()) memory->restore();
+
+        for (size_t c = i + 1; c < history.size(); c++)
+            used -= cost(history[c]);
+
+        history.resize(i + 1);
+
+        checkpoint_t& c = history.back();
+
+        used -= cost(c);
+
+        c.offsets.clear();
+        c.pages.clear();
+
+        used += cost(c);
+
+        hyrisc_load_snapshot(proc, &c.cpu);
+
+        return load_devices(c);
+    }
+
+public:
+    // Returns false if RAM can't take deltas on this host
+    bool init(hyrisc_t* proc, dev_bus_t* bus, dev_memory_t* memory, hyu64_t budget) {
+        this->proc   = proc;
+        this->bus    = bus;
+        this->memory = memory;
+        this->budget = budget;
+
+        if (!memory->has_deltas()) return false;
+
+        history.clear();
+
+        used = 0;
+
+        // The first checkpoint starts off the snapshot
+        memory->snapshot();
+
+        checkpoint_t c;
+
+        c.at = proc->internal.retired;
+
+        hyrisc_save_snapshot(proc, &c.cpu);
+        save_devices(c);
+
+        used += cost(c);
+
+        history.push_back(std::move(c));
+
+        return true;
+    }
+
+    void checkpoint() {
+        checkpoint_t& last = history.back();
+
+        if (last.at == proc->internal.retired) return;
+
+        used -= cost(last);
+
+        bool delta = memory->take_delta(last.offsets, last.pages);
+
+        used += cost(last);
+
+        // Nothing before this one can be rolled back to, history has
+        // to start over here
+        if (!delta) {
+            _log(error, "Couldn't find RAM pages dirtied since the last checkpoint, dropping reverse history");
+
+            history.clear();
+
+            used = 0;
+        }
+
+        checkpoint_t c;
+
+        c.at = proc->internal.retired;
+
+        hyrisc_save_snapshot(proc, &c.cpu);
+        save_devices(c);
+
+        used += cost(c);
+
+        history.push_back(std::move(c));
+
+        adapt();
+        trim();
+    }
+
+    // Runs up to budget instructions forward taking checkpoints as
+    // they're due, returns the number of instructions retired. Stops
+    // early if the CPU gets frozen
+    hyu64_t run(hyu64_t budget) {
+        hyu64_t start = proc->internal.retired;
+
+        while (((proc->internal.retired - start) < budget) && !proc->ext.freeze) {
+            hyu64_t due = history.back().at + interval;
+
+            if (proc->internal.retired >= due) {
+                checkpoint();
+
+                continue;
+            }
+
+            hyu64_t left = budget - (proc->internal.retired - start);
+
+            if (left > (due - proc->internal.retired)) left = due - proc->internal.retired;
+
+            auto begin = std::chrono::steady_clock::now();
+
+            hyu64_t count = hyrisc_run(proc, left);
+
+            run_ns += std::chrono::duration_cast <std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - begin
+            ).count();
+
+            run_instructions += count;
+
+            if (!count) break;
+        }
+
+        return proc->internal.retired - start;
+    }
+
+    // Earliest instruction count that can still be reached
+    hyu64_t first() const {
+        return history.front().at;
+    }
+
+    // Moves to an exact instruction count, back or forward. Returns
+    // false if it's past the start of history or couldn't be reached
+    bool seek(hyu64_t target) {
+        if (target < first()) return false;
+
+        if (target < proc->internal.retired) {
+            size_t i = history.size() - 1;
+
+            while (history[i].at > target) i--;
+
+            if (!rewind(i)) return false;
+        }
+
+        while (proc->internal.retired < target)
+            if (!run(target - proc->internal.retired)) break;
+
+        return proc->internal.retired == target;
+    }
+
+    // Goes back to the last point before the current one where stop
+    // holds, checked between instructions. Returns false and goes to
+    // the start of history if there isn't one
+    template <class F> bool seek_back(F stop) {
+        hyu64_t now = proc->internal.retired;
+
+        size_t i = history.size();
+
+        while (i--) {
+            if (history[i].at >= now) continue;
+
+            hyu64_t end = (i + 1) < history.size() ? history[i + 1].at : now;
+
+            if (!seek(history[i].at)) return false;
+
+            hyu64_t found = 0;
+            bool hit = false;
+
+            while (proc->internal.retired < end) {
+                if (stop(proc)) {
+                    found = proc->internal.retired;
+                    hit = true;
+                }
+
+                if (!hyrisc_run(proc, 1)) break;
+            }
+
+            if (hit) return seek(found);
+        }
+
+        seek(first());
+
+        return false;
+    }
+
+    hyu64_t memory_used() const {
+        return used;
+    }
+
+    size_t checkpoints() const {
+        return history.size();
+    }
+};
\ No newline at end of file
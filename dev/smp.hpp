@@ -0,0 +1,110 @@
+#pragma once
+
+#include "../hyrisc/state.hpp"
+
+#include "device.hpp"
+
+#include <cstring>
+
+// SMP control
+// Lets cores sharing a board tell each other apart and synchronize,
+// the ISA has no atomic instructions. Every access goes through the
+// machine's device lock, so the locks are atomic between cores.
+//
+//   0x00       This core's number (read-only)
+//   0x04       Number of cores (read-only)
+//   0x80-0xff  32 hardware locks, reads return the lock's value and
+//              set it to 1 (test-and-set), writes store the value
+//
+// The machine sets the accessing core before every access.
+
+#define SMP_SIZE  0x100
+#define SMP_LOCKS 32
+
+class dev_smp_t : public device_t {
+    hyrisc_ext_t* proc;
+
+    hyu32_t base;
+    hyu32_t cores = 1;
+    hyu32_t core = 0;
+
+    hyu32_t locks[SMP_LOCKS] = { 0 };
+    hyu32_t saved[SMP_LOCKS] = { 0 };
+
+public:
+    void create(hyu32_t base, hyu32_t cores) {
+        this->base  = base;
+        this->cores = cores;
+    }
+
+    void set_core(hyu32_t core) {
+        this->core = core;
+    }
+
+    void init(hyrisc_ext_t* proc) override {
+        this->proc = proc;
+    }
+
+    bool access(hyu32_t addr, hyu32_t& data, hybool_t rw, hyint_t size) override {
+        if ((addr < base) || (addr >= (base + SMP_SIZE))) return false;
+
+        hyu32_t offset = addr - base;
+
+        if (offset >= 0x80) {
+            hyu32_t& lock = locks[(offset - 0x80) >> 2];
+
+            switch (rw) {
+                case RW_READ : data = lock; lock = 1; break;
+                case RW_WRITE: lock = data; break;
+            }
+
+            return true;
+        }
+
+        if (rw == RW_READ) {
+            switch (offset) {
+                case 0x0: data = core; break;
+                case 0x4: data = cores; break;
+                default : data = 0; break;
+            }
+        }
+
+        return true;
+    }
+
+    void snapshot() override {
+        std::memcpy(saved, locks, sizeof(locks));
+    }
+
+    void restore() override {
+        std::memcpy(locks, saved, sizeof(locks));
+    }
+
+    void save(hyrisc_state_writer_t& w) override {
+        w.begin("SMP ", 1);
+        w.u32(base);
+        w.u32(cores);
+
+        for (hyu32_t lock : locks)
+            w.u32(lock);
+
+        w.end();
+    }
+
+    bool load(hyrisc_state_reader_t& r) override {
+        if (!r.expect("SMP ") || (r.u32() != base) || (r.u32() != cores)) return false;
+
+        for (hyu32_t& lock : locks)
+            lock = r.u32();
+
+        return r.good();
+    }
+
+    void update() override {
+        if (!proc->bci.busreq) return;
+        if (!access(proc->bci.a, proc->bci.d, proc->bci.rw, proc->bci.s)) return;
+
+        proc->bci.busack = true;
+        proc->bci.be = 0x0;
+    }
+};
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../hyrisc/state.hpp"
+#include "../hyrisc/replay.hpp"
 
 #include "device.hpp"
 
@@ -11,7 +12,7 @@
 #ifdef _WIN32
 #include <conio.h>
 
-int getchar_impl() {
+inline int getchar_impl() {
     if (_kbhit()) {
         return _getch();
     } else {
@@ -25,10 +26,10 @@ int getchar_impl() {
 #include "termios.h"
 #include "unistd.h"
 
-int getchar_impl() {
+inline int getchar_impl() {
     int c;
  
-    static termios oldt, newt;
+    termios oldt, newt;
 
     tcgetattr(STDIN_FILENO, &oldt);
 
@@ -51,15 +52,36 @@ class dev_terminal_t : public device_t {
 
     hyu32_t base;
 
+    hyrisc_replay_t* replay = nullptr;
+
+    std::ostream* out = &std::cout;
+
+    hyrisc_input_t input = getchar_impl;
+
 public:
     void create(hyu32_t base) {
         this->base = base;
     }
 
+    // Keyboard input goes through the input log
+    void attach_replay(hyrisc_replay_t* replay) {
+        this->replay = replay;
+    }
+
+    // Output goes to stdout unless redirected
+    void attach_output(std::ostream* out) {
+        this->out = out;
+    }
+
+    // Keyboard input comes from the host terminal unless redirected
+    void attach_input(hyrisc_input_t input) {
+        this->input = input;
+    }
+
     hyu32_t read(hyu32_t addr, hyint_t size) {
         switch (addr) {
             case 0x0: return 0x0;
-            case 0x1: return getchar_impl();
+            case 0x1: return replay ? replay->input(HYRISC_INPUT_TERMINAL, input) : input();
         }
 
         return 0x0;
@@ -67,7 +89,7 @@ public:
     
     void write(hyu32_t addr, hyu32_t value, hyint_t size) {
         if (addr == 0x0) {
-            std::cout << (char)(value & 0xff);
+            *out << (char)(value & 0xff);
         }
     }
 
@@ -75,18 +97,34 @@ public:
         this->proc = proc;
     }
 
-    void update() override {
-        bool address_in_range = (proc->bci.a >= base) && (proc->bci.a <= (base + 2));
+    bool access(hyu32_t addr, hyu32_t& data, hybool_t rw, hyint_t size) override {
+        bool address_in_range = (addr >= base) && (addr <= (base + 2));
+
+        if (!address_in_range) return false;
 
-        if (!address_in_range) return;
+        switch (rw) {
+            case RW_READ : data = read(addr - base, size); break;
+            case RW_WRITE: write(addr - base, data, size); break;
+        }
+
+        return true;
+    }
+
+    void save(hyrisc_state_writer_t& w) override {
+        w.begin("TERM", 1);
+        w.u32(base);
+        w.end();
+    }
+
+    bool load(hyrisc_state_reader_t& r) override {
+        return r.expect("TERM") && (r.u32() == base) && r.good();
+    }
+
+    void update() override {
         if (!proc->bci.busreq) return;
+        if (!access(proc->bci.a, proc->bci.d, proc->bci.rw, proc->bci.s)) return;
 
         proc->bci.busack = true;
         proc->bci.be = 0x0;
-        
-        switch (proc->bci.rw) {
-            case 0: proc->bci.d = read(proc->bci.a - base, proc->bci.s); break;
-            case 1: write(proc->bci.a - base, proc->bci.d, proc->bci.s); break;
-        }
     }
 };
\ No newline at end of file
@@ -60,12 +60,17 @@
 #define HYRISC_OPT_I16   0xd // 16-bit Immediate
 #define HYRISC_OPT_RI8   0xe // Register, 8-bit Immediate
 #define HYRISC_OPT_RI5   0xf // Register, 5-bit Immediate
+#define HYRISC_OPT_3F    0x10 // 3 FPU Registers
+#define HYRISC_OPT_2F    0x11 // 2 FPU Registers
+#define HYRISC_OPT_RF    0x12 // Register, FPU Register
+#define HYRISC_OPT_FR    0x13 // FPU Register, Register
 
 // Size operand usage
 #define HYRISC_SOP_NONE       0x0
 #define HYRISC_SOP_LOAD_STORE 0x1
 #define HYRISC_SOP_INC_DEC    0x2
 #define HYRISC_SOP_BRANCH     0x3
+#define HYRISC_SOP_VECTOR     0x4
 
 // Conditional
 #define HYRISC_NO_COND        0x0
@@ -148,6 +153,42 @@ enum hyrisc_opcodes_t {
     HY_PUSHS     = 0x9d,
     HY_POPS      = 0x9c,
     HY_NOP       = 0x8f,
+    HY_FSIN      = 0x8a, // FPU Trig extension
+    HY_FCOS      = 0x89,
+    HY_FTAN      = 0x88,
+    HY_FASIN     = 0x87,
+    HY_FACOS     = 0x86,
+    HY_FATAN     = 0x85,
+    HY_FSINH     = 0x84,
+    HY_FCOSH     = 0x83,
+    HY_FTANH     = 0x82,
+    HY_FMVRF     = 0x81, // Move r to f
+    HY_FMVFR     = 0x80, // Move f to r
+    HY_FADD      = 0x7f, // FPU Basic ISA
+    HY_FSUB      = 0x7e,
+    HY_FMUL      = 0x7d,
+    HY_FDIV      = 0x7c,
+    HY_FFMA      = 0x7b,
+    HY_FSQRT     = 0x7a,
+    HY_FPOW      = 0x79,
+    HY_FABS      = 0x78,
+    HY_FMOD      = 0x77,
+    HY_FEXP      = 0x76,
+    HY_FMIN      = 0x75,
+    HY_FMAX      = 0x74,
+    HY_FROUND    = 0x73,
+    HY_FCLAMP    = 0x72,
+    HY_FCVTI     = 0x71,
+    HY_FCVTF     = 0x70,
+    HY_FVWVG     = 0x68, // FPU Vector extension
+    HY_FVAVG     = 0x67,
+    HY_FVWSM     = 0x66,
+    HY_FVSUM     = 0x65,
+    HY_FVFMA     = 0x64,
+    HY_FVDIV     = 0x63,
+    HY_FVMUL     = 0x62,
+    HY_FVSUB     = 0x61,
+    HY_FVADD     = 0x60,
     HY_BAD       = 0x00
 };
 
@@ -279,33 +320,33 @@ const hyrisc_opc_info_t hyrisc_opc_info[256] = {
     [0x8d] = { 0x8d        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
     [0x8c] = { 0x8c        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
     [0x8b] = { 0x8b        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x8a] = { 0x8a        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x89] = { 0x89        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x88] = { 0x88        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x87] = { 0x87        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x86] = { 0x86        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x85] = { 0x85        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x84] = { 0x84        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x83] = { 0x83        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x82] = { 0x82        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x81] = { 0x81        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x80] = { 0x80        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x7f] = { 0x7f        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x7e] = { 0x7e        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x7d] = { 0x7d        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x7c] = { 0x7c        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x7b] = { 0x7b        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x7a] = { 0x7a        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x79] = { 0x79        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x78] = { 0x78        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x77] = { 0x77        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x76] = { 0x76        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x75] = { 0x75        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x74] = { 0x74        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x73] = { 0x73        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x72] = { 0x72        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x71] = { 0x71        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x70] = { 0x70        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
+    [0x8a] = { HY_FSIN     , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fsin"  },
+    [0x89] = { HY_FCOS     , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fcos"  },
+    [0x88] = { HY_FTAN     , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "ftan"  },
+    [0x87] = { HY_FASIN    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fasin" },
+    [0x86] = { HY_FACOS    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "facos" },
+    [0x85] = { HY_FATAN    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fatan" },
+    [0x84] = { HY_FSINH    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fsinh" },
+    [0x83] = { HY_FCOSH    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fcosh" },
+    [0x82] = { HY_FTANH    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "ftanh" },
+    [0x81] = { HY_FMVRF    , HYRISC_ENC_4, HYRISC_OPT_FR  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fmv"   },
+    [0x80] = { HY_FMVFR    , HYRISC_ENC_4, HYRISC_OPT_RF  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fmv"   },
+    [0x7f] = { HY_FADD     , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fadd"  },
+    [0x7e] = { HY_FSUB     , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fsub"  },
+    [0x7d] = { HY_FMUL     , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fmul"  },
+    [0x7c] = { HY_FDIV     , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fdiv"  },
+    [0x7b] = { HY_FFMA     , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "ffma"  },
+    [0x7a] = { HY_FSQRT    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fsqrt" },
+    [0x79] = { HY_FPOW     , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fpow"  },
+    [0x78] = { HY_FABS     , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fabs"  },
+    [0x77] = { HY_FMOD     , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fmod"  },
+    [0x76] = { HY_FEXP     , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fexp"  },
+    [0x75] = { HY_FMIN     , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fmin"  },
+    [0x74] = { HY_FMAX     , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fmax"  },
+    [0x73] = { HY_FROUND   , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fround" },
+    [0x72] = { HY_FCLAMP   , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fclamp" },
+    [0x71] = { HY_FCVTI    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fcvti" },
+    [0x70] = { HY_FCVTF    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_NONE      , HYRISC_NO_COND, "fcvtf" },
     [0x6f] = { 0x6f        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
     [0x6e] = { 0x6e        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
     [0x6d] = { 0x6d        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
@@ -313,15 +354,15 @@ const hyrisc_opc_info_t hyrisc_opc_info[256] = {
     [0x6b] = { 0x6b        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
     [0x6a] = { 0x6a        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
     [0x69] = { 0x69        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x68] = { 0x68        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x67] = { 0x67        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x66] = { 0x66        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x65] = { 0x65        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x64] = { 0x64        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x63] = { 0x63        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x62] = { 0x62        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x61] = { 0x61        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
-    [0x60] = { 0x60        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
+    [0x68] = { HY_FVWVG    , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_VECTOR    , HYRISC_NO_COND, "fvwvg" },
+    [0x67] = { HY_FVAVG    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_VECTOR    , HYRISC_NO_COND, "fvavg" },
+    [0x66] = { HY_FVWSM    , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_VECTOR    , HYRISC_NO_COND, "fvwsm" },
+    [0x65] = { HY_FVSUM    , HYRISC_ENC_4, HYRISC_OPT_2F  , HYRISC_SOP_VECTOR    , HYRISC_NO_COND, "fvsum" },
+    [0x64] = { HY_FVFMA    , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_VECTOR    , HYRISC_NO_COND, "fvfma" },
+    [0x63] = { HY_FVDIV    , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_VECTOR    , HYRISC_NO_COND, "fvdiv" },
+    [0x62] = { HY_FVMUL    , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_VECTOR    , HYRISC_NO_COND, "fvmul" },
+    [0x61] = { HY_FVSUB    , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_VECTOR    , HYRISC_NO_COND, "fvsub" },
+    [0x60] = { HY_FVADD    , HYRISC_ENC_4, HYRISC_OPT_3F  , HYRISC_SOP_VECTOR    , HYRISC_NO_COND, "fvadd" },
     [0x5f] = { 0x5f        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
     [0x5e] = { 0x5e        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
     [0x5d] = { 0x5d        , HYRISC_ENC_0, HYRISC_OPT_NONE, HYRISC_SOP_NONE      , HYRISC_NO_COND, "<bad>" },
@@ -457,10 +498,25 @@ const char* hyrisc_register_names_abi[] = {
     "ir" , "br" , "sp" , "pc"
 };
 
+// f31 is FPCSR
+const char* hyrisc_register_names_fpu[] = {
+    "f0" , "f1" , "f2" , "f3" ,
+    "f4" , "f5" , "f6" , "f7" ,
+    "f8" , "f9" , "f10", "f11",
+    "f12", "f13", "f14", "f15",
+    "f16", "f17", "f18", "f19",
+    "f20", "f21", "f22", "f23",
+    "f24", "f25", "f26", "f27",
+    "f28", "f29", "f30", "fpcsr"
+};
+
 const char* hyrisc_dis_sop_load_store = "bslx";
 const char* hyrisc_dis_sop_inc_dec = "bsld";
 const char* hyrisc_dis_sop_branch = "us";
 
+// Vectors are 2 << size registers wide, 3 is illegal
+const char* hyrisc_dis_sop_vector = "248x";
+
 int print_insn_hyrisc(unsigned long iword) {
     unsigned opcode = HYRISC_DIS_OPCODE;
 
@@ -742,6 +798,58 @@ int print_insn_hyrisc(unsigned long iword) {
             );
         } break;
 
+        case HYRISC_OPT_3F: {
+            if (insn.size_operand == HYRISC_SOP_VECTOR) {
+                printf("%s.%c %s, %s, %s",
+                    insn.name,
+                    hyrisc_dis_sop_vector[HYRISC_DIS_SIZE],
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDX],
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDY],
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDZ]
+                );
+            } else {
+                printf("%s %s, %s, %s",
+                    insn.name,
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDX],
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDY],
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDZ]
+                );
+            }
+        } break;
+
+        case HYRISC_OPT_2F: {
+            if (insn.size_operand == HYRISC_SOP_VECTOR) {
+                printf("%s.%c %s, %s",
+                    insn.name,
+                    hyrisc_dis_sop_vector[HYRISC_DIS_SIZE],
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDX],
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDY]
+                );
+            } else {
+                printf("%s %s, %s",
+                    insn.name,
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDX],
+                    hyrisc_register_names_fpu[HYRISC_DIS_FIELDY]
+                );
+            }
+        } break;
+
+        case HYRISC_OPT_RF: {
+            printf("%s %s, %s",
+                insn.name,
+                hyrisc_register_names_abi[HYRISC_DIS_FIELDX],
+                hyrisc_register_names_fpu[HYRISC_DIS_FIELDY]
+            );
+        } break;
+
+        case HYRISC_OPT_FR: {
+            printf("%s %s, %s",
+                insn.name,
+                hyrisc_register_names_fpu[HYRISC_DIS_FIELDX],
+                hyrisc_register_names_abi[HYRISC_DIS_FIELDY]
+            );
+        } break;
+
         default: {
             printf("<bad>");
         }
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "machine.hpp"
+
+#include <string>
+
+// Fork server
+// The guest boots once, up to its first debug opcode, and the board
+// is then forked for every test case, so host pages are shared
+// copy-on-write and a case only costs the guest work it does.
+//
+// Cases are written by the client to the mailbox, a file the server
+// maps shared (on /dev/shm it never touches a disk). Each child
+// injects its case either into guest RAM at a fixed address, as a
+// 32-bit length followed by the data, or as terminal input, read a
+// byte at a time and then as no key. It runs until the guest stops
+// or it reaches the instruction limit.
+//
+// The client talks to the server over two pipes on fixed fds, set
+// up before starting it. The server says hello on the status pipe,
+// and then for every case the client writes its length (u32) to the
+// control pipe and reads a result record back. Closing the control
+// pipe ends the server. Everything is in host byte order.
+//
+// Builds with coverage (see hyrisc/coverage.hpp) can also share the
+// edge map of every case with the client, through a second file of
+// HYRISC_COVERAGE_SIZE bytes that is cleared before each case.
+
+#define FORKSRV_CTL_FD    198
+#define FORKSRV_STATUS_FD 199
+
+#define FORKSRV_HELLO        0x53465948 // "HYFS"
+#define FORKSRV_MAILBOX_SIZE 0x100000
+
+#ifdef __linux__
+#define FORKSRV_SUPPORTED
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+enum forksrv_stop_t : hyu32_t {
+    FORKSRV_LIMIT,   // Reached the instruction limit
+    FORKSRV_DEBUG,   // Ran a debug opcode
+    FORKSRV_ILLEGAL, // Ran an illegal instruction
+    FORKSRV_CRASH,   // The child died, a0 is the signal
+    FORKSRV_ERROR    // The case couldn't be injected
+};
+
+struct forksrv_result_t {
+    hyu32_t stop;
+    hyu32_t a0;
+
+    // Retired by the case, from the fork point
+    hyu64_t instructions;
+};
+
+enum forksrv_target_t {
+    FORKSRV_RAM,
+    FORKSRV_TERMINAL
+};
+
+class fork_server_t {
+    machine_t* machine = nullptr;
+
+    hyu8_t* mailbox = nullptr;
+    size_t  mailbox_size = 0;
+
+    forksrv_target_t target = FORKSRV_TERMINAL;
+    hyu32_t          addr = 0;
+
+    hyu64_t limit = 0;
+
+    hyu8_t* coverage = nullptr;
+
+    // Each child only serves one case
+    static inline const hyu8_t* input = nullptr;
+    static inline size_t        input_left = 0;
+
+    static int case_input() {
+        if (!input_left) return 0;
+
+        input_left--;
+
+        return *input++;
+    }
+
+    static bool put(int fd, const void* data, size_t size) {
+#ifdef FORKSRV_SUPPORTED
+        return write(fd, data, size) == (ssize_t)size;
+#else
+        return false;
+#endif
+    }
+
+    static bool get(int fd, void* data, size_t size) {
+#ifdef FORKSRV_SUPPORTED
+        return read(fd, data, size) == (ssize_t)size;
+#else
+        return false;
+#endif
+    }
+
+    bool inject(hyu32_t size) {
+        if (target == FORKSRV_TERMINAL) {
+            input      = mailbox;
+            input_left = size;
+
+            machine->terminal.attach_input(case_input);
+
+            return true;
+        }
+
+        hyu8_t* host = machine->bus.host_pointer(addr, size + 4);
+
+        if (!host) return false;
+
+        std::memcpy(host, &size, 4);
+        std::memcpy(host + 4, mailbox, size);
+
+        // Cases may hold code
+        hyrisc_cache_invalidate(&machine->cpu, addr, size + 4);
+
+        return true;
+    }
+
+    // Anonymous if path is empty, only shared with children then
+    static hyu8_t* map_shared(const std::string& path, size_t& size) {
+#ifdef FORKSRV_SUPPORTED
+        void* view;
+
+        if (path.empty()) {
+            view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        } else {
+            int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+
+            if (fd < 0) return nullptr;
+
+            struct stat st;
+
+            if (fstat(fd, &st) || (!st.st_size && ftruncate(fd, size))) {
+                close(fd);
+
+                return nullptr;
+            }
+
+            if (st.st_size) size = st.st_size;
+
+            view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            close(fd);
+        }
+
+        return (view == MAP_FAILED) ? nullptr : (hyu8_t*)view;
+#else
+        return nullptr;
+#endif
+    }
+
+    forksrv_result_t run_case(hyu32_t size) {
+        forksrv_result_t result = { FORKSRV_ERROR, 0, 0 };
+
+        if (!inject(size)) return result;
+
+        if (coverage) {
+            machine->cpu.coverage      = coverage;
+            machine->cpu.coverage_prev = 0;
+        }
+
+        hyu64_t start = machine->retired();
+
+        result.stop = FORKSRV_LIMIT;
+
+        while (!limit || ((machine->retired() - start) < limit)) {
+            hyu64_t budget = 0x100000;
+
+            if (limit && ((limit - (machine->retired() - start)) < budget))
+                budget = limit - (machine->retired() - start);
+
+            machine_stop_t stop = machine->run(budget);
+
+            if (stop == MACHINE_DEBUG  ) { result.stop = FORKSRV_DEBUG; break; }
+            if (stop == MACHINE_ILLEGAL) { result.stop = FORKSRV_ILLEGAL; break; }
+        }
+
+        result.a0           = machine->cpu.internal.r[24];
+        result.instructions = machine->retired() - start;
+
+        return result;
+    }
+
+public:
+    ~fork_server_t() {
+#ifdef FORKSRV_SUPPORTED
+        if (mailbox) munmap(mailbox, mailbox_size);
+        if (coverage) munmap(coverage, HYRISC_COVERAGE_SIZE);
+#endif
+    }
+
+    // The mailbox is created if it doesn't exist, and keeps its size
+    // if it does. An empty path maps one only this process and its
+    // children see. Returns false if it can't be mapped, or forking
+    // isn't supported on this host
+    bool init(machine_t* machine, const std::string& path, hyu64_t limit) {
+        this->machine = machine;
+        this->limit   = limit;
+
+        mailbox_size = FORKSRV_MAILBOX_SIZE;
+        mailbox      = map_shared(path, mailbox_size);
+
+        return mailbox;
+    }
+
+    // Same as the mailbox, but the file has to hold the whole map.
+    // Only filled by builds with coverage
+    bool set_coverage(const std::string& path) {
+        size_t size = HYRISC_COVERAGE_SIZE;
+
+        coverage = map_shared(path, size);
+
+        if (coverage && (size < HYRISC_COVERAGE_SIZE)) {
+#ifdef FORKSRV_SUPPORTED
+            munmap(coverage, size);
+#endif
+
+            coverage = nullptr;
+        }
+
+        return coverage;
+    }
+
+    // Cases go to guest RAM at addr instead of the terminal
+    void set_ram_target(hyu32_t addr) {
+        target     = FORKSRV_RAM;
+        this->addr = addr;
+    }
+
+    // Runs the guest to its first debug opcode, where every case
+    // starts. Returns false if it stops anywhere else
+    bool boot() {
+        machine_stop_t booted;
+
+        while ((booted = machine->run(0x100000)) == MACHINE_BUDGET);
+
+        // Nothing left buffered for the children to flush again
+        std::cout.flush();
+
+        return booted == MACHINE_DEBUG;
+    }
+
+    hyu8_t* get_mailbox() const {
+        return mailbox;
+    }
+
+    size_t get_mailbox_size() const {
+        return mailbox_size;
+    }
+
+    // Edges hit by the last case, null without a map
+    const hyu8_t* get_coverage() const {
+        return coverage;
+    }
+
+    // Runs the first size bytes of the mailbox as a case on a fork of
+    // the booted board. Returns false if it couldn't fork
+    bool run_forked(hyu32_t size, forksrv_result_t& result) {
+#ifdef FORKSRV_SUPPORTED
+        if (size > mailbox_size) size = mailbox_size;
+
+        if (coverage) std::memset(coverage, 0, HYRISC_COVERAGE_SIZE);
+
+        int results[2];
+
+        if (pipe(results)) return false;
+
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            close(results[0]);
+            close(results[1]);
+
+            return false;
+        }
+
+        if (!pid) {
+            close(results[0]);
+
+            result = run_case(size);
+
+            std::cout.flush();
+
+            put(results[1], &result, sizeof(result));
+
+            _exit(0);
+        }
+
+        close(results[1]);
+
+        int status;
+
+        waitpid(pid, &status, 0);
+
+        if (!get(results[0], &result, sizeof(result))) {
+            result.stop         = FORKSRV_CRASH;
+            result.a0           = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+            result.instructions = 0;
+        }
+
+        close(results[0]);
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Boots the guest and serves cases until the client closes the
+    // control pipe. Returns false if the guest didn't get to a debug
+    // opcode or the client went away mid-case
+    bool serve() {
+        if (!boot()) return false;
+
+        hyu32_t hello = FORKSRV_HELLO;
+
+        if (!put(FORKSRV_STATUS_FD, &hello, 4)) return false;
+
+        hyu32_t size;
+
+        while (get(FORKSRV_CTL_FD, &size, 4)) {
+            forksrv_result_t result;
+
+            if (!run_forked(size, result)) return false;
+
+            if (!put(FORKSRV_STATUS_FD, &result, sizeof(result))) return false;
+        }
+
+        return true;
+    }
+};
\ No newline at end of file
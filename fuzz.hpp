@@ -0,0 +1,345 @@
+#pragma once
+
+#include "forkserver.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Fuzzing
+// Mutational, coverage-guided fuzzer driving a fork server in the
+// same process. The corpus directory holds the seeds and grows with
+// every input that hits new edges, or new hit counts on an edge
+// (bucketed like AFL: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+).
+// Inputs making the guest run an illegal instruction or crash the
+// emulator go to crashes/ in it, one per new set of edges.
+//
+// Inputs are stacks of random byte-level mutations of an input from
+// the queue, spliced with another one now and then. Runs are
+// repeatable, the generator always starts off the same seed.
+//
+// Needs a build with coverage (make COVERAGE=1).
+
+#define FUZZ_MAX_SIZE      0x1000
+#define FUZZ_STATS_SECONDS 5
+
+class fuzzer_t {
+    typedef std::vector <hyu8_t> input_t;
+
+    fork_server_t* server = nullptr;
+
+    std::string dir;
+
+    std::vector <input_t> queue;
+
+    // Bits of the hit count buckets no input has reached yet, for
+    // the queue and for crashes
+    input_t virgin;
+    input_t virgin_crash;
+
+    hyu64_t rng = 0x9e3779b97f4a7c15ull;
+
+    hyu64_t cases   = 0;
+    hyu64_t crashes = 0;
+    hyu64_t hangs   = 0;
+
+    hyu64_t next_id = 0;
+
+    hyu32_t random() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+
+        return rng >> 32;
+    }
+
+    hyu32_t below(hyu32_t n) {
+        return n ? (random() % n) : 0;
+    }
+
+    static hyu8_t bucket(hyu8_t count) {
+        if (count < 4  ) return count ? (1 << (count - 1)) : 0;
+        if (count < 8  ) return 0x08;
+        if (count < 16 ) return 0x10;
+        if (count < 32 ) return 0x20;
+        if (count < 128) return 0x40;
+
+        return 0x80;
+    }
+
+    // Clears whatever the last case reached in map, returns true if
+    // that was anything
+    bool has_new_bits(input_t& map) {
+        const hyu8_t* coverage = server->get_coverage();
+
+        bool found = false;
+
+        for (size_t i = 0; i < HYRISC_COVERAGE_SIZE; i++) {
+            if (!coverage[i]) continue;
+
+            hyu8_t bits = bucket(coverage[i]);
+
+            if (map[i] & bits) {
+                map[i] &= ~bits;
+
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    static bool save(const std::string& path, const input_t& input) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+        file.write((const char*)input.data(), input.size());
+
+        return file.good();
+    }
+
+    // Next id-<n><suffix> in prefix that isn't taken, earlier runs may
+    // have left some
+    std::string unused(const std::string& prefix, const char* suffix) {
+        std::string path;
+
+        do {
+            char name[32];
+
+            std::snprintf(name, sizeof(name), "id-%06llu%s", (unsigned long long)next_id++, suffix);
+
+            path = prefix + name;
+        } while (std::filesystem::exists(path));
+
+        return path;
+    }
+
+    size_t edges() const {
+        size_t count = 0;
+
+        for (hyu8_t bits : virgin)
+            if (bits != 0xff) count++;
+
+        return count;
+    }
+
+    void mutate(input_t& input) {
+        static const hyu32_t interesting[] = {
+            0x00, 0x01, 0x7f, 0x80, 0xff, 0x7fff, 0x8000, 0xffff,
+            0x7fffffff, 0x80000000, 0xffffffff, 0x10, 0x20, 0x40, 0x64, 0x100
+        };
+
+        int stack = 1 << (1 + below(5));
+
+        for (int i = 0; i < stack; i++) {
+            switch (input.empty() ? 5 : below(8)) {
+                // Flip a bit
+                case 0: {
+                    hyu32_t bit = below(input.size() * 8);
+
+                    input[bit >> 3] ^= 0x80 >> (bit & 7);
+                } break;
+
+                // Random byte
+                case 1: {
+                    input[below(input.size())] = random();
+                } break;
+
+                // Add or subtract a small value
+                case 2: {
+                    hyu8_t& byte = input[below(input.size())];
+
+                    byte += (below(2) ? 1 : -1) * (1 + below(35));
+                } break;
+
+                // Interesting value, 1, 2 or 4 bytes
+                case 3: {
+                    hyu32_t value = interesting[below(sizeof(interesting) / sizeof(hyu32_t))];
+                    hyu32_t width = 1 << below(3);
+
+                    if (width > input.size()) width = input.size();
+
+                    hyu32_t at = below(input.size() - width + 1);
+
+                    std::memcpy(&input[at], &value, width);
+                } break;
+
+                // Delete a block
+                case 4: {
+                    if (input.size() < 2) break;
+
+                    hyu32_t length = 1 + below(input.size() / 2);
+                    hyu32_t at = below(input.size() - length + 1);
+
+                    input.erase(input.begin() + at, input.begin() + at + length);
+                } break;
+
+                // Insert random bytes or a copy of a block
+                case 5:
+                case 6: {
+                    if (input.size() >= FUZZ_MAX_SIZE) break;
+
+                    hyu32_t length = 1 + below(16);
+                    hyu32_t at = below(input.size() + 1);
+
+                    input_t block(length);
+
+                    if (input.size() && below(2)) {
+                        hyu32_t from = below(input.size());
+
+                        for (hyu32_t b = 0; b < length; b++)
+                            block[b] = input[(from + b) % input.size()];
+                    } else {
+                        for (hyu8_t& b : block) b = random();
+                    }
+
+                    input.insert(input.begin() + at, block.begin(), block.end());
+                } break;
+
+                // Splice the tail of another input
+                case 7: {
+                    const input_t& other = queue[below(queue.size())];
+
+                    if (other.empty()) break;
+
+                    hyu32_t at = below(input.size());
+                    hyu32_t from = below(other.size());
+
+                    input.resize(at);
+                    input.insert(input.end(), other.begin() + from, other.end());
+                } break;
+            }
+        }
+
+        if (input.size() > FUZZ_MAX_SIZE) input.resize(FUZZ_MAX_SIZE);
+    }
+
+    // Runs an input and keeps it if it did anything new. Returns
+    // false if the server couldn't fork
+    bool run_input(const input_t& input, bool keep = true) {
+        size_t size = input.size();
+
+        if (size > server->get_mailbox_size()) size = server->get_mailbox_size();
+
+        std::memcpy(server->get_mailbox(), input.data(), size);
+
+        forksrv_result_t result;
+
+        if (!server->run_forked(size, result)) return false;
+
+        cases++;
+
+        if ((result.stop == FORKSRV_ILLEGAL) || (result.stop == FORKSRV_CRASH)) {
+            if (!has_new_bits(virgin_crash)) return true;
+
+            crashes++;
+
+            std::string path = unused(dir + "/crashes/", (result.stop == FORKSRV_ILLEGAL) ? "-illegal" : "-crash");
+
+            if (!save(path, input)) {
+                _log(error, "Couldn't save crash \"%s\"", path.c_str());
+            }
+
+            return true;
+        }
+
+        if (result.stop == FORKSRV_LIMIT) hangs++;
+
+        if (!has_new_bits(virgin)) return true;
+
+        queue.push_back(input);
+
+        if (!keep) return true;
+
+        std::string path = unused(dir + "/", "");
+
+        if (!save(path, input)) {
+            _log(error, "Couldn't save input \"%s\"", path.c_str());
+        }
+
+        return true;
+    }
+
+    void stats() {
+        _log(info, "%llu cases, %zu queued, %zu edges, %llu crashes, %llu hangs",
+            (unsigned long long)cases,
+            queue.size(),
+            edges(),
+            (unsigned long long)crashes,
+            (unsigned long long)hangs
+        );
+    }
+
+public:
+    // The server has to have a coverage map
+    bool init(fork_server_t* server, const std::string& dir) {
+        this->server = server;
+        this->dir    = dir;
+
+        virgin.assign(HYRISC_COVERAGE_SIZE, 0xff);
+        virgin_crash.assign(HYRISC_COVERAGE_SIZE, 0xff);
+
+        std::error_code ec;
+
+        std::filesystem::create_directories(dir + "/crashes", ec);
+
+        return !ec && server->get_coverage();
+    }
+
+    // Boots the guest and fuzzes it for up to count cases, forever if
+    // count is 0. Returns false if the guest didn't get to a debug
+    // opcode or the server couldn't fork
+    bool run(hyu64_t count) {
+        if (!server->boot()) return false;
+
+        std::vector <input_t> seeds;
+
+        std::error_code ec;
+
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            if (!entry.is_regular_file()) continue;
+
+            std::ifstream file(entry.path(), std::ios::binary);
+
+            input_t seed((std::istreambuf_iterator <char>(file)), std::istreambuf_iterator <char>());
+
+            if (seed.size() > FUZZ_MAX_SIZE) seed.resize(FUZZ_MAX_SIZE);
+
+            seeds.push_back(seed);
+        }
+
+        // Seeds are already in the corpus, and only queued if they do
+        // anything new
+        for (const input_t& seed : seeds)
+            if (!run_input(seed, false)) return false;
+
+        if (queue.empty() && !run_input(input_t(), false)) return false;
+
+        // Nothing reached any edge
+        if (queue.empty()) queue.push_back(input_t());
+
+        auto last = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; !count || (cases < count); i++) {
+            input_t input = queue[i % queue.size()];
+
+            mutate(input);
+
+            if (!run_input(input)) return false;
+
+            auto now = std::chrono::steady_clock::now();
+
+            if (std::chrono::duration_cast <std::chrono::seconds>(now - last).count() >= FUZZ_STATS_SECONDS) {
+                stats();
+
+                last = now;
+            }
+        }
+
+        stats();
+
+        return true;
+    }
+};
\ No newline at end of file
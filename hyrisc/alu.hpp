@@ -5,44 +5,53 @@
 #include "flags.hpp"
 
 namespace alu {
-    typedef hyu64_t (*operation_t)(hyu32_t&, hyu32_t, hyu32_t);
+// Dividing by zero gives all ones instead of raising SIGFPE on the
+// host, a guest can't take the emulator down with it. divs has always
+// divided as unsigned (src1 promotes the divisor back), so it shares
+// this and INT_MIN / -1 can't overflow either
+inline hyu32_t divide(hyu32_t a, hyu32_t b) {
+    return b ? (a / b) : 0xffffffff;
+}
 
-#define OPERATION(name, code) \
-operation_t HY_##name = [](hyu32_t& dst, hyu32_t src1, hyu32_t src2) -> hyu64_t { hyu64_t temp = code; return temp; }
+// Operations are stateless functors, so handlers get them inlined
+// Flags are only recorded here, along with the operands they
+// depend on, and built later by hyrisc_get_flags if needed
+#define OPERATION(name, flags, a, b, code, store) \
+struct HY_##name##_t { \
+    inline void operator()(hyrisc_t* proc, hyu32_t& dst, hyu32_t src1, hyu32_t src2) const { hyu32_t temp = code; hyrisc_defer_flags(proc, flags, temp, a, b); store; } \
+}; \
+constexpr HY_##name##_t HY_##name = {}
 
-    OPERATION(addu, src1 + src2         ; dst = temp & 0xffffffff);
-    OPERATION(subu, src1 - src2         ; dst = temp & 0xffffffff);
-    OPERATION(mulu, src1 * src2         ; dst = temp & 0xffffffff);
-    OPERATION(divu, src1 / src2         ; dst = temp & 0xffffffff);
-    OPERATION(adds, src1 + (hyi32_t)src2; dst = temp & 0xffffffff);
-    OPERATION(subs, src1 - (hyi32_t)src2; dst = temp & 0xffffffff);
-    OPERATION(muls, src1 * (hyi32_t)src2; dst = temp & 0xffffffff);
-    OPERATION(divs, src1 / (hyi32_t)src2; dst = temp & 0xffffffff);
-    OPERATION(and , src1 & src2         ; dst = temp & 0xffffffff);
-    OPERATION(or  , src1 | src2         ; dst = temp & 0xffffffff);
-    OPERATION(xor , src1 ^ src2         ; dst = temp & 0xffffffff);
-    OPERATION(not , ~src1               ; dst = temp & 0xffffffff);
-    OPERATION(neg , ~src1               ; dst = temp & 0xffffffff);
-    OPERATION(inc , dst + src1          ; dst = temp & 0xffffffff);
-    OPERATION(dec , dst - src1          ; dst = temp & 0xffffffff);
-    OPERATION(rst , 0                   ; dst = temp & 0xffffffff);
-    OPERATION(tst , dst & (1 << src1)   ;                        );
-    OPERATION(cmp , dst - src1          ;                        );
-    OPERATION(cmpb, dst - (src1 & 0xff) ;                        );
-    OPERATION(lsl , src1 << src2        ; dst = temp & 0xffffffff);
-    OPERATION(lsr , src1 >> src2        ; dst = temp & 0xffffffff);
-    OPERATION(asl , src1 << src2        ; dst = temp & 0xffffffff);
-    OPERATION(asr , src1 >> src2        ; dst = temp & 0xffffffff);
-    OPERATION(rl  , src1 << src2        ; dst = temp & 0xffffffff);
-    OPERATION(rr  , src1 >> src2        ; dst = temp & 0xffffffff);
+    OPERATION(addu, HY_FLAGS_ADD  , src1, src2         , src1 + src2         , dst = temp);
+    OPERATION(subu, HY_FLAGS_SUB  , src1, src2         , src1 - src2         , dst = temp);
+    OPERATION(mulu, HY_FLAGS_MUL  , src1, src2         , src1 * src2         , dst = temp);
+    OPERATION(divu, HY_FLAGS_LOGIC, 0   , 0            , divide(src1, src2)  , dst = temp);
+    OPERATION(adds, HY_FLAGS_ADD  , src1, src2         , src1 + (hyi32_t)src2, dst = temp);
+    OPERATION(subs, HY_FLAGS_SUB  , src1, src2         , src1 - (hyi32_t)src2, dst = temp);
+    OPERATION(muls, HY_FLAGS_MUL  , src1, src2         , src1 * (hyi32_t)src2, dst = temp);
+    OPERATION(divs, HY_FLAGS_LOGIC, 0   , 0            , divide(src1, src2)  , dst = temp);
+    OPERATION(and , HY_FLAGS_LOGIC, 0   , 0            , src1 & src2         , dst = temp);
+    OPERATION(or  , HY_FLAGS_LOGIC, 0   , 0            , src1 | src2         , dst = temp);
+    OPERATION(xor , HY_FLAGS_LOGIC, 0   , 0            , src1 ^ src2         , dst = temp);
+    OPERATION(not , HY_FLAGS_LOGIC, 0   , 0            , ~src1               , dst = temp);
+    OPERATION(neg , HY_FLAGS_LOGIC, 0   , 0            , ~src1               , dst = temp);
+    OPERATION(inc , HY_FLAGS_ADD  , dst , src1         , dst + src1          , dst = temp);
+    OPERATION(dec , HY_FLAGS_SUB  , dst , src1         , dst - src1          , dst = temp);
+    OPERATION(rst , HY_FLAGS_LOGIC, 0   , 0            , 0                   , dst = temp);
+    OPERATION(tst , HY_FLAGS_LOGIC, 0   , 0            , dst & (1 << src1)   ,           );
+    OPERATION(cmp , HY_FLAGS_SUB  , dst , src1         , dst - src1          ,           );
+    OPERATION(cmpb, HY_FLAGS_SUB  , dst , src1 & 0xff  , dst - (src1 & 0xff) ,           );
+    OPERATION(lsl , HY_FLAGS_SHL  , src1, src2         , src1 << src2        , dst = temp);
+    OPERATION(lsr , HY_FLAGS_LOGIC, 0   , 0            , src1 >> src2        , dst = temp);
+    OPERATION(asl , HY_FLAGS_SHL  , src1, src2         , src1 << src2        , dst = temp);
+    OPERATION(asr , HY_FLAGS_LOGIC, 0   , 0            , src1 >> src2        , dst = temp);
+    OPERATION(rl  , HY_FLAGS_LOGIC, 0   , 0            , src1 << src2        , dst = temp);
+    OPERATION(rr  , HY_FLAGS_LOGIC, 0   , 0            , src1 >> src2        , dst = temp);
 
 #undef OPERATION
 
-    void perform_operation(hyrisc_t* proc, hyu32_t& dst, hyu32_t src1, hyu32_t src2, operation_t op) {
-        hyu64_t temp = op(dst, src1, src2);
-
-        hyrisc_set_flags(proc, Z, !(temp & 0xffffffff));
-        hyrisc_set_flags(proc, N, (temp & 0xffffffff) & 0x80000000);
-        hyrisc_set_flags(proc, C, temp > 0xffffffff);
+    template <class Op>
+    inline void perform_operation(hyrisc_t* proc, hyu32_t& dst, hyu32_t src1, hyu32_t src2, Op op) {
+        op(proc, dst, src1, src2);
     }
 }
\ No newline at end of file
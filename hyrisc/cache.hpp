@@ -0,0 +1,263 @@
+#pragma once
+
+#include "types.hpp"
+#include "state.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Predecode cache
+// Direct-mapped cache of fully decoded instructions, keyed by
+// the physical address they were fetched from. A bitmap of pages
+// holding cached code lets bus writes invalidate stale entries
+// without having to scan the whole cache.
+
+#define HYRISC_CACHE_SIZE  0x1000
+#define HYRISC_CACHE_MASK  (HYRISC_CACHE_SIZE - 1)
+#define HYRISC_PAGE_SHIFT  12
+#define HYRISC_PAGE_SIZE   (1 << HYRISC_PAGE_SHIFT)
+#define HYRISC_PAGE_COUNT  (1 << (32 - HYRISC_PAGE_SHIFT))
+
+// Block cache
+// Basic blocks are runs of predecoded instructions ending on a
+// flow control instruction. Each block remembers the blocks
+// execution continued to last time, so hot edges skip the lookup.
+// Invalidated blocks are only retired, and freed on the next
+// flush, since other blocks may still be chained to them.
+
+#define HYRISC_BLOCK_MAX_OPS      0x40
+#define HYRISC_JUMP_CACHE_SIZE    0x1000
+#define HYRISC_JUMP_CACHE_MASK    (HYRISC_JUMP_CACHE_SIZE - 1)
+#define HYRISC_MAX_RETIRED_BLOCKS 0x400
+
+struct hyrisc_block_t {
+    hyu32_t  pc;                // Address of the first instruction
+    hyu32_t  end;               // Address past the last instruction
+    hybool_t valid;
+    hyu32_t  hits;              // Times run, used to find hot blocks
+    void*    code;              // Translated code, if any
+
+    std::vector <hyrisc_predecoded_t> ops;
+
+    // Chained successors, [0] is the fall-through path
+    hyu32_t         next_pc[2];
+    hyrisc_block_t* next[2];
+};
+
+// Code sharing
+// Cores running off the same memory each have caches of their own.
+// Pages any of them holds code from are marked in a shared bitmap,
+// and stores to those pages are queued, once per page, until the
+// owner of the share applies them to every core at a sync point
+// (see hyrisc_code_share_sync). Code written by one core reaches
+// the others from the next sync point on.
+
+struct hyrisc_code_share_t {
+    std::atomic <hyu64_t> pages[HYRISC_PAGE_COUNT / 64];
+
+    std::mutex            lock;
+    std::vector <hyu32_t> written;
+};
+
+struct hyrisc_cache_t {
+    hyrisc_predecoded_t entry[HYRISC_CACHE_SIZE];
+    hyu64_t             pages[HYRISC_PAGE_COUNT / 64]; // Pages with cached code
+
+    hyrisc_block_t* jump[HYRISC_JUMP_CACHE_SIZE];
+
+    std::unordered_map <hyu32_t, hyrisc_block_t*>               blocks;
+    std::unordered_map <hyu32_t, std::vector <hyrisc_block_t*>> page_blocks;
+    std::vector <hyrisc_block_t*>                              retired;
+
+    hyu64_t  generation;    // Bumped every time all blocks are freed
+    hybool_t flush_pending; // Set to free all blocks at the next safe point
+
+    hyrisc_code_share_t* shared = nullptr;
+};
+
+inline void hyrisc_cache_flush_blocks(hyrisc_cache_t* cache) {
+    for (auto& it : cache->blocks)
+        delete it.second;
+
+    for (hyrisc_block_t* block : cache->retired)
+        delete block;
+
+    cache->blocks.clear();
+    cache->page_blocks.clear();
+    cache->retired.clear();
+
+    std::memset(cache->jump, 0, sizeof(cache->jump));
+
+    cache->generation++;
+    cache->flush_pending = false;
+}
+
+inline void hyrisc_cache_flush(hyrisc_t* proc) {
+    if (!proc->cache) return;
+
+    for (hyrisc_predecoded_t& entry : proc->cache->entry)
+        entry.valid = false;
+
+    std::memset(proc->cache->pages, 0, sizeof(proc->cache->pages));
+
+    hyrisc_cache_flush_blocks(proc->cache);
+}
+
+inline void hyrisc_cache_init(hyrisc_t* proc) {
+    if (!proc->cache) proc->cache = new hyrisc_cache_t;
+
+    hyrisc_cache_flush(proc);
+}
+
+inline void hyrisc_cache_destroy(hyrisc_t* proc) {
+    if (proc->cache) hyrisc_cache_flush_blocks(proc->cache);
+
+    delete proc->cache;
+
+    proc->cache = nullptr;
+}
+
+inline hyrisc_predecoded_t* hyrisc_cache_entry(hyrisc_cache_t* cache, hyu32_t addr) {
+    return &cache->entry[(addr >> 2) & HYRISC_CACHE_MASK];
+}
+
+inline bool hyrisc_cache_page_cached(hyrisc_cache_t* cache, hyu32_t page) {
+    return cache->pages[page >> 6] & (1ull << (page & 63));
+}
+
+inline void hyrisc_cache_mark_page(hyrisc_cache_t* cache, hyu32_t addr) {
+    hyu32_t page = addr >> HYRISC_PAGE_SHIFT;
+
+    cache->pages[page >> 6] |= 1ull << (page & 63);
+
+    if (cache->shared)
+        cache->shared->pages[page >> 6].fetch_or(1ull << (page & 63), std::memory_order_relaxed);
+}
+
+inline void hyrisc_cache_invalidate_page(hyrisc_cache_t* cache, hyu32_t page) {
+    // Entries for a single page occupy a contiguous run of
+    // slots, only those can hold instructions from this page
+    hyu32_t first = (page << (HYRISC_PAGE_SHIFT - 2)) & HYRISC_CACHE_MASK;
+
+    for (hyu32_t i = 0; i < (HYRISC_PAGE_SIZE >> 2); i++) {
+        hyrisc_predecoded_t& entry = cache->entry[first + i];
+
+        if ((entry.pc >> HYRISC_PAGE_SHIFT) == page)
+            entry.valid = false;
+    }
+
+    auto it = cache->page_blocks.find(page);
+
+    if (it != cache->page_blocks.end()) {
+        for (hyrisc_block_t* block : it->second) {
+            // Blocks spanning two pages might already be gone
+            if (!block->valid) continue;
+
+            block->valid = false;
+
+            hyrisc_block_t*& jump = cache->jump[(block->pc >> 2) & HYRISC_JUMP_CACHE_MASK];
+
+            if (jump == block) jump = nullptr;
+
+            cache->blocks.erase(block->pc);
+            cache->retired.push_back(block);
+        }
+
+        cache->page_blocks.erase(it);
+    }
+
+    cache->pages[page >> 6] &= ~(1ull << (page & 63));
+}
+
+inline hyrisc_block_t* hyrisc_cache_find_block(hyrisc_cache_t* cache, hyu32_t addr) {
+    hyrisc_block_t*& jump = cache->jump[(addr >> 2) & HYRISC_JUMP_CACHE_MASK];
+
+    if (jump && (jump->pc == addr)) return jump;
+
+    auto it = cache->blocks.find(addr);
+
+    if (it == cache->blocks.end()) return nullptr;
+
+    jump = it->second;
+
+    return jump;
+}
+
+inline void hyrisc_cache_insert_block(hyrisc_cache_t* cache, hyrisc_block_t* block) {
+    cache->blocks[block->pc] = block;
+    cache->jump[(block->pc >> 2) & HYRISC_JUMP_CACHE_MASK] = block;
+
+    hyu32_t first = block->pc >> HYRISC_PAGE_SHIFT;
+    hyu32_t last = (block->end - 1) >> HYRISC_PAGE_SHIFT;
+
+    cache->page_blocks[first].push_back(block);
+    hyrisc_cache_mark_page(cache, block->pc);
+
+    if (last != first) {
+        cache->page_blocks[last].push_back(block);
+        hyrisc_cache_mark_page(cache, block->end - 1);
+    }
+}
+
+// Called on every bus write, drops cached instructions in any
+// page touched by the [addr, addr + size) range
+inline void hyrisc_cache_invalidate(hyrisc_t* proc, hyu32_t addr, hyu32_t size) {
+    if (!proc->cache) return;
+
+    hyu32_t first = addr >> HYRISC_PAGE_SHIFT;
+    hyu32_t last = (addr + size - 1) >> HYRISC_PAGE_SHIFT;
+
+    if (hyrisc_cache_page_cached(proc->cache, first))
+        hyrisc_cache_invalidate_page(proc->cache, first);
+
+    if ((last != first) && hyrisc_cache_page_cached(proc->cache, last))
+        hyrisc_cache_invalidate_page(proc->cache, last);
+
+    if (proc->cache->shared) {
+        hyrisc_code_share_t* share = proc->cache->shared;
+
+        for (hyu32_t page = first; page <= last; page++) {
+            hyu64_t bit = 1ull << (page & 63);
+
+            // Later stores aren't queued again unless a core caches
+            // code from the page again
+            if (!(share->pages[page >> 6].load(std::memory_order_relaxed) & bit)) continue;
+            if (!(share->pages[page >> 6].fetch_and(~bit, std::memory_order_relaxed) & bit)) continue;
+
+            std::lock_guard <std::mutex> guard(share->lock);
+
+            share->written.push_back(page);
+        }
+    }
+}
+
+inline void hyrisc_code_share_init(hyrisc_code_share_t* share) {
+    for (std::atomic <hyu64_t>& word : share->pages)
+        word.store(0, std::memory_order_relaxed);
+
+    share->written.clear();
+}
+
+// Cores sharing code have to be stopped. Drops the code every one
+// of them holds from pages written since the last sync
+inline void hyrisc_code_share_sync(hyrisc_code_share_t* share, hyrisc_t* const* cores, size_t count) {
+    std::vector <hyu32_t> written;
+
+    {
+        std::lock_guard <std::mutex> guard(share->lock);
+
+        written.swap(share->written);
+    }
+
+    for (hyu32_t page : written) {
+        for (size_t i = 0; i < count; i++) {
+            hyrisc_cache_t* cache = cores[i]->cache;
+
+            if (cache && hyrisc_cache_page_cached(cache, page))
+                hyrisc_cache_invalidate_page(cache, page);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "types.hpp"
+#include "state.hpp"
+
+// Edge coverage
+// AFL-style map of control flow edges. Every transition between
+// basic blocks hashes the address it lands on, and bumps the counter
+// for that hash XOR the one of the block before (shifted, so A->B
+// and B->A land apart). Functional mode counts every block it enters,
+// pin-accurate mode every instruction that would end a block.
+//
+// Only built with HYRISC_COVERAGE defined, there's nothing on the
+// hot path otherwise. proc->coverage points to the map, or is null
+// to turn it off at runtime.
+
+#define HYRISC_COVERAGE_SIZE 0x10000
+
+inline void hyrisc_coverage_edge(hyrisc_t* proc, hyu32_t to) {
+    hyu32_t loc = ((to >> 2) * 0x9e3779b1u) >> 16;
+
+    proc->coverage[(loc ^ proc->coverage_prev) & (HYRISC_COVERAGE_SIZE - 1)]++;
+
+    proc->coverage_prev = loc >> 1;
+}
+
+#ifdef HYRISC_COVERAGE
+#define HYRISC_COVER_BLOCK(proc, addr) \
+    if (proc->coverage) hyrisc_coverage_edge(proc, addr)
+
+#define HYRISC_COVER_RETIRE(proc) \
+    if (proc->coverage && hyrisc_ends_block(proc->internal.decoder)) hyrisc_coverage_edge(proc, proc->internal.r[pc])
+#else
+#define HYRISC_COVER_BLOCK(proc, addr)
+#define HYRISC_COVER_RETIRE(proc)
+#endif
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "types.hpp"
+#include "state.hpp"
+#include "cache.hpp"
+
+#include <cstring>
+
+// Fastmem
+// The whole guest address space is reserved as a single host region
+// of PROT_NONE guard pages, and RAM devices map themselves into it
+// at their guest address. Loads and stores index the region with no
+// range checks at all. A bitmap of the pages mapped in sends device
+// pages straight to the devices; the few accesses still reaching a
+// guard page (crossing the end of RAM) fault, and the SIGSEGV handler
+// turns the fault into a miss that's dispatched to the devices (or
+// raises a bus error) like any other access.
+//
+// Accesses go through a few leaf stubs, so recovering from a fault
+// only takes moving RIP to a stub returning false. x86-64 Linux only.
+
+#if defined(__x86_64__) && defined(__linux__)
+#define HYRISC_FASTMEM_SUPPORTED
+
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#endif
+
+#define HYRISC_FASTMEM_SIZE       0x100000000ull
+#define HYRISC_FASTMEM_GUARD      0x1000 // Catches accesses crossing 4 GiB
+#define HYRISC_FASTMEM_STUB_SIZE  0x10
+#define HYRISC_FASTMEM_STUB_COUNT 7
+#define HYRISC_FASTMEM_PAGES      (HYRISC_FASTMEM_SIZE >> HYRISC_PAGE_SHIFT)
+
+typedef bool (*hyrisc_fastmem_load_t)(hyu8_t* base, hyu64_t addr, hyu32_t* data);
+typedef bool (*hyrisc_fastmem_store_t)(hyu8_t* base, hyu64_t addr, hyu32_t data);
+
+struct hyrisc_fastmem_t {
+    hyu8_t* base;
+
+    // One bit per guest page, set if it's mapped into the region
+    const hyu32_t* mapped;
+
+    // Indexed by access size, AS_EXECUTE uses the 32-bit ones
+    hyrisc_fastmem_load_t  load[3];
+    hyrisc_fastmem_store_t store[3];
+};
+
+#ifdef HYRISC_FASTMEM_SUPPORTED
+inline hyu8_t*          hyrisc_fastmem_stubs = nullptr;
+inline struct sigaction hyrisc_fastmem_prev;
+
+// movzx/mov eax, [rdi+rsi]; mov [rdx], eax; mov eax, 1; ret
+// mov [rdi+rsi], dl/dx/edx; mov eax, 1; ret
+// xor eax, eax; ret
+inline const hyu8_t hyrisc_fastmem_code[HYRISC_FASTMEM_STUB_COUNT][HYRISC_FASTMEM_STUB_SIZE] = {
+    { 0x0f, 0xb6, 0x04, 0x37, 0x89, 0x02, 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3 },
+    { 0x0f, 0xb7, 0x04, 0x37, 0x89, 0x02, 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3 },
+    { 0x8b, 0x04, 0x37, 0x89, 0x02, 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3 },
+    { 0x88, 0x14, 0x37, 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3 },
+    { 0x66, 0x89, 0x14, 0x37, 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3 },
+    { 0x89, 0x14, 0x37, 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3 },
+    { 0x31, 0xc0, 0xc3 }
+};
+
+#define HYRISC_FASTMEM_MISS (HYRISC_FASTMEM_STUB_COUNT - 1)
+
+inline void hyrisc_fastmem_handler(int sig, siginfo_t* info, void* context) {
+    greg_t& rip = ((ucontext_t*)context)->uc_mcontext.gregs[REG_RIP];
+
+    hyu8_t* fault = (hyu8_t*)rip;
+
+    if ((fault >= hyrisc_fastmem_stubs) &&
+        (fault < (hyrisc_fastmem_stubs + HYRISC_FASTMEM_MISS * HYRISC_FASTMEM_STUB_SIZE))) {
+        rip = (greg_t)(hyrisc_fastmem_stubs + HYRISC_FASTMEM_MISS * HYRISC_FASTMEM_STUB_SIZE);
+
+        return;
+    }
+
+    // Not ours, let whoever was there before handle it
+    if (hyrisc_fastmem_prev.sa_flags & SA_SIGINFO) {
+        hyrisc_fastmem_prev.sa_sigaction(sig, info, context);
+
+        return;
+    }
+
+    if ((hyrisc_fastmem_prev.sa_handler == SIG_DFL) || (hyrisc_fastmem_prev.sa_handler == SIG_IGN)) {
+        // Faulting instruction runs again and gets the default action
+        sigaction(sig, &hyrisc_fastmem_prev, nullptr);
+
+        return;
+    }
+
+    hyrisc_fastmem_prev.sa_handler(sig);
+}
+
+inline bool hyrisc_fastmem_setup() {
+    void* code = mmap(nullptr, sizeof(hyrisc_fastmem_code), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED) return false;
+
+    std::memcpy(code, hyrisc_fastmem_code, sizeof(hyrisc_fastmem_code));
+
+    if (mprotect(code, sizeof(hyrisc_fastmem_code), PROT_READ | PROT_EXEC)) {
+        munmap(code, sizeof(hyrisc_fastmem_code));
+
+        return false;
+    }
+
+    struct sigaction action;
+
+    std::memset(&action, 0, sizeof(action));
+
+    action.sa_sigaction = hyrisc_fastmem_handler;
+    action.sa_flags     = SA_SIGINFO | SA_NODEFER;
+
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGSEGV, &action, &hyrisc_fastmem_prev)) {
+        munmap(code, sizeof(hyrisc_fastmem_code));
+
+        return false;
+    }
+
+    hyrisc_fastmem_stubs = (hyu8_t*)code;
+
+    return true;
+}
+
+// The handler is shared by every CPU in the process, and gets
+// installed once no matter how many threads get here at a time
+inline bool hyrisc_fastmem_install() {
+    static const bool installed = hyrisc_fastmem_setup();
+
+    return installed;
+}
+#endif
+
+// Reserves a guest address space worth of guard pages, RAM devices
+// have to be mapped in at base + their address. Returns nullptr if
+// the host doesn't support fastmem
+inline hyu8_t* hyrisc_fastmem_reserve() {
+#ifdef HYRISC_FASTMEM_SUPPORTED
+    void* base = mmap(
+        nullptr,
+        HYRISC_FASTMEM_SIZE + HYRISC_FASTMEM_GUARD,
+        PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1, 0
+    );
+
+    return (base == MAP_FAILED) ? nullptr : (hyu8_t*)base;
+#else
+    return nullptr;
+#endif
+}
+
+inline void hyrisc_fastmem_release(hyu8_t* base) {
+#ifdef HYRISC_FASTMEM_SUPPORTED
+    if (base) munmap(base, HYRISC_FASTMEM_SIZE + HYRISC_FASTMEM_GUARD);
+#endif
+}
+
+// Sets the bits of guest pages [addr, addr + size) in a bitmap of
+// HYRISC_FASTMEM_PAGES bits, for memory mapped into the region
+inline void hyrisc_fastmem_mark(hyu32_t* mapped, hyu32_t addr, hyu64_t size) {
+    hyu64_t first = addr >> HYRISC_PAGE_SHIFT;
+    hyu64_t last  = ((hyu64_t)addr + size + HYRISC_PAGE_SIZE - 1) >> HYRISC_PAGE_SHIFT;
+
+    for (hyu64_t page = first; page < last; page++)
+        mapped[page >> 5] |= 1u << (page & 31);
+}
+
+// Returns false if fastmem isn't supported on this host. mapped is
+// the region's bitmap of pages, see hyrisc_fastmem_mark
+inline bool hyrisc_fastmem_init(hyrisc_t* proc, hyu8_t* base, const hyu32_t* mapped) {
+#ifdef HYRISC_FASTMEM_SUPPORTED
+    if (!base || !hyrisc_fastmem_install()) return false;
+
+    if (!proc->fastmem) proc->fastmem = new hyrisc_fastmem_t;
+
+    hyrisc_fastmem_t* fastmem = proc->fastmem;
+
+    fastmem->base   = base;
+    fastmem->mapped = mapped;
+
+    for (int i = 0; i < 3; i++) {
+        fastmem->load[i]  = (hyrisc_fastmem_load_t)(hyrisc_fastmem_stubs + i * HYRISC_FASTMEM_STUB_SIZE);
+        fastmem->store[i] = (hyrisc_fastmem_store_t)(hyrisc_fastmem_stubs + (i + 3) * HYRISC_FASTMEM_STUB_SIZE);
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline void hyrisc_fastmem_destroy(hyrisc_t* proc) {
+    delete proc->fastmem;
+
+    proc->fastmem = nullptr;
+}
+
+// Returns false if the access has to go through the devices
+inline bool hyrisc_fastmem_access(hyrisc_t* proc, hyu32_t addr, hyu32_t* data, hybool_t rw, hyint_t size) {
+    hyrisc_fastmem_t* fastmem = proc->fastmem;
+
+    if (!fastmem) return false;
+
+    // Device pages would only fault
+    hyu32_t page = addr >> HYRISC_PAGE_SHIFT;
+
+    if (!(fastmem->mapped[page >> 5] & (1u << (page & 31)))) return false;
+
+    int i = (size > 2) ? 2 : size;
+
+    return rw ?
+        fastmem->store[i](fastmem->base, addr, *data) :
+        fastmem->load[i](fastmem->base, addr, data);
+}
\ No newline at end of file
@@ -8,7 +8,62 @@
 #define V 0b00000100
 #define C 0b00001000
 
+// Builds st out of the last flag-setting operation
+// C is a carry out, like on ARM: set when an addition wraps, and
+// when a subtraction (or comparison) doesn't borrow, that is when
+// a >= b unsigned. HI (a > b) and LS (a <= b) are built on that.
+inline hyu8_t hyrisc_get_flags(hyrisc_t* proc) {
+    hyrisc_flags_t& f = proc->internal.flags;
+
+    if (f.op == HY_FLAGS_NONE) return proc->internal.st;
+
+    hyu8_t st = proc->internal.st & ~(Z | N | V | C);
+
+    if (!f.res) st |= Z;
+    if (f.res & 0x80000000) st |= N;
+
+    switch (f.op) {
+        case HY_FLAGS_ADD: {
+            if (f.res < f.a) st |= C;
+            if ((f.a ^ f.res) & (f.b ^ f.res) & 0x80000000) st |= V;
+        } break;
+
+        case HY_FLAGS_SUB: {
+            if (f.a >= f.b) st |= C;
+            if ((f.a ^ f.b) & (f.a ^ f.res) & 0x80000000) st |= V;
+        } break;
+
+        case HY_FLAGS_MUL: {
+            hyi64_t product = (hyi64_t)(hyi32_t)f.a * (hyi32_t)f.b;
+
+            if (((hyu64_t)f.a * f.b) >> 32) st |= C;
+            if (product != (hyi32_t)f.res) st |= V;
+        } break;
+
+        case HY_FLAGS_SHL: {
+            hyu32_t shift = f.b & 31;
+
+            if (shift && (f.a >> (32 - shift))) st |= C;
+        } break;
+    }
+
+    f.op = HY_FLAGS_NONE;
+
+    proc->internal.st = st;
+
+    return st;
+}
+
+inline void hyrisc_defer_flags(hyrisc_t* proc, hyu8_t op, hyu32_t res, hyu32_t a = 0, hyu32_t b = 0) {
+    proc->internal.flags.op  = op;
+    proc->internal.flags.res = res;
+    proc->internal.flags.a   = a;
+    proc->internal.flags.b   = b;
+}
+
 inline static void hyrisc_set_flags(hyrisc_t* proc, hyu8_t mask, bool cond, bool reset = true) {
+    hyrisc_get_flags(proc);
+
     if (cond) {
         proc->internal.st |= mask;
         return;
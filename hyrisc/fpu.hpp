@@ -5,49 +5,67 @@
 
 #include <cfenv>
 #include <cmath>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(HYRISC_FPU_NO_SIMD)
+#define HYRISC_FPU_X86
+#include <immintrin.h>
+#endif
 
 // FPU version 1 revision 0
+// All FPU instructions use encoding 4, with fd, fs0 and fs1 in
+// fields X, Y and Z. f31 is FPCSR.
+
 // FPU Basic ISA
 // Supported instructions:
-// fadd   fd, fs0, fs1
-// fsub   fd, fs0, fs1
-// fmul   fd, fs0, fs1
-// fdiv   fd, fs0, fs1
-// ffma   fd, fs0, fs1
-// fsqrt  fd, fs0
-// fpow   fd, fs0, fs1
-// fabs   fd, fs0
-// fmod   fd, fs0, fs1
-// fexp   fd, fs0
-// fmin   fd, fs0, fs1
-// fmax   fd, fs0, fs1
-// fround fd, fs0
-// fclamp fd, fs0, fs1
+// fadd   fd, fs0, fs1      0x7f
+// fsub   fd, fs0, fs1      0x7e
+// fmul   fd, fs0, fs1      0x7d
+// fdiv   fd, fs0, fs1      0x7c
+// ffma   fd, fs0, fs1      0x7b
+// fsqrt  fd, fs0           0x7a
+// fpow   fd, fs0, fs1      0x79
+// fabs   fd, fs0           0x78
+// fmod   fd, fs0, fs1      0x77
+// fexp   fd, fs0           0x76
+// fmin   fd, fs0, fs1      0x75
+// fmax   fd, fs0, fs1      0x74
+// fround fd, fs0           0x73
+// fclamp fd, fs0, fs1      0x72
 
 // Conversion functions, use when transferring data from
 // main registers to floating point and back
-// fcvti  fd, fs0       f[d] = hyu32_t(round(f[fs0]))
-// fcvtf  fd, fs0       f[d] = float(f[fs0])
+// fcvti  fd, fs0           0x71    f[d] = hyu32_t(round(f[fs0]))
+// fcvtf  fd, fs0           0x70    f[d] = float(f[fs0])
+
+// Register transfers, raw bits are copied unchanged
+// fmvfr  rd, fs0           0x80    r[d] = f[fs0]
+// fmvrf  fd, rs0           0x81    f[d] = r[rs0]
 
 // Example:
 // add   r0, 0x2
 // mul   r0, 0x2
-// l     f1, r0
+// fmvrf f1, r0
 // fcvtf f1, f1
 
 // FPU Trig extension (supported)
-// fsin   fd, fs0
-// fcos   fd, fs0
-// ftan   fd, fs0
-// fasin  fd, fs0
-// facos  fd, fs0
-// fatan  fd, fs0
-// fsinh  fd, fs0
-// fcosh  fd, fs0
-// ftanh  fd, fs0
-
-// FPU Vector extension (not yet supported)
-// iiiiiiii 111xxxxx yyyyyzz zzzzzRss
+// fsin   fd, fs0           0x8a
+// fcos   fd, fs0           0x89
+// ftan   fd, fs0           0x88
+// fasin  fd, fs0           0x87
+// facos  fd, fs0           0x86
+// fatan  fd, fs0           0x85
+// fsinh  fd, fs0           0x84
+// fcosh  fd, fs0           0x83
+// ftanh  fd, fs0           0x82
+
+// FPU Vector extension (supported)
+// Opcodes 0x60-0x68 (fvadd-fvwvg, in the order listed below).
+// Encoding 4, S = 2 << SS (SS = 3 is illegal). Vectors are S
+// consecutive registers and must fit in f0-f30, sources are read
+// before the destination is written. Reductions add lanes by
+// folding the upper half onto the lower one until one is left.
+// iiiiiiii 11xxxxxy yyyyzzzz z00000SS
 // fvadd{2, 4, 8} fdi, fsi0, fsi1  f[fdi+0] = f[fsi0+0] + f[fsi1+0]
 // fvsub{2, 4, 8} fdi, fsi0, fsi1
 // fvmul{2, 4, 8} fdi, fsi0, fsi1
@@ -59,14 +77,26 @@
 // fvwvg{2, 4, 8} fd , fsi0, fsi1  f[fd] += f[fsi0+i] * f[fsi1+i], f[fd] /= S
 
 namespace fpu {
-    typedef hyfloat_t (*operation_t)(hyfloat_t&, hyfloat_t, hyfloat_t);
+    // Raw bits of a register
+    inline hyu32_t bits(hyfloat_t value) {
+        hyu32_t raw;
+
+        std::memcpy(&raw, &value, sizeof(raw));
 
+        return raw;
+    }
+
+// Operations are stateless functors, so they can be inlined
 #define OPERATION(name, code) \
-    operation_t HY_##name = [](hyfloat_t& dst, hyfloat_t src1, hyfloat_t src2) -> hyfloat_t { \
-        hyfloat_t temp = code; \
+    struct HY_##name##_t { \
+        inline hyfloat_t operator()(hyfloat_t& dst, hyfloat_t src1, hyfloat_t src2) const { \
+            hyfloat_t temp = code; \
 \
-        return temp; \
-    }
+            return temp; \
+        } \
+    }; \
+\
+    constexpr HY_##name##_t HY_##name = {}
 
     OPERATION(fadd  , src1 + src2           ; dst  = temp);
     OPERATION(fsub  , src1 - src2           ; dst  = temp);
@@ -92,23 +122,256 @@ namespace fpu {
     OPERATION(fround, std::rintf(src1)      ; dst  = temp);
     OPERATION(fclamp, (dst < src1) ? src1 : ((dst > src2) ? src2 : dst); dst = temp);
     OPERATION(fcvti , 0.0f; *(hyu32_t*)&dst = (hyu32_t)(hyint_t)std::rintf(src1));
-    OPERATION(fcvtf , 0.0f; dst = (hyfloat_t)(hyu32_t)src1);
+    OPERATION(fcvtf , 0.0f; dst = (hyfloat_t)bits(src1));
 
 #undef OPERATION
 
-    void perform_operation(hyrisc_t* proc, hyfloat_t& dst, hyfloat_t src1, hyfloat_t src2, operation_t op) {
-        hyu32_t fpcsr = *(hyu32_t*)&proc->internal.f[31];
+    // FPCSR
+    // Bits 0-4 are sticky exception flags, bits 5-6 the rounding mode.
+    // The host rounding mode is only changed when the guest's changes,
+    // and exceptions are left pending in the host's own sticky flags
+    // until something reads FPCSR. The CPU owning the pending flags
+    // is tracked per thread, so several CPUs can share one.
+    const int rounding_modes[] = {
+        FE_TONEAREST,
+        FE_UPWARD,
+        FE_DOWNWARD,
+        FE_TOWARDZERO
+    };
+
+    inline thread_local int       host_rounding = -1;
+    inline thread_local hyrisc_t* flags_owner   = nullptr;
+
+    // Raw FPCSR bits, f31 is a float register
+    inline hyu32_t fpcsr(hyrisc_t* proc) {
+        return bits(proc->internal.f[31]);
+    }
+
+    inline void set_fpcsr_bits(hyrisc_t* proc, hyu32_t value) {
+        std::memcpy(&proc->internal.f[31], &value, sizeof(value));
+    }
+
+    // Folds pending host exceptions into the CPU's FPCSR
+    inline void sync(hyrisc_t* proc) {
+        if (flags_owner != proc) return;
+
+        int raised = std::fetestexcept(FE_ALL_EXCEPT);
+
+        if (raised) {
+            hyu32_t csr = fpcsr(proc);
+
+            if (raised & FE_DIVBYZERO) csr |= (1 << 0);
+            if (raised & FE_INEXACT  ) csr |= (1 << 1);
+            if (raised & FE_INVALID  ) csr |= (1 << 2);
+            if (raised & FE_OVERFLOW ) csr |= (1 << 3);
+            if (raised & FE_UNDERFLOW) csr |= (1 << 4);
+
+            set_fpcsr_bits(proc, csr);
+
+            std::feclearexcept(FE_ALL_EXCEPT);
+        }
+
+        flags_owner = nullptr;
+    }
+
+    // Must be called before a CPU owning pending flags goes away
+    inline void release(hyrisc_t* proc) {
+        sync(proc);
+    }
+
+    // Guest accesses to FPCSR have to go through these
+    inline hyu32_t get_fpcsr(hyrisc_t* proc) {
+        sync(proc);
+
+        return fpcsr(proc);
+    }
+
+    inline void set_fpcsr(hyrisc_t* proc, hyu32_t value) {
+        sync(proc);
+
+        set_fpcsr_bits(proc, value);
+    }
+
+    // Sets up the host FPU for an operation on this CPU
+    inline void prepare(hyrisc_t* proc) {
+        if (flags_owner != proc) {
+            if (flags_owner) sync(flags_owner);
+
+            // Start from a clean slate so only this CPU's
+            // exceptions end up in its FPCSR
+            std::feclearexcept(FE_ALL_EXCEPT);
+
+            flags_owner = proc;
+        }
 
-        std::fesetround((fpcsr >> 5) & 0x3);
+        int rounding = (fpcsr(proc) >> 5) & 0x3;
 
-        hyfloat_t temp = op(dst, src1, src2);
+        if (rounding != host_rounding) {
+            std::fesetround(rounding_modes[rounding]);
 
-        if (std::fetestexcept(FE_DIVBYZERO)) fpcsr |= (1 << 0);
-        if (std::fetestexcept(FE_INEXACT  )) fpcsr |= (1 << 1);
-        if (std::fetestexcept(FE_INVALID  )) fpcsr |= (1 << 2);
-        if (std::fetestexcept(FE_OVERFLOW )) fpcsr |= (1 << 3);
-        if (std::fetestexcept(FE_UNDERFLOW)) fpcsr |= (1 << 4);
+            host_rounding = rounding;
+        }
+    }
+
+    template <class Op>
+    inline void perform_operation(hyrisc_t* proc, hyfloat_t& dst, hyfloat_t src1, hyfloat_t src2, Op op) {
+        prepare(proc);
 
-        *(hyu32_t*)&proc->internal.f[31] = fpcsr;
+        op(dst, src1, src2);
     }
+
+    // Vector extension kernels
+    // Every kernel must produce the same results (and exceptions)
+    // as the scalar one, so unused SIMD lanes are never computed on
+    enum vector_op_t {
+        FV_ADD,
+        FV_SUB,
+        FV_MUL,
+        FV_DIV,
+        FV_FMA
+    };
+
+    // d[i] = a[i] op b[i], i = 0 -> n-1
+    typedef void (*vector_kernel_t)(hyfloat_t*, const hyfloat_t*, const hyfloat_t*, int);
+
+    // Sum of a[i] * b[i], or of a[i] if b is null
+    typedef hyfloat_t (*reduce_kernel_t)(const hyfloat_t*, const hyfloat_t*, int);
+
+    struct vector_unit_t {
+        const char*     name;
+        vector_kernel_t op[5];
+        reduce_kernel_t reduce;
+    };
+
+    template <int op>
+    inline hyfloat_t vector_lane(hyfloat_t d, hyfloat_t a, hyfloat_t b) {
+        if constexpr (op == FV_ADD) return a + b;
+        if constexpr (op == FV_SUB) return a - b;
+        if constexpr (op == FV_MUL) return a * b;
+        if constexpr (op == FV_DIV) return a / b;
+
+        return d + (a * b);
+    }
+
+    template <int op>
+    void vector_scalar(hyfloat_t* d, const hyfloat_t* a, const hyfloat_t* b, int n) {
+        hyfloat_t temp[8];
+
+        for (int i = 0; i < n; i++)
+            temp[i] = vector_lane <op> (d[i], a[i], b[i]);
+
+        for (int i = 0; i < n; i++)
+            d[i] = temp[i];
+    }
+
+    inline hyfloat_t reduce_scalar(const hyfloat_t* a, const hyfloat_t* b, int n) {
+        hyfloat_t p[8];
+
+        for (int i = 0; i < n; i++)
+            p[i] = b ? (a[i] * b[i]) : a[i];
+
+        for (int w = n >> 1; w; w >>= 1)
+            for (int i = 0; i < w; i++)
+                p[i] = p[i] + p[i + w];
+
+        return p[0];
+    }
+
+#ifdef HYRISC_FPU_X86
+    template <int op>
+    inline __m128 vector_lanes_sse(const hyfloat_t* d, __m128 a, __m128 b) {
+        if constexpr (op == FV_ADD) return _mm_add_ps(a, b);
+        if constexpr (op == FV_SUB) return _mm_sub_ps(a, b);
+        if constexpr (op == FV_MUL) return _mm_mul_ps(a, b);
+        if constexpr (op == FV_DIV) return _mm_div_ps(a, b);
+
+        return _mm_add_ps(_mm_loadu_ps(d), _mm_mul_ps(a, b));
+    }
+
+    template <int op>
+    void vector_sse(hyfloat_t* d, const hyfloat_t* a, const hyfloat_t* b, int n) {
+        if (n == 2) return vector_scalar <op> (d, a, b, n);
+
+        __m128 lo = vector_lanes_sse <op> (d, _mm_loadu_ps(a), _mm_loadu_ps(b));
+
+        if (n == 8) {
+            __m128 hi = vector_lanes_sse <op> (d + 4, _mm_loadu_ps(a + 4), _mm_loadu_ps(b + 4));
+
+            _mm_storeu_ps(d + 4, hi);
+        }
+
+        _mm_storeu_ps(d, lo);
+    }
+
+    inline __m128 reduce_load_sse(const hyfloat_t* a, const hyfloat_t* b) {
+        return b ? _mm_mul_ps(_mm_loadu_ps(a), _mm_loadu_ps(b)) : _mm_loadu_ps(a);
+    }
+
+    // Adds up 4 lanes as (p0 + p2) + (p1 + p3)
+    inline hyfloat_t reduce_lanes_sse(__m128 p) {
+        p = _mm_add_ps(p, _mm_movehl_ps(_mm_setzero_ps(), p));
+        p = _mm_add_ss(p, _mm_shuffle_ps(p, p, 1));
+
+        return _mm_cvtss_f32(p);
+    }
+
+    inline hyfloat_t reduce_sse(const hyfloat_t* a, const hyfloat_t* b, int n) {
+        if (n == 2) return reduce_scalar(a, b, n);
+
+        __m128 p = reduce_load_sse(a, b);
+
+        if (n == 8) p = _mm_add_ps(p, reduce_load_sse(a + 4, b ? (b + 4) : nullptr));
+
+        return reduce_lanes_sse(p);
+    }
+
+    template <int op>
+    __attribute__((target("avx")))
+    void vector_avx(hyfloat_t* d, const hyfloat_t* a, const hyfloat_t* b, int n) {
+        if (n != 8) return vector_sse <op> (d, a, b, n);
+
+        __m256 va = _mm256_loadu_ps(a);
+        __m256 vb = _mm256_loadu_ps(b);
+        __m256 r;
+
+        if constexpr (op == FV_ADD) r = _mm256_add_ps(va, vb);
+        if constexpr (op == FV_SUB) r = _mm256_sub_ps(va, vb);
+        if constexpr (op == FV_MUL) r = _mm256_mul_ps(va, vb);
+        if constexpr (op == FV_DIV) r = _mm256_div_ps(va, vb);
+        if constexpr (op == FV_FMA) r = _mm256_add_ps(_mm256_loadu_ps(d), _mm256_mul_ps(va, vb));
+
+        _mm256_storeu_ps(d, r);
+    }
+
+    __attribute__((target("avx")))
+    inline hyfloat_t reduce_avx(const hyfloat_t* a, const hyfloat_t* b, int n) {
+        if (n != 8) return reduce_sse(a, b, n);
+
+        __m256 p = _mm256_loadu_ps(a);
+
+        if (b) p = _mm256_mul_ps(p, _mm256_loadu_ps(b));
+
+        return reduce_lanes_sse(_mm_add_ps(_mm256_castps256_ps128(p), _mm256_extractf128_ps(p, 1)));
+    }
+#endif
+
+#define VECTOR_UNIT(name, impl, reduce) \
+    { name, { impl <FV_ADD>, impl <FV_SUB>, impl <FV_MUL>, impl <FV_DIV>, impl <FV_FMA> }, reduce }
+
+    inline vector_unit_t select_vector_unit() {
+#ifdef HYRISC_FPU_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx"))
+            return VECTOR_UNIT("avx", vector_avx, reduce_avx);
+
+        return VECTOR_UNIT("sse", vector_sse, reduce_sse);
+#else
+        return VECTOR_UNIT("scalar", vector_scalar, reduce_scalar);
+#endif
+    }
+
+#undef VECTOR_UNIT
+
+    inline vector_unit_t vector_unit = select_vector_unit();
 }
\ No newline at end of file
@@ -7,12 +7,18 @@
 #include <cstring>
 #include <csignal>
 #include <cfenv>
+#include <limits>
 
 #include "state.hpp"
 #include "types.hpp"
 #include "flags.hpp"
 #include "alu.hpp"
 #include "fpu.hpp"
+#include "cache.hpp"
+#include "tlb.hpp"
+#include "fastmem.hpp"
+#include "savestate.hpp"
+#include "coverage.hpp"
 
 #include <iostream>
 
@@ -27,7 +33,7 @@ enum hyrisc_register_names_t {
     r28, lr , sp , pc
 };
 
-const char* hyrisc_register_names[] = {
+inline const char* hyrisc_register_names[] = {
     "r0" , "r1" , "r2" , "r3" ,
     "r4" , "r5" , "r6" , "r7" ,
     "r8" , "r9" , "r10", "r11",
@@ -38,7 +44,7 @@ const char* hyrisc_register_names[] = {
     "r28", "fp" , "sp" , "pc"
 };
 
-void hyrisc_bci_update(hyrisc_t* proc) {
+inline void hyrisc_bci_update(hyrisc_t* proc) {
     if (proc->ext.bci.busreq && proc->ext.bci.busack) {
         proc->ext.bci.busreq = false;
         proc->ext.bci.busack = false;
@@ -73,12 +79,12 @@ void hyrisc_bci_update(hyrisc_t* proc) {
     }
 }
 
-void hyrisc_set_cpuid(hyrisc_t* proc, const char* id, hyint_t core) {
+inline void hyrisc_set_cpuid(hyrisc_t* proc, const char* id, hyint_t core) {
     proc->id = id;
     proc->core = core;
 }
 
-void hyrisc_reset(hyrisc_t* proc) {
+inline void hyrisc_reset(hyrisc_t* proc) {
     std::memset(&proc->internal, 0, sizeof(proc->internal));
 
     proc->ext.bci.a      = 0xffffffff;
@@ -97,7 +103,7 @@ void hyrisc_reset(hyrisc_t* proc) {
     proc->internal.r[pc] = proc->ext.pic.v;
 }
 
-bool hyrisc_handle_signals(hyrisc_t* proc) {
+inline bool hyrisc_handle_signals(hyrisc_t* proc) {
     // If RESET is high, then reset the CPU
     if (proc->ext.reset) {
         hyrisc_reset(proc);
@@ -132,7 +138,7 @@ enum hyrisc_access_size_t {
     AS_EXECUTE
 };
 
-void hyrisc_init_read(hyrisc_t* proc, hyu32_t addr, hyint_t size = AS_LONG) {
+inline void hyrisc_init_read(hyrisc_t* proc, hyu32_t addr, hyint_t size = AS_LONG) {
     proc->ext.bci.a = addr;
     proc->ext.bci.s = size;
 
@@ -142,7 +148,7 @@ void hyrisc_init_read(hyrisc_t* proc, hyu32_t addr, hyint_t size = AS_LONG) {
     proc->ext.bci.be = 0x0;
 }
 
-void hyrisc_init_write(hyrisc_t* proc, hyu32_t addr, hyu32_t value, hyint_t size = AS_LONG) {
+inline void hyrisc_init_write(hyrisc_t* proc, hyu32_t addr, hyu32_t value, hyint_t size = AS_LONG) {
     proc->ext.bci.a = addr;
     proc->ext.bci.s = size;
     proc->ext.bci.d = value;
@@ -151,12 +157,17 @@ void hyrisc_init_write(hyrisc_t* proc, hyu32_t addr, hyu32_t value, hyint_t size
     proc->ext.bci.busreq = true;
 
     proc->ext.bci.be = 0x0;
+
+    // Keep predecoded instructions coherent with memory
+    hyrisc_cache_invalidate(proc, addr, (size >= AS_LONG) ? 4 : (1 << size));
 }
 
 bool hyrisc_execute(hyrisc_t*, hyint_t);
-void hyrisc_decode(hyrisc_t*);
+hyrisc_handler_t hyrisc_decode(hyrisc_t*);
+hyrisc_handler_t hyrisc_get_handler(hyu8_t);
+inline bool hyrisc_ends_block(const hyrisc_decoder_t&);
 
-void hyrisc_clock(hyrisc_t* proc) {
+inline void hyrisc_clock(hyrisc_t* proc) {
     // Update BCI
     hyrisc_bci_update(proc);
 
@@ -181,14 +192,17 @@ void hyrisc_clock(hyrisc_t* proc) {
 
         case 0x2: {
             // Decode and execute are done on the same clock cycle
-            hyrisc_decode(proc);
+            hyrisc_handler_t handler = hyrisc_decode(proc);
 
-            bool done = hyrisc_execute(proc, 0);
+            bool done = handler(proc, 0);
 
             // If its done, then reset cycle counter
             if (done) {
                 proc->internal.cycle = 0;
                 proc->internal.r[r0] = 0;
+                proc->internal.retired++;
+
+                HYRISC_COVER_RETIRE(proc);
             } else {
                 // Instruction needs an extra cycle to wait for I/O
                 proc->internal.cycle++;
@@ -201,10 +215,100 @@ void hyrisc_clock(hyrisc_t* proc) {
     
             proc->internal.cycle = 0;
             proc->internal.r[r0] = 0;
+            proc->internal.retired++;
+
+            HYRISC_COVER_RETIRE(proc);
         } break;
     }
 }
 
+// Functional execution
+// Runs a whole instruction per call, memory accesses are routed
+// straight to memory through fastmem or the TLB, or to the owning
+// device through proc->fbus. Pins are left in the same state pin-accurate
+// mode leaves them at the end of an instruction.
+
+// Performs the access currently set up on the BCI pins. Returns
+// false if nothing answered and the BCI raised a bus error IRQ
+inline bool hyrisc_bus_access(hyrisc_t* proc) {
+    hyu32_t addr = proc->ext.bci.a;
+    hyu32_t data = proc->ext.bci.d;
+
+    hyu32_t bytes = (proc->ext.bci.s >= AS_LONG) ? 4 : (1 << proc->ext.bci.s);
+
+    bool ack = hyrisc_fastmem_access(proc, addr, &data, proc->ext.bci.rw, proc->ext.bci.s) ||
+               hyrisc_tlb_access(proc, addr, &data, proc->ext.bci.rw, bytes) ||
+               proc->fbus.access(proc->fbus.udata, addr, &data, proc->ext.bci.rw, proc->ext.bci.s);
+
+    if (ack) {
+        proc->ext.bci.d = data;
+
+        // Handshake completes on the same call
+        proc->ext.bci.busreq = false;
+        proc->ext.bci.busack = false;
+
+        return true;
+    }
+
+    // Open Bus, let the BCI handle it as it would on the next clock
+    hyrisc_bci_update(proc);
+
+    return !proc->ext.pic.irq;
+}
+
+inline void hyrisc_step(hyrisc_t* proc) {
+    hyrisc_bci_update(proc);
+
+    if (!hyrisc_handle_signals(proc)) return;
+
+    hyu32_t addr = proc->internal.r[pc];
+
+    hyrisc_predecoded_t* entry = proc->cache ? hyrisc_cache_entry(proc->cache, addr) : nullptr;
+
+    hyrisc_handler_t handler;
+
+    if (entry && entry->valid && (entry->pc == addr)) {
+        // Skip the fetch, but leave the pins as it would have
+        proc->ext.bci.a  = addr;
+        proc->ext.bci.d  = entry->instruction;
+        proc->ext.bci.s  = AS_EXECUTE;
+        proc->ext.bci.rw = RW_READ;
+        proc->ext.bci.be = 0x0;
+
+        proc->internal.instruction = entry->instruction;
+        proc->internal.decoder = entry->decoder;
+        proc->internal.r[pc] += 4;
+
+        handler = entry->handler;
+    } else {
+        hyrisc_init_read(proc, addr, AS_EXECUTE);
+
+        if (!hyrisc_bus_access(proc)) {
+            proc->internal.retired++;
+
+            return;
+        }
+
+        proc->internal.instruction = proc->ext.bci.d;
+        proc->internal.r[pc] += 4;
+
+        handler = hyrisc_decode(proc);
+    }
+
+    if (!handler(proc, 0)) {
+        proc->internal.cycle = 3;
+
+        if (hyrisc_bus_access(proc))
+            handler(proc, 1);
+    }
+
+    proc->internal.cycle = 0;
+    proc->internal.r[r0] = 0;
+    proc->internal.retired++;
+
+    HYRISC_COVER_RETIRE(proc);
+}
+
 /*
     lui     %gpr10,    0xaabb; gpr0 = 0xaabb0000 flags = 00000010
     or      %gpr10,    0xccdd; gpr0 = 0xaabbccdd flags = 00000010
@@ -322,10 +426,47 @@ enum hyrisc_opcodes_t {
     HY_POPM      = 0x9e,
     HY_PUSHS     = 0x9d,
     HY_POPS      = 0x9c,
-    HY_NOP       = 0x8f
+    HY_NOP       = 0x8f,
+    HY_FSIN      = 0x8a, // FPU Trig extension
+    HY_FCOS      = 0x89,
+    HY_FTAN      = 0x88,
+    HY_FASIN     = 0x87,
+    HY_FACOS     = 0x86,
+    HY_FATAN     = 0x85,
+    HY_FSINH     = 0x84,
+    HY_FCOSH     = 0x83,
+    HY_FTANH     = 0x82,
+    HY_FMVRF     = 0x81, // Move r to f
+    HY_FMVFR     = 0x80, // Move f to r
+    HY_FADD      = 0x7f, // FPU Basic ISA
+    HY_FSUB      = 0x7e,
+    HY_FMUL      = 0x7d,
+    HY_FDIV      = 0x7c,
+    HY_FFMA      = 0x7b,
+    HY_FSQRT     = 0x7a,
+    HY_FPOW      = 0x79,
+    HY_FABS      = 0x78,
+    HY_FMOD      = 0x77,
+    HY_FEXP      = 0x76,
+    HY_FMIN      = 0x75,
+    HY_FMAX      = 0x74,
+    HY_FROUND    = 0x73,
+    HY_FCLAMP    = 0x72,
+    HY_FCVTI     = 0x71,
+    HY_FCVTF     = 0x70,
+    HY_FVWVG     = 0x68, // FPU Vector extension
+    HY_FVAVG     = 0x67,
+    HY_FVWSM     = 0x66,
+    HY_FVSUM     = 0x65,
+    HY_FVFMA     = 0x64,
+    HY_FVDIV     = 0x63,
+    HY_FVMUL     = 0x62,
+    HY_FVSUB     = 0x61,
+    HY_FVADD     = 0x60,
+    HY_DEBUG     = 0x45  // Break into host
 };
 
-#define BITS(b, l) ((((hyu32_t)proc->internal.instruction >> b) & ((1 << l) - 1)))
+#define BITS(b, l) ((((hyu32_t)instruction >> b) & ((1 << l) - 1)))
 
 #define CC_EQ 0
 #define CC_NE 1
@@ -343,31 +484,55 @@ enum hyrisc_opcodes_t {
 #define CC_LE 13
 #define CC_AL 14
 
-#define SET(f) (proc->internal.st & f)
-#define CLEAR(f) (!SET(f))
+// Conditions only depend on the low 4 bits of st, so each one
+// is a mask of the flag states it holds for
+constexpr hyu16_t hyrisc_condition_mask(int cc) {
+    hyu16_t mask = 0;
+
+    for (int st = 0; st < 16; st++) {
+        bool z = st & Z, n = st & N, v = st & V, c = st & C;
+
+        bool holds = false;
+
+        switch (cc) {
+            case CC_EQ: { holds =  z; } break;
+            case CC_NE: { holds = !z; } break;
+            case CC_CS: { holds =  c; } break;
+            case CC_CC: { holds = !c; } break;
+            case CC_MI: { holds =  n; } break;
+            case CC_PL: { holds = !n; } break;
+            case CC_VS: { holds =  v; } break;
+            case CC_VC: { holds = !v; } break;
+            case CC_HI: { holds =  c && !z; } break;
+            case CC_LS: { holds = !c ||  z; } break;
+            case CC_GE: { holds = n == v; } break;
+            case CC_LT: { holds = n != v; } break;
+            case CC_GT: { holds = !z && (n == v); } break;
+            case CC_LE: { holds =  z || (n != v); } break;
+            case CC_AL: { holds = true; } break;
+        }
 
-inline bool hyrisc_test_condition(hyrisc_t* proc, int cc) {
-    switch (cc) {
-        case CC_EQ: { return  SET(Z); }
-        case CC_NE: { return !SET(Z); }
-        case CC_CS: { return  SET(C); }
-        case CC_CC: { return !SET(C); }
-        case CC_MI: { return  SET(N); }
-        case CC_PL: { return !SET(N); }
-        case CC_VS: { return  SET(V); }
-        case CC_VC: { return !SET(V); }
-        case CC_HI: { return SET(C) && !SET(Z); }
-        case CC_LS: { return !SET(C) || SET(Z); }
-        case CC_GE: { return SET(N) == SET(V); }
-        case CC_LT: { return SET(N) != SET(V); }
-        case CC_GT: { return !SET(Z) && (SET(N) == SET(V)); }
-        case CC_LE: { return  SET(Z) && (SET(N) != SET(V)); }
-        case CC_AL: { return true; }
+        if (holds) mask |= 1 << st;
     }
 
-    return false;
+    return mask;
+}
+
+constexpr std::array <hyu16_t, 32> hyrisc_build_condition_table() {
+    std::array <hyu16_t, 32> table = {};
+
+    // Condition fields are 5 bits wide, codes past AL never hold
+    for (int cc = 0; cc < 32; cc++)
+        table[cc] = hyrisc_condition_mask(cc);
+
+    return table;
 }
 
+constexpr std::array <hyu16_t, 32> hyrisc_condition_table = hyrisc_build_condition_table();
+
+inline bool hyrisc_test_condition(hyrisc_t* proc, int cc) {
+    return (hyrisc_condition_table[cc & 31] >> (hyrisc_get_flags(proc) & 0xf)) & 1;
+}
 
 #undef CC_EQ
 #undef CC_NE
@@ -384,8 +549,6 @@ inline bool hyrisc_test_condition(hyrisc_t* proc, int cc) {
 #undef CC_GT
 #undef CC_LE
 #undef CC_AL
-#undef SET
-#undef CLEAR
 
 #define hyrisc_bus_wait if (!proc->ext.bci.busack) return false; \
 \
@@ -480,30 +643,30 @@ proc->ext.bci.busack = false;
     0x8f    nop                              4   nop
 */
 
-void hyrisc_decode(hyrisc_t* proc) {
-    std::memset(&proc->internal.decoder, 0, sizeof(proc->internal.decoder));
+inline void hyrisc_decode_word(hyrisc_decoder_t* decoder, hyu32_t instruction) {
+    std::memset(decoder, 0, sizeof(hyrisc_decoder_t));
 
-    proc->internal.decoder.opcode = BITS(0, 8);
-    proc->internal.decoder.encoding = BITS(8, 2);
+    decoder->opcode   = BITS(0, 8);
+    decoder->encoding = BITS(8, 2);
 
-    switch (proc->internal.decoder.encoding) {
+    switch (decoder->encoding) {
         case 3: {
-            proc->internal.decoder.fieldx = BITS(10, 5);
-            proc->internal.decoder.fieldy = BITS(15, 5);
-            proc->internal.decoder.fieldz = BITS(20, 5);
-            proc->internal.decoder.fieldw = BITS(25, 5);
-            proc->internal.decoder.size   = BITS(30, 2);
+            decoder->fieldx = BITS(10, 5);
+            decoder->fieldy = BITS(15, 5);
+            decoder->fieldz = BITS(20, 5);
+            decoder->fieldw = BITS(25, 5);
+            decoder->size   = BITS(30, 2);
         } break;
 
         case 2: {
-            proc->internal.decoder.fieldx = BITS(10, 5);
-            proc->internal.decoder.fieldy = BITS(15, 5);
-            proc->internal.decoder.imm8   = BITS(20, 8);
+            decoder->fieldx = BITS(10, 5);
+            decoder->fieldy = BITS(15, 5);
+            decoder->imm8   = BITS(20, 8);
         } break;
 
         case 1: {
-            proc->internal.decoder.fieldx = BITS(10, 5);
-            proc->internal.decoder.imm16  = BITS(15, 16);
+            decoder->fieldx = BITS(10, 5);
+            decoder->imm16  = BITS(15, 16);
         } break;
 
         // The instruction set is so coarse we don't even need encoding 0
@@ -524,19 +687,54 @@ void hyrisc_decode(hyrisc_t* proc) {
     }
 
     // _log(debug, "instruction=%08x, fx=%02x, fy=%02x, fz=%02x, fw=%02x, i16=%04x, i8=%02x, size=%u, encoding=%u, opcode=%02x",
-    //     proc->internal.instruction,
-    //     proc->internal.decoder.fieldx,
-    //     proc->internal.decoder.fieldy,
-    //     proc->internal.decoder.fieldz,
-    //     proc->internal.decoder.fieldw,
-    //     proc->internal.decoder.imm16,
-    //     proc->internal.decoder.imm8,
-    //     proc->internal.decoder.size,
-    //     proc->internal.decoder.encoding,
-    //     proc->internal.decoder.opcode
+    //     instruction,
+    //     decoder->fieldx,
+    //     decoder->fieldy,
+    //     decoder->fieldz,
+    //     decoder->fieldw,
+    //     decoder->imm16,
+    //     decoder->imm8,
+    //     decoder->size,
+    //     decoder->encoding,
+    //     decoder->opcode
     // );
 }
 
+inline hyrisc_handler_t hyrisc_decode(hyrisc_t* proc) {
+    // The instruction latch was fetched from PC-4 on the previous cycle
+    hyu32_t addr = proc->internal.r[pc] - 4;
+
+    hyrisc_predecoded_t* entry = nullptr;
+
+    if (proc->cache) {
+        entry = hyrisc_cache_entry(proc->cache, addr);
+
+        bool hit = entry->valid &&
+                   (entry->pc == addr) &&
+                   (entry->instruction == proc->internal.instruction);
+
+        if (hit) {
+            proc->internal.decoder = entry->decoder;
+
+            return entry->handler;
+        }
+    }
+
+    hyrisc_decode_word(&proc->internal.decoder, proc->internal.instruction);
+
+    if (entry) {
+        entry->pc          = addr;
+        entry->instruction = proc->internal.instruction;
+        entry->decoder     = proc->internal.decoder;
+        entry->handler     = hyrisc_get_handler(proc->internal.decoder.opcode);
+        entry->valid       = true;
+
+        hyrisc_cache_mark_page(proc->cache, addr);
+    }
+
+    return hyrisc_get_handler(proc->internal.decoder.opcode);
+}
+
 #define REGX proc->internal.r[proc->internal.decoder.fieldx]
 #define REGY proc->internal.r[proc->internal.decoder.fieldy]
 #define REGZ proc->internal.r[proc->internal.decoder.fieldz]
@@ -553,453 +751,1144 @@ void hyrisc_decode(hyrisc_t* proc) {
 #define INDEXED_MULTIPLY (REGY + (REGZ * I5W))
 #define INDEXED_SHIFT    (REGY + (REGZ << I5W))
 
-bool hyrisc_execute(hyrisc_t* proc, hyint_t cycle) {
-    switch (proc->internal.decoder.opcode) {
-        case HY_MOV: {
-            REGX = REGY;
+// Instruction handlers
+// Every opcode is implemented by its own handler, handlers return
+// false when they need an extra cycle to wait for I/O.
+#define HYRISC_HANDLER(name) inline bool hyrisc_op_##name(hyrisc_t* proc, hyint_t cycle)
+
+// ALU handlers are generated from one template, specialized per
+// operation and per operand source
+enum hyrisc_operand_t {
+    OPD_X,
+    OPD_Y,
+    OPD_Z,
+    OPD_I8,
+    OPD_I16,
+    OPD_I5Y,
+    OPD_SIZE,   // Access size in bytes
+    OPD_ZERO
+};
 
-            return true;
-        } break;
+template <int source>
+inline hyu32_t hyrisc_operand(hyrisc_t* proc) {
+    if constexpr (source == OPD_X   ) return REGX;
+    if constexpr (source == OPD_Y   ) return REGY;
+    if constexpr (source == OPD_Z   ) return REGZ;
+    if constexpr (source == OPD_I8  ) return I8;
+    if constexpr (source == OPD_I16 ) return I16;
+    if constexpr (source == OPD_I5Y ) return I5Y;
+    if constexpr (source == OPD_SIZE) return 1 << SIZE;
+
+    return 0;
+}
 
-        case HY_LI: {
-            REGX = I16;
+template <class Op, int src1, int src2>
+bool hyrisc_op_alu(hyrisc_t* proc, hyint_t cycle) {
+    alu::perform_operation(proc, REGX, hyrisc_operand <src1> (proc), hyrisc_operand <src2> (proc), Op());
 
-            return true;
-        } break;
+    return true;
+}
 
-        case HY_LUI: {
-            REGX = I16 << 16;
+#define HYRISC_ALU_HANDLER(name, op, src1, src2) \
+    constexpr hyrisc_handler_t hyrisc_op_##name = hyrisc_op_alu <alu::HY_##op##_t, src1, src2>;
 
-            return true;
-        } break;
+HYRISC_HANDLER(mov) {
+    REGX = REGY;
 
-        case HY_LOADM: {
-            switch (cycle) {
-                case 0: {
-                    hyrisc_init_read(proc, INDEXED_MULTIPLY, SIZE);
-                    
-                    return false;
-                } break;
+    return true;
+}
 
-                case 1: {
-                    hyrisc_do_read(REGX);
+HYRISC_HANDLER(li) {
+    REGX = I16;
 
-                    return true;
-                } break;
-            }
-        } break;
-        
-        case HY_LOADS: {
-            switch (cycle) {
-                case 0: {
-                    hyrisc_init_read(proc, INDEXED_SHIFT, SIZE);
-                    
-                    return false;
-                } break;
+    return true;
+}
 
-                case 1: {
-                    hyrisc_do_read(REGX);
+HYRISC_HANDLER(lui) {
+    REGX = I16 << 16;
 
-                    return true;
-                } break;
-            }
-        } break;
+    return true;
+}
 
-        case HY_LOADFA: {
-            switch (cycle) {
-                case 0: {
-                    hyrisc_init_read(proc, REGY + I10, SIZE);
+HYRISC_HANDLER(loadm) {
+    switch (cycle) {
+        case 0: {
+            hyrisc_init_read(proc, INDEXED_MULTIPLY, SIZE);
 
-                    return false;
-                } break;
+            return false;
+        } break;
 
-                case 1: {
-                    hyrisc_do_read(REGX);
+        case 1: {
+            hyrisc_do_read(REGX);
 
-                    return true;
-                } break;
-            }
+            return true;
         } break;
+    }
 
-        case HY_LOADFS: {
-            switch (cycle) {
-                case 0: {
-                    hyrisc_init_read(proc, REGY - I10, SIZE);
-
-                    return false;
-                } break;
+    return true;
+}
 
-                case 1: {
-                    hyrisc_do_read(REGX);
+HYRISC_HANDLER(loads) {
+    switch (cycle) {
+        case 0: {
+            hyrisc_init_read(proc, INDEXED_SHIFT, SIZE);
 
-                    return true;
-                } break;
-            }
+            return false;
         } break;
 
-        case HY_STOREM: {
-            switch (cycle) {
-                case 0: {
-                    hyrisc_init_write(proc, INDEXED_MULTIPLY, REGX, SIZE);
-
-                    return false;
-                } break;
-
-                case 1: {
-                    hyrisc_bus_wait;
+        case 1: {
+            hyrisc_do_read(REGX);
 
-                    return true;
-                } break;
-            }
+            return true;
         } break;
+    }
 
-        case HY_STORES: {
-            switch (cycle) {
-                case 0: {
-                    hyrisc_init_write(proc, INDEXED_SHIFT, REGX, SIZE);
+    return true;
+}
 
-                    return false;
-                } break;
+HYRISC_HANDLER(loadfa) {
+    switch (cycle) {
+        case 0: {
+            hyrisc_init_read(proc, REGY + I10, SIZE);
 
-                case 1: {
-                    hyrisc_bus_wait;
+            return false;
+        } break;
 
-                    return true;
-                } break;
-            }
+        case 1: {
+            hyrisc_do_read(REGX);
+
+            return true;
         } break;
+    }
 
-        case HY_STOREFA: {
-            switch (cycle) {
-                case 0: {
-                    hyrisc_init_write(proc, REGY + I10, REGX, SIZE);
+    return true;
+}
 
-                    return false;
-                } break;
+HYRISC_HANDLER(loadfs) {
+    switch (cycle) {
+        case 0: {
+            hyrisc_init_read(proc, REGY - I10, SIZE);
 
-                case 1: {
-                    hyrisc_bus_wait;
+            return false;
+        } break;
 
-                    return true;
-                } break;
-            }
+        case 1: {
+            hyrisc_do_read(REGX);
+
+            return true;
         } break;
-        
-        case HY_STOREFS: {
-            switch (cycle) {
-                case 0: {
-                    hyrisc_init_write(proc, REGY - I10, REGX, SIZE);
+    }
 
-                    return false;
-                } break;
+    return true;
+}
 
-                case 1: {
-                    hyrisc_bus_wait;
+HYRISC_HANDLER(storem) {
+    switch (cycle) {
+        case 0: {
+            hyrisc_init_write(proc, INDEXED_MULTIPLY, REGX, SIZE);
 
-                    return true;
-                } break;
-            }
+            return false;
         } break;
 
-        case HY_LEAM: {
-            REGX = INDEXED_MULTIPLY;
+        case 1: {
+            hyrisc_bus_wait;
 
             return true;
         } break;
+    }
+
+    return true;
+}
 
-        case HY_LEAS: {
-            REGX = INDEXED_SHIFT;
+HYRISC_HANDLER(stores) {
+    switch (cycle) {
+        case 0: {
+            hyrisc_init_write(proc, INDEXED_SHIFT, REGX, SIZE);
 
-            return true;
+            return false;
         } break;
 
-        case HY_LEAFA: {
-            REGX = REGY + I10;
+        case 1: {
+            hyrisc_bus_wait;
 
             return true;
         } break;
-        
-        case HY_LEAFS: {
-            REGX = REGY - I10;
+    }
 
-            return true;
+    return true;
+}
+
+HYRISC_HANDLER(storefa) {
+    switch (cycle) {
+        case 0: {
+            hyrisc_init_write(proc, REGY + I10, REGX, SIZE);
+
+            return false;
         } break;
 
-        case HY_ADDR   : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_addu); return true; } break;
-        case HY_ADDUI8 : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_addu); return true; } break;
-        case HY_ADDUI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_addu); return true; } break;
-        case HY_ADDSI8 : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_adds); return true; } break;
-        case HY_ADDSI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_adds); return true; } break;
-        case HY_SUBR   : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_subu); return true; } break;
-        case HY_SUBUI8 : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_subu); return true; } break;
-        case HY_SUBUI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_subu); return true; } break;
-        case HY_SUBSI8 : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_subs); return true; } break;
-        case HY_SUBSI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_subs); return true; } break;
-        case HY_MULR   : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_mulu); return true; } break;
-        case HY_MULUI8 : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_mulu); return true; } break;
-        case HY_MULUI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_mulu); return true; } break;
-        case HY_MULSI8 : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_muls); return true; } break;
-        case HY_MULSI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_muls); return true; } break;
-        case HY_DIVR   : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_divu); return true; } break;
-        case HY_DIVUI8 : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_divu); return true; } break;
-        case HY_DIVUI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_divu); return true; } break;
-        case HY_DIVSI8 : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_divs); return true; } break;
-        case HY_DIVSI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_divs); return true; } break;
-        case HY_CMPZ   : { alu::perform_operation(proc, REGX, 0   , 0   , alu::HY_cmp ); return true; } break;
-        case HY_CMPR   : { alu::perform_operation(proc, REGX, REGY, 0   , alu::HY_cmp ); return true; } break;
-        case HY_CMPI8  : { alu::perform_operation(proc, REGX, I16 , 0   , alu::HY_cmpb); return true; } break;
-        case HY_CMPI16 : { alu::perform_operation(proc, REGX, I16 , 0   , alu::HY_cmp ); return true; } break;
-        case HY_ANDR   : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_and ); return true; } break;
-        case HY_ANDI8  : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_and ); return true; } break;
-        case HY_ANDI16 : { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_and ); return true; } break;
-        case HY_ORR    : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_or  ); return true; } break;
-        case HY_ORI8   : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_or  ); return true; } break;
-        case HY_ORI16  : { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_or  ); return true; } break;
-        case HY_XORR   : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_xor ); return true; } break;
-        case HY_XORI8  : { alu::perform_operation(proc, REGX, REGY, I8  , alu::HY_xor ); return true; } break;
-        case HY_XORI16 : { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_xor ); return true; } break;
-        case HY_NOT    : { alu::perform_operation(proc, REGX, REGY, 0   , alu::HY_not ); return true; } break;
-        case HY_NEG    : { alu::perform_operation(proc, REGX, REGY, 0   , alu::HY_neg ); return true; } break;
-        
-        case HY_SEXT: {
-            uint32_t b = (1ull << (2 << (2 + SIZE))) >> 1;
-            uint32_t mask = 0xffffffff - ((b - 1) | b);
-
-            REGX = mask | REGY;
+        case 1: {
+            hyrisc_bus_wait;
 
             return true;
         } break;
+    }
+
+    return true;
+}
 
-        case HY_RSTS: {
-            REGX = 0;
+HYRISC_HANDLER(storefs) {
+    switch (cycle) {
+        case 0: {
+            hyrisc_init_write(proc, REGY - I10, REGX, SIZE);
 
-            return true;
+            return false;
         } break;
 
-        // This instruction is part of the I extension
-        case HY_RSTM: {
-            for (int i = I5X; i < I5Y; i++) {
-                proc->internal.r[i] = 0;
-            }
+        case 1: {
+            hyrisc_bus_wait;
 
             return true;
         } break;
+    }
+
+    return true;
+}
+
+HYRISC_HANDLER(leam) {
+    REGX = INDEXED_MULTIPLY;
+
+    return true;
+}
+
+HYRISC_HANDLER(leas) {
+    REGX = INDEXED_SHIFT;
+
+    return true;
+}
+
+HYRISC_HANDLER(leafa) {
+    REGX = REGY + I10;
+
+    return true;
+}
+
+HYRISC_HANDLER(leafs) {
+    REGX = REGY - I10;
+
+    return true;
+}
+
+HYRISC_ALU_HANDLER(addr,    addu, OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(addui8,  addu, OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(addui16, addu, OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(addsi8,  adds, OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(addsi16, adds, OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(subr,    subu, OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(subui8,  subu, OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(subui16, subu, OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(subsi8,  subs, OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(subsi16, subs, OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(mulr,    mulu, OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(mului8,  mulu, OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(mului16, mulu, OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(mulsi8,  muls, OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(mulsi16, muls, OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(divr,    divu, OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(divui8,  divu, OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(divui16, divu, OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(divsi8,  divs, OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(divsi16, divs, OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(cmpz,    cmp,  OPD_ZERO, OPD_ZERO)
+HYRISC_ALU_HANDLER(cmpr,    cmp,  OPD_Y,    OPD_ZERO)
+HYRISC_ALU_HANDLER(cmpi8,   cmpb, OPD_I16,  OPD_ZERO)
+HYRISC_ALU_HANDLER(cmpi16,  cmp,  OPD_I16,  OPD_ZERO)
+HYRISC_ALU_HANDLER(andr,    and,  OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(andi8,   and,  OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(andi16,  and,  OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(orr,     or,   OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(ori8,    or,   OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(ori16,   or,   OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(xorr,    xor,  OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(xori8,   xor,  OPD_Y,    OPD_I8)
+HYRISC_ALU_HANDLER(xori16,  xor,  OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(notr,    not,  OPD_Y,    OPD_ZERO)
+HYRISC_ALU_HANDLER(neg,     neg,  OPD_Y,    OPD_ZERO)
+
+HYRISC_HANDLER(sext) {
+    uint32_t b = (1ull << (2 << (2 + SIZE))) >> 1;
+    uint32_t mask = 0xffffffff - ((b - 1) | b);
+
+    REGX = mask | REGY;
+
+    return true;
+}
+
+HYRISC_HANDLER(rsts) {
+    REGX = 0;
+
+    return true;
+}
+
+// This instruction is part of the I extension
+HYRISC_HANDLER(rstm) {
+    for (int i = I5X; i < I5Y; i++) {
+        proc->internal.r[i] = 0;
+    }
+
+    return true;
+}
+
+HYRISC_ALU_HANDLER(inc,     inc,  OPD_SIZE, OPD_ZERO)
+HYRISC_ALU_HANDLER(dec,     dec,  OPD_SIZE, OPD_ZERO)
+
+HYRISC_ALU_HANDLER(tst,     tst,  OPD_I5Y,  OPD_ZERO)
 
-        case HY_INC: { alu::perform_operation(proc, REGX, 1 << SIZE, 0, alu::HY_inc); return true; } break;
-        case HY_DEC: { alu::perform_operation(proc, REGX, 1 << SIZE, 0, alu::HY_dec); return true; } break;
-
-        case HY_TST: { alu::perform_operation(proc, REGX, I5Y, 0, alu::HY_tst); return true; } break;
-        
-        case HY_LSLR  : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_lsl); return true; } break;
-        case HY_LSLI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_lsl); return true; } break;
-        case HY_LSRR  : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_lsr); return true; } break;
-        case HY_LSRI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_lsr); return true; } break;
-        case HY_ASLR  : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_asl); return true; } break;
-        case HY_ASLI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_asl); return true; } break;
-        case HY_ASRR  : { alu::perform_operation(proc, REGX, REGY, REGZ, alu::HY_asr); return true; } break;
-        case HY_ASRI16: { alu::perform_operation(proc, REGX, REGX, I16 , alu::HY_asr); return true; } break;
-        
-        case HY_BCCS: { if (hyrisc_test_condition(proc, COND)) proc->internal.r[pc] += ( int32_t)( int16_t)I16; return true; } break;
-        case HY_BCCU: { if (hyrisc_test_condition(proc, COND)) proc->internal.r[pc] += (uint32_t)          I16; return true; } break;
-        
-        case HY_JALCCI16: {
+HYRISC_ALU_HANDLER(lslr,    lsl,  OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(lsli16,  lsl,  OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(lsrr,    lsr,  OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(lsri16,  lsr,  OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(aslr,    asl,  OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(asli16,  asl,  OPD_X,    OPD_I16)
+HYRISC_ALU_HANDLER(asrr,    asr,  OPD_Y,    OPD_Z)
+HYRISC_ALU_HANDLER(asri16,  asr,  OPD_X,    OPD_I16)
+
+HYRISC_HANDLER(bccs) { if (hyrisc_test_condition(proc, COND)) proc->internal.r[pc] += ( int32_t)( int16_t)I16; return true; }
+HYRISC_HANDLER(bccu) { if (hyrisc_test_condition(proc, COND)) proc->internal.r[pc] += (uint32_t)          I16; return true; }
+
+HYRISC_HANDLER(jalcci16) {
+    if (hyrisc_test_condition(proc, COND)) {
+        proc->internal.r[pc] &= 0xffff0000;
+        proc->internal.r[pc] |= I16;
+    }
+
+    return true;
+}
+
+HYRISC_HANDLER(jalccm) {
+    if (hyrisc_test_condition(proc, COND)) {
+        proc->internal.r[lr] = proc->internal.r[pc];
+        proc->internal.r[pc] = INDEXED_MULTIPLY;
+    }
+
+    return true;
+}
+
+HYRISC_HANDLER(jalccs) {
+    if (hyrisc_test_condition(proc, COND)) {
+        proc->internal.r[lr] = proc->internal.r[pc];
+        proc->internal.r[pc] = INDEXED_SHIFT;
+    }
+
+    return true;
+}
+
+HYRISC_HANDLER(callcci16) {
+    switch (cycle) {
+        case 0: {
             if (hyrisc_test_condition(proc, COND)) {
+                proc->internal.r[sp] -= 4;
+
+                hyrisc_init_write(proc, proc->internal.r[sp], proc->internal.r[pc], AS_LONG);
+
                 proc->internal.r[pc] &= 0xffff0000;
                 proc->internal.r[pc] |= I16;
+
+                return false;
+            } else {
+                return true;
             }
+        } break;
+
+        case 1: {
+            hyrisc_bus_wait;
 
             return true;
         } break;
+    }
 
-        case HY_JALCCM: {
+    return true;
+}
+
+HYRISC_HANDLER(callccm) {
+    switch (cycle) {
+        case 0: {
             if (hyrisc_test_condition(proc, COND)) {
-                proc->internal.r[lr] = proc->internal.r[pc];
+                proc->internal.r[sp] -= 4;
+
+                hyrisc_init_write(proc, proc->internal.r[sp], proc->internal.r[pc], AS_LONG);
+
                 proc->internal.r[pc] = INDEXED_MULTIPLY;
+
+                return false;
+            } else {
+                return true;
             }
+        } break;
+
+        case 1: {
+            hyrisc_bus_wait;
 
             return true;
         } break;
+    }
 
-        case HY_JALCCS: {
+    return true;
+}
+
+HYRISC_HANDLER(callccs) {
+    switch (cycle) {
+        case 0: {
             if (hyrisc_test_condition(proc, COND)) {
-                proc->internal.r[lr] = proc->internal.r[pc];
+                proc->internal.r[sp] -= 4;
+
+                hyrisc_init_write(proc, proc->internal.r[sp], proc->internal.r[pc], AS_LONG);
+
                 proc->internal.r[pc] = INDEXED_SHIFT;
+
+                return false;
+            } else {
+                return true;
             }
+        } break;
+
+        case 1: {
+            hyrisc_bus_wait;
 
             return true;
         } break;
+    }
+
+    return true;
+}
 
-        case HY_CALLCCI16: {
-            switch (cycle) {
-                case 0: {
-                    if (hyrisc_test_condition(proc, COND)) {
-                        proc->internal.r[sp] -= 4;
+HYRISC_HANDLER(rtlcc) {
+    if (hyrisc_test_condition(proc, COND)) {
+        proc->internal.r[pc] = proc->internal.r[lr];
+    }
 
-                        hyrisc_init_write(proc, proc->internal.r[sp], proc->internal.r[pc], AS_LONG);
-                        
-                        proc->internal.r[pc] &= 0xffff0000;
-                        proc->internal.r[pc] |= I16;
+    return true;
+}
 
-                        return false;
-                    } else {
-                        return true;
-                    }
-                } break;
+HYRISC_HANDLER(retcc) {
+    switch (cycle) {
+        case 0: {
+            if (hyrisc_test_condition(proc, COND)) {
+                hyrisc_init_read(proc, proc->internal.r[sp], AS_LONG);
 
-                case 1: {
-                    hyrisc_bus_wait;
+                proc->internal.r[sp] += 4;
 
-                    return true;
-                } break;
+                return false;
+            } else {
+                return true;
             }
         } break;
 
-        case HY_CALLCCM: {
-            switch (cycle) {
-                case 0: {
-                    if (hyrisc_test_condition(proc, COND)) {
-                        proc->internal.r[sp] -= 4;
+        case 1: {
+            hyrisc_do_read(proc->internal.r[pc]);
 
-                        hyrisc_init_write(proc, proc->internal.r[sp], proc->internal.r[pc], AS_LONG);
-                        
-                        proc->internal.r[pc] = INDEXED_MULTIPLY;
+            return true;
+        } break;
+    }
+
+    return true;
+}
 
-                        return false;
-                    } else {
-                        return true;
-                    }
-                } break;
+// PUSHM and POPM are part of the I extension
+// and have not been implemented yet
 
-                case 1: {
-                    hyrisc_bus_wait;
+HYRISC_HANDLER(pushs) {
+    switch (cycle) {
+        case 0: {
+            proc->internal.r[sp] -= 4;
 
-                    return true;
-                } break;
-            }
+            hyrisc_init_write(proc, proc->internal.r[sp], REGX, AS_LONG);
+
+            return false;
         } break;
 
-        case HY_CALLCCS: {
-            switch (cycle) {
-                case 0: {
-                    if (hyrisc_test_condition(proc, COND)) {
-                        proc->internal.r[sp] -= 4;
+        case 1: {
+            hyrisc_bus_wait;
+        } break;
+    }
 
-                        hyrisc_init_write(proc, proc->internal.r[sp], proc->internal.r[pc], AS_LONG);
-                        
-                        proc->internal.r[pc] = INDEXED_SHIFT;
+    return true;
+}
 
-                        return false;
-                    } else {
-                        return true;
-                    }
-                } break;
+HYRISC_HANDLER(pops) {
+    switch (cycle) {
+        case 0: {
+            hyrisc_init_read(proc, proc->internal.r[sp], AS_LONG);
 
-                case 1: {
-                    hyrisc_bus_wait;
+            proc->internal.r[sp] += 4;
 
-                    return true;
-                } break;
-            }
+            return false;
         } break;
 
-        case HY_RTLCC: {
-            if (hyrisc_test_condition(proc, COND)) {
-                proc->internal.r[pc] = proc->internal.r[lr];
-            }
-
-            return true;
+        case 1: {
+            hyrisc_do_read(REGX);
         } break;
+    }
 
-        case HY_RETCC: {
-            switch (cycle) {
-                case 0: {
-                    if (hyrisc_test_condition(proc, COND)) {
-                        hyrisc_init_read(proc, proc->internal.r[sp], AS_LONG);
+    return true;
+}
 
-                        proc->internal.r[sp] += 4;
+HYRISC_HANDLER(nop) {
+    return true;
+}
 
-                        return false;
-                    } else {
-                        return true;
-                    }
-                } break;
+// Debug instruction!
+// Break into host
+HYRISC_HANDLER(debug) {
+    if (proc->debug && proc->debug(proc)) return true;
 
-                case 1: {
-                    hyrisc_do_read(proc->internal.r[pc]);
+#ifdef _WIN32
+    std::raise(SIGBREAK);
+#else
+    std::raise(SIGINT);
+#endif
 
-                    return true;
-                } break;
-            }
+    return true;
+}
+
+// Any other instructions are considered illegal
+// Emulator will raise SIGILL
+HYRISC_HANDLER(illegal) {
+    if (proc->illegal && proc->illegal(proc)) return true;
+
+    std::raise(SIGILL);
+
+    return true;
+}
+
+// FPU
+// FPCSR (f31) has to be synced with the host before being read or
+// written, it may have exceptions pending
+#define FREG(i) proc->internal.f[i]
+#define VLEN    (2 << SIZE)
+
+template <class Op>
+bool hyrisc_op_fpu(hyrisc_t* proc, hyint_t cycle) {
+    if ((I5X == 31) || (I5Y == 31) || (I5Z == 31)) fpu::sync(proc);
+
+    fpu::perform_operation(proc, FREG(I5X), FREG(I5Y), FREG(I5Z), Op());
+
+    return true;
+}
+
+#define HYRISC_FPU_HANDLER(name) \
+    constexpr hyrisc_handler_t hyrisc_op_##name = hyrisc_op_fpu <fpu::HY_##name##_t>;
+
+HYRISC_FPU_HANDLER(fadd  )
+HYRISC_FPU_HANDLER(fsub  )
+HYRISC_FPU_HANDLER(fmul  )
+HYRISC_FPU_HANDLER(fdiv  )
+HYRISC_FPU_HANDLER(ffma  )
+HYRISC_FPU_HANDLER(fsqrt )
+HYRISC_FPU_HANDLER(fpow  )
+HYRISC_FPU_HANDLER(fabs  )
+HYRISC_FPU_HANDLER(fmod  )
+HYRISC_FPU_HANDLER(fexp  )
+HYRISC_FPU_HANDLER(fmin  )
+HYRISC_FPU_HANDLER(fmax  )
+HYRISC_FPU_HANDLER(fround)
+HYRISC_FPU_HANDLER(fclamp)
+HYRISC_FPU_HANDLER(fcvti )
+HYRISC_FPU_HANDLER(fcvtf )
+HYRISC_FPU_HANDLER(fsin  )
+HYRISC_FPU_HANDLER(fcos  )
+HYRISC_FPU_HANDLER(ftan  )
+HYRISC_FPU_HANDLER(fasin )
+HYRISC_FPU_HANDLER(facos )
+HYRISC_FPU_HANDLER(fatan )
+HYRISC_FPU_HANDLER(fsinh )
+HYRISC_FPU_HANDLER(fcosh )
+HYRISC_FPU_HANDLER(ftanh )
+
+#undef HYRISC_FPU_HANDLER
+
+inline bool hyrisc_op_fmvfr(hyrisc_t* proc, hyint_t cycle) {
+    REGX = (I5Y == 31) ? fpu::get_fpcsr(proc) : fpu::bits(FREG(I5Y));
+
+    return true;
+}
+
+inline bool hyrisc_op_fmvrf(hyrisc_t* proc, hyint_t cycle) {
+    if (I5X == 31) {
+        fpu::set_fpcsr(proc, REGY);
+    } else {
+        hyu32_t raw = REGY;
+
+        std::memcpy(&FREG(I5X), &raw, sizeof(raw));
+    }
+
+    return true;
+}
 
+// FPU Vector extension
+// Vectors are 2 << SIZE registers wide and have to fit in f0-f30,
+// anything else is an illegal instruction
+
+inline bool hyrisc_vector_fits(hyrisc_t* proc, hyu8_t first, int length) {
+    return (SIZE != 3) && ((first + length) <= 31);
+}
+
+template <int op>
+bool hyrisc_op_fvector(hyrisc_t* proc, hyint_t cycle) {
+    if (!hyrisc_vector_fits(proc, I5X, VLEN) ||
+        !hyrisc_vector_fits(proc, I5Y, VLEN) ||
+        !hyrisc_vector_fits(proc, I5Z, VLEN))
+        return hyrisc_op_illegal(proc, cycle);
+
+    fpu::prepare(proc);
+    fpu::vector_unit.op[op](&FREG(I5X), &FREG(I5Y), &FREG(I5Z), VLEN);
+
+    return true;
+}
+
+template <bool weighted, bool average>
+bool hyrisc_op_fvreduce(hyrisc_t* proc, hyint_t cycle) {
+    if (!hyrisc_vector_fits(proc, I5X, 1) ||
+        !hyrisc_vector_fits(proc, I5Y, VLEN) ||
+        (weighted && !hyrisc_vector_fits(proc, I5Z, VLEN)))
+        return hyrisc_op_illegal(proc, cycle);
+
+    fpu::prepare(proc);
+
+    hyfloat_t sum = fpu::vector_unit.reduce(&FREG(I5Y), weighted ? &FREG(I5Z) : nullptr, VLEN);
+
+    // Kernels may propagate different NaNs, only keep the default one
+    if (std::isnan(sum)) sum = std::numeric_limits <hyfloat_t>::quiet_NaN();
+
+    FREG(I5X) += sum;
+
+    if (average) FREG(I5X) /= VLEN;
+
+    return true;
+}
+
+constexpr hyrisc_handler_t hyrisc_op_fvadd = hyrisc_op_fvector <fpu::FV_ADD>;
+constexpr hyrisc_handler_t hyrisc_op_fvsub = hyrisc_op_fvector <fpu::FV_SUB>;
+constexpr hyrisc_handler_t hyrisc_op_fvmul = hyrisc_op_fvector <fpu::FV_MUL>;
+constexpr hyrisc_handler_t hyrisc_op_fvdiv = hyrisc_op_fvector <fpu::FV_DIV>;
+constexpr hyrisc_handler_t hyrisc_op_fvfma = hyrisc_op_fvector <fpu::FV_FMA>;
+constexpr hyrisc_handler_t hyrisc_op_fvsum = hyrisc_op_fvreduce <false, false>;
+constexpr hyrisc_handler_t hyrisc_op_fvwsm = hyrisc_op_fvreduce <true , false>;
+constexpr hyrisc_handler_t hyrisc_op_fvavg = hyrisc_op_fvreduce <false, true >;
+constexpr hyrisc_handler_t hyrisc_op_fvwvg = hyrisc_op_fvreduce <true , true >;
+
+#undef FREG
+#undef VLEN
+
+#undef HYRISC_HANDLER
+#undef HYRISC_ALU_HANDLER
+
+#define HYRISC_OPCODE_LIST(X) \
+    X(HY_MOV      , mov      ) \
+    X(HY_LI       , li       ) \
+    X(HY_LUI      , lui      ) \
+    X(HY_LOADM    , loadm    ) \
+    X(HY_LOADS    , loads    ) \
+    X(HY_LOADFA   , loadfa   ) \
+    X(HY_LOADFS   , loadfs   ) \
+    X(HY_STOREM   , storem   ) \
+    X(HY_STORES   , stores   ) \
+    X(HY_STOREFA  , storefa  ) \
+    X(HY_STOREFS  , storefs  ) \
+    X(HY_LEAM     , leam     ) \
+    X(HY_LEAS     , leas     ) \
+    X(HY_LEAFA    , leafa    ) \
+    X(HY_LEAFS    , leafs    ) \
+    X(HY_ADDR     , addr     ) \
+    X(HY_ADDUI8   , addui8   ) \
+    X(HY_ADDUI16  , addui16  ) \
+    X(HY_ADDSI8   , addsi8   ) \
+    X(HY_ADDSI16  , addsi16  ) \
+    X(HY_SUBR     , subr     ) \
+    X(HY_SUBUI8   , subui8   ) \
+    X(HY_SUBUI16  , subui16  ) \
+    X(HY_SUBSI8   , subsi8   ) \
+    X(HY_SUBSI16  , subsi16  ) \
+    X(HY_MULR     , mulr     ) \
+    X(HY_MULUI8   , mului8   ) \
+    X(HY_MULUI16  , mului16  ) \
+    X(HY_MULSI8   , mulsi8   ) \
+    X(HY_MULSI16  , mulsi16  ) \
+    X(HY_DIVR     , divr     ) \
+    X(HY_DIVUI8   , divui8   ) \
+    X(HY_DIVUI16  , divui16  ) \
+    X(HY_DIVSI8   , divsi8   ) \
+    X(HY_DIVSI16  , divsi16  ) \
+    X(HY_CMPZ     , cmpz     ) \
+    X(HY_CMPR     , cmpr     ) \
+    X(HY_CMPI8    , cmpi8    ) \
+    X(HY_CMPI16   , cmpi16   ) \
+    X(HY_ANDR     , andr     ) \
+    X(HY_ANDI8    , andi8    ) \
+    X(HY_ANDI16   , andi16   ) \
+    X(HY_ORR      , orr      ) \
+    X(HY_ORI8     , ori8     ) \
+    X(HY_ORI16    , ori16    ) \
+    X(HY_XORR     , xorr     ) \
+    X(HY_XORI8    , xori8    ) \
+    X(HY_XORI16   , xori16   ) \
+    X(HY_NOT      , notr     ) \
+    X(HY_NEG      , neg      ) \
+    X(HY_SEXT     , sext     ) \
+    X(HY_RSTS     , rsts     ) \
+    X(HY_RSTM     , rstm     ) \
+    X(HY_INC      , inc      ) \
+    X(HY_DEC      , dec      ) \
+    X(HY_TST      , tst      ) \
+    X(HY_LSLR     , lslr     ) \
+    X(HY_LSLI16   , lsli16   ) \
+    X(HY_LSRR     , lsrr     ) \
+    X(HY_LSRI16   , lsri16   ) \
+    X(HY_ASLR     , aslr     ) \
+    X(HY_ASLI16   , asli16   ) \
+    X(HY_ASRR     , asrr     ) \
+    X(HY_ASRI16   , asri16   ) \
+    X(HY_BCCS     , bccs     ) \
+    X(HY_BCCU     , bccu     ) \
+    X(HY_JALCCI16 , jalcci16 ) \
+    X(HY_JALCCM   , jalccm   ) \
+    X(HY_JALCCS   , jalccs   ) \
+    X(HY_CALLCCI16, callcci16) \
+    X(HY_CALLCCM  , callccm  ) \
+    X(HY_CALLCCS  , callccs  ) \
+    X(HY_RTLCC    , rtlcc    ) \
+    X(HY_RETCC    , retcc    ) \
+    X(HY_PUSHS    , pushs    ) \
+    X(HY_POPS     , pops     ) \
+    X(HY_NOP      , nop      ) \
+    X(HY_FADD     , fadd     ) \
+    X(HY_FSUB     , fsub     ) \
+    X(HY_FMUL     , fmul     ) \
+    X(HY_FDIV     , fdiv     ) \
+    X(HY_FFMA     , ffma     ) \
+    X(HY_FSQRT    , fsqrt    ) \
+    X(HY_FPOW     , fpow     ) \
+    X(HY_FABS     , fabs     ) \
+    X(HY_FMOD     , fmod     ) \
+    X(HY_FEXP     , fexp     ) \
+    X(HY_FMIN     , fmin     ) \
+    X(HY_FMAX     , fmax     ) \
+    X(HY_FROUND   , fround   ) \
+    X(HY_FCLAMP   , fclamp   ) \
+    X(HY_FCVTI    , fcvti    ) \
+    X(HY_FCVTF    , fcvtf    ) \
+    X(HY_FSIN     , fsin     ) \
+    X(HY_FCOS     , fcos     ) \
+    X(HY_FTAN     , ftan     ) \
+    X(HY_FASIN    , fasin    ) \
+    X(HY_FACOS    , facos    ) \
+    X(HY_FATAN    , fatan    ) \
+    X(HY_FSINH    , fsinh    ) \
+    X(HY_FCOSH    , fcosh    ) \
+    X(HY_FTANH    , ftanh    ) \
+    X(HY_FMVFR    , fmvfr    ) \
+    X(HY_FMVRF    , fmvrf    ) \
+    X(HY_FVADD    , fvadd    ) \
+    X(HY_FVSUB    , fvsub    ) \
+    X(HY_FVMUL    , fvmul    ) \
+    X(HY_FVDIV    , fvdiv    ) \
+    X(HY_FVFMA    , fvfma    ) \
+    X(HY_FVSUM    , fvsum    ) \
+    X(HY_FVWSM    , fvwsm    ) \
+    X(HY_FVAVG    , fvavg    ) \
+    X(HY_FVWVG    , fvwvg    ) \
+    X(HY_DEBUG    , debug)
+
+// Dispatch
+// By default opcodes are dispatched through a table of handlers,
+// the predecode cache stores the handler itself so cached
+// instructions jump straight to it. Define HYRISC_DISPATCH_SWITCH
+// to fall back to a plain switch for compilers/targets where
+// indirect calls are a bad deal.
+inline std::array <hyrisc_handler_t, 0x100> hyrisc_build_handler_table() {
+    std::array <hyrisc_handler_t, 0x100> table;
+
+    table.fill(hyrisc_op_illegal);
+
+#define X(opcode, name) table[opcode] = hyrisc_op_##name;
+    HYRISC_OPCODE_LIST(X)
+#undef X
+
+    return table;
+}
+
+inline std::array <hyrisc_handler_t, 0x100> hyrisc_handler_table = hyrisc_build_handler_table();
+
+inline bool hyrisc_execute(hyrisc_t* proc, hyint_t cycle) {
+#ifdef HYRISC_DISPATCH_SWITCH
+    switch (proc->internal.decoder.opcode) {
+#define X(opcode, name) case opcode: return hyrisc_op_##name(proc, cycle);
+        HYRISC_OPCODE_LIST(X)
+#undef X
+    }
+
+    return hyrisc_op_illegal(proc, cycle);
+#else
+    return hyrisc_handler_table[proc->internal.decoder.opcode](proc, cycle);
+#endif
+}
+
+inline hyrisc_handler_t hyrisc_get_handler(hyu8_t opcode) {
+#ifdef HYRISC_DISPATCH_SWITCH
+    return hyrisc_execute;
+#else
+    return hyrisc_handler_table[opcode];
+#endif
+}
+
+// Block execution
+// Functional mode can run whole basic blocks out of the block
+// cache. Pins are only updated by data accesses while running
+// a block, instruction fetches don't touch the BCI.
+inline bool hyrisc_ends_block(const hyrisc_decoder_t& decoder) {
+    switch (decoder.opcode) {
+        case HY_BCCS     : case HY_BCCU    :
+        case HY_JALCCI16 : case HY_JALCCM  : case HY_JALCCS :
+        case HY_CALLCCI16: case HY_CALLCCM : case HY_CALLCCS:
+        case HY_RTLCC    : case HY_RETCC   :
+        case HY_DEBUG    :
             return true;
-        } break;
+    }
+
+    // Any other instruction writing to PC changes flow too
+    return decoder.fieldx == pc;
+}
+
+inline hyrisc_block_t* hyrisc_build_block(hyrisc_t* proc, hyu32_t addr) {
+    hyrisc_block_t* block = new hyrisc_block_t;
+
+    block->pc    = addr;
+    block->valid = true;
+    block->hits  = 0;
+    block->code  = nullptr;
+
+    block->next_pc[0] = 0;
+    block->next_pc[1] = 0;
+    block->next[0]    = nullptr;
+    block->next[1]    = nullptr;
+
+    hyu32_t fetch = addr;
+
+    while (block->ops.size() < HYRISC_BLOCK_MAX_OPS) {
+        hyrisc_predecoded_t op;
+
+        bool ack = hyrisc_tlb_access(proc, fetch, &op.instruction, RW_READ, 4) ||
+                   proc->fbus.access(proc->fbus.udata, fetch, &op.instruction, RW_READ, AS_EXECUTE);
+
+        if (!ack) break;
+
+        hyrisc_decode_word(&op.decoder, op.instruction);
 
-        // PUSHM and POPM are part of the I extension
-        // and have not been implemented yet
+        op.pc      = fetch;
+        op.handler = hyrisc_get_handler(op.decoder.opcode);
+        op.valid   = true;
 
-        case HY_PUSHS: {
-            switch (cycle) {
-                case 0: {
-                    proc->internal.r[sp] -= 4;
+        block->ops.push_back(op);
 
-                    hyrisc_init_write(proc, proc->internal.r[sp], REGX, AS_LONG);
+        fetch += 4;
 
-                    return false;
-                } break;
+        if (hyrisc_ends_block(op.decoder)) break;
+    }
+
+    if (block->ops.empty()) {
+        delete block;
+
+        return nullptr;
+    }
+
+    block->end = fetch;
+
+    hyrisc_cache_insert_block(proc->cache, block);
+
+    return block;
+}
+
+// Runs a single micro-op from a block, returns false if the block
+// can't go on (bus error IRQ, a write to the block's own code or a
+// hook freezing the CPU)
+inline bool hyrisc_execute_op(hyrisc_t* proc, const hyrisc_predecoded_t* op, hyrisc_block_t* block) {
+    proc->internal.instruction = op->instruction;
+    proc->internal.decoder     = op->decoder;
+    proc->internal.r[pc]       = op->pc + 4;
+
+    if (op->handler(proc, 0)) {
+        proc->internal.r[r0] = 0;
+
+        return !proc->ext.freeze;
+    }
+
+    proc->internal.cycle = 3;
+
+    bool ack = hyrisc_bus_access(proc);
+
+    if (ack) op->handler(proc, 1);
+
+    proc->internal.cycle = 0;
+    proc->internal.r[r0] = 0;
+
+    return ack && block->valid;
+}
+
+// Runs instructions from a block until the end of it, or until
+// budget instructions have been retired. Returns the number of
+// instructions retired.
+inline hyu64_t hyrisc_execute_block(hyrisc_t* proc, hyrisc_block_t* block, hyu64_t budget) {
+    hyu64_t count = 0;
+
+    for (const hyrisc_predecoded_t& op : block->ops) {
+        if (count == budget) break;
+
+        count++;
+
+        bool done = hyrisc_execute_op(proc, &op, block);
+
+        // Counted after the op, devices see the count before it
+        proc->internal.retired++;
+
+        if (!done) break;
+    }
 
-                case 1: {
-                    hyrisc_bus_wait;
-                } break;
+    return count;
+}
+
+// Runs up to budget instructions in functional mode, returns the
+// number of instructions retired. Falls back to hyrisc_step when
+// the cache is disabled. Pending FPU exceptions are folded into
+// FPCSR before returning, so host code run between calls can't
+// raise guest flags.
+inline hyu64_t hyrisc_run(hyrisc_t* proc, hyu64_t budget) {
+    hyu64_t retired = 0;
+
+    if (!proc->cache) {
+        while (retired < budget) {
+            hyrisc_step(proc);
+
+            retired++;
+        }
+
+        fpu::sync(proc);
+
+        return retired;
+    }
+
+    hyrisc_cache_t* cache = proc->cache;
+    hyrisc_block_t* prev = nullptr;
+
+    while (retired < budget) {
+        hyrisc_bci_update(proc);
+
+        if (!hyrisc_handle_signals(proc)) break;
+
+        hyu32_t addr = proc->internal.r[pc];
+
+        hyrisc_block_t* block = nullptr;
+
+        // Follow the chain on hot edges
+        if (prev && prev->valid) {
+            if      (prev->next_pc[0] == addr) block = prev->next[0];
+            else if (prev->next_pc[1] == addr) block = prev->next[1];
+
+            if (block && !block->valid) block = nullptr;
+        }
+
+        if (!block) {
+            // Nothing holds block pointers between blocks, so this
+            // is the only safe point to free retired blocks
+            if (cache->flush_pending ||
+                (cache->retired.size() > HYRISC_MAX_RETIRED_BLOCKS) ||
+                (cache->blocks.size() > (HYRISC_JUMP_CACHE_SIZE << 4))) {
+                hyrisc_cache_flush_blocks(cache);
+
+                prev = nullptr;
             }
-        } break;
 
-        case HY_POPS: {
-            switch (cycle) {
-                case 0: {
-                    hyrisc_init_read(proc, proc->internal.r[sp], AS_LONG);
+            block = hyrisc_cache_find_block(cache, addr);
 
-                    proc->internal.r[sp] += 4;
+            if (!block) block = hyrisc_build_block(proc, addr);
 
-                    return false;
-                } break;
+            // Couldn't fetch anything, let the interpreter
+            // handle the bus error
+            if (!block) {
+                hyrisc_step(proc);
 
-                case 1: {
-                    hyrisc_do_read(REGX);
-                } break;
+                retired++;
+                prev = nullptr;
+
+                continue;
             }
-        } break;
 
-        case HY_NOP: {
-            return true;
-        } break;
+            if (prev && prev->valid) {
+                int slot = (addr == prev->end) ? 0 : 1;
 
-        // Debug instruction!
-        // Break into host
-        case 0x45: {
-#ifdef _WIN32
-            std::raise(SIGBREAK);
-#else
-            std::raise(SIGINT);
-#endif
-        } break;
+                prev->next_pc[slot] = addr;
+                prev->next[slot]    = block;
+            }
+        }
 
-        // Any other instructions are considered illegal
-        // Emulator will raise SIGILL
-        default: {
-            std::raise(SIGILL);
-        } break;
+        HYRISC_COVER_BLOCK(proc, addr);
+
+        hyu64_t count = 0;
+
+        // Hot blocks may run translated code instead
+        if (proc->jit_run)
+            count = proc->jit_run(proc, block, budget - retired);
+
+        if (!count)
+            count = hyrisc_execute_block(proc, block, budget - retired);
+
+        retired += count;
+        prev = block;
     }
 
-    return true;
+    fpu::sync(proc);
+
+    return retired;
 }
 
 #undef BITS
 
-void hyrisc_pulse_reset(hyrisc_t* proc, hyu32_t vec) {
+inline void hyrisc_pulse_reset(hyrisc_t* proc, hyu32_t vec) {
     proc->ext.reset = true;
     proc->ext.pic.v = vec;
 
     hyrisc_clock(proc);
 
     proc->ext.reset = false;
+}
+
+// Snapshots
+// Only the CPU state, memory and devices are captured by the board.
+// Memory may have changed on restore, so all cached code is dropped
+struct hyrisc_snapshot_t {
+    hyrisc_int_t internal;
+    hyrisc_ext_t ext;
+};
+
+inline void hyrisc_save_snapshot(hyrisc_t* proc, hyrisc_snapshot_t* snapshot) {
+    // Pick up exceptions still pending on the host
+    fpu::sync(proc);
+
+    snapshot->internal = proc->internal;
+    snapshot->ext      = proc->ext;
+}
+
+inline void hyrisc_load_snapshot(hyrisc_t* proc, const hyrisc_snapshot_t* snapshot) {
+    fpu::release(proc);
+
+    proc->internal = snapshot->internal;
+    proc->ext      = snapshot->ext;
+
+    hyrisc_cache_flush(proc);
+}
+
+// Save-states, see savestate.hpp
+inline void hyrisc_save_state(hyrisc_t* proc, hyrisc_state_writer_t& w) {
+    // Pick up exceptions still pending on the host
+    fpu::sync(proc);
+
+    const hyrisc_int_t& i = proc->internal;
+    const hyrisc_ext_t& e = proc->ext;
+
+    w.begin("CPU ", 2);
+
+    w.u32(i.cycle);
+    w.u32(i.instruction);
+
+    for (int r = 0; r < 32; r++) w.u32(i.r[r]);
+
+    w.u32(i.last_cycles);
+
+    for (int f = 0; f < 32; f++) w.f32(i.f[f]);
+
+    w.u8 (i.st);
+    w.u8 (i.flags.op);
+    w.u32(i.flags.res);
+    w.u32(i.flags.a);
+    w.u32(i.flags.b);
+    w.u8 (i.rw);
+    w.u8 (i.decoder.opcode);
+    w.u8 (i.decoder.encoding);
+    w.u8 (i.decoder.fieldx);
+    w.u8 (i.decoder.fieldy);
+    w.u8 (i.decoder.fieldz);
+    w.u8 (i.decoder.fieldw);
+    w.u8 (i.decoder.size);
+    w.u8 (i.decoder.imm8);
+    w.u16(i.decoder.imm16);
+    w.u64(i.retired);
+
+    w.u32(e.bci.a);
+    w.u32(e.bci.d);
+    w.u8 (e.bci.busirq);
+    w.u8 (e.bci.busack);
+    w.u8 (e.bci.busreq);
+    w.u8 (e.bci.rw);
+    w.u8 (e.bci.be);
+    w.u8 (e.bci.s);
+    w.u32(e.pic.v);
+    w.u8 (e.pic.irq);
+    w.u8 (e.pic.irqack);
+    w.u8 (e.reset);
+    w.u8 (e.freeze);
+    w.f32(e.vcc);
+
+    w.end();
+}
+
+inline bool hyrisc_load_state(hyrisc_t* proc, hyrisc_state_reader_t& r) {
+    if (!r.expect("CPU ")) return false;
+
+    fpu::release(proc);
+
+    hyrisc_int_t& i = proc->internal;
+    hyrisc_ext_t& e = proc->ext;
+
+    i.cycle       = r.u32();
+    i.instruction = r.u32();
+
+    for (int n = 0; n < 32; n++) i.r[n] = r.u32();
+
+    i.last_cycles = r.u32();
+
+    for (int f = 0; f < 32; f++) i.f[f] = r.f32();
+
+    i.st               = r.u8();
+    i.flags.op         = r.u8();
+    i.flags.res        = r.u32();
+    i.flags.a          = r.u32();
+    i.flags.b          = r.u32();
+    i.rw               = r.u8();
+    i.decoder.opcode   = r.u8();
+    i.decoder.encoding = r.u8();
+    i.decoder.fieldx   = r.u8();
+    i.decoder.fieldy   = r.u8();
+    i.decoder.fieldz   = r.u8();
+    i.decoder.fieldw   = r.u8();
+    i.decoder.size     = r.u8();
+    i.decoder.imm8     = r.u8();
+    i.decoder.imm16    = r.u16();
+    i.retired          = (r.chunk_version() >= 2) ? r.u64() : 0;
+
+    e.bci.a      = r.u32();
+    e.bci.d      = r.u32();
+    e.bci.busirq = r.u8();
+    e.bci.busack = r.u8();
+    e.bci.busreq = r.u8();
+    e.bci.rw     = r.u8();
+    e.bci.be     = r.u8();
+    e.bci.s      = r.u8();
+    e.pic.v      = r.u32();
+    e.pic.irq    = r.u8();
+    e.pic.irqack = r.u8();
+    e.reset      = r.u8();
+    e.freeze     = r.u8();
+    e.vcc        = r.f32();
+
+    hyrisc_cache_flush(proc);
+
+    return r.good();
 }
\ No newline at end of file
@@ -0,0 +1,887 @@
+#pragma once
+
+#include "hyrisc.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define HYRISC_JIT_X64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Dynamic recompiler
+// Translates hot blocks out of the block cache to x86-64 code.
+// Register moves, ALU operations, address computations and
+// conditional branches are emitted inline, loads and stores call
+// back into the functional bus, and anything else calls the
+// interpreter's handler for that instruction. Translated code
+// works on the hyrisc_t state directly, so it can stop after any
+// instruction and leave the CPU exactly as the interpreter would.
+//
+// The retired instruction count is only written back before calls
+// that may reach a device and on the way out, with the count at
+// entry kept in rbp.
+//
+// The code buffer is never writable and executable at once, the
+// pages a block is emitted to are only made writable while it's
+// translated. Every CPU has a buffer of its own, so nothing runs
+// from them meanwhile.
+
+#define HYRISC_JIT_BUFFER_SIZE  0x1000000
+#define HYRISC_JIT_THRESHOLD    0x10
+#define HYRISC_JIT_MAX_OP_SIZE  0x80
+
+// Translated block, returns the number of instructions retired
+typedef hyu64_t (*hyrisc_jit_code_t)(hyrisc_t*);
+
+struct hyrisc_jit_t {
+    hyu8_t*  buf;
+    size_t   size;
+    size_t   used;
+
+    // Code for freed blocks is only reclaimed once the block cache
+    // has been flushed, generation tells us when that happened
+    hyu64_t  generation;
+
+    hybool_t verify;            // Check every run against the interpreter
+
+    hyu64_t  translated;
+    hyu64_t  verified;
+};
+
+namespace x64 {
+    enum reg_t : hyu8_t {
+        EAX = 0,
+        ECX = 1,
+        EDX = 2,
+        EBX = 3,
+        ESI = 6,
+        EDI = 7
+    };
+
+    enum alu_t {
+        ALU_ADD,
+        ALU_SUB,
+        ALU_MUL,
+        ALU_AND,
+        ALU_OR,
+        ALU_XOR,
+        ALU_SHL,
+        ALU_SHR,
+        ALU_NOT,
+        ALU_INC,
+        ALU_DEC,
+        ALU_TST,
+        ALU_CMP,
+        ALU_CMPB
+    };
+
+    enum src_t {
+        SRC_X,
+        SRC_Y,
+        SRC_Z,
+        SRC_I8,
+        SRC_I16,
+        SRC_ZERO
+    };
+
+    enum addr_t {
+        ADDR_M,     // Indexed multiply
+        ADDR_S,     // Indexed shift
+        ADDR_FA,    // Fixed add
+        ADDR_FS     // Fixed subtract
+    };
+
+    const int R_OFFSET        = offsetof(hyrisc_t, internal.r);
+    const int FLAGS_OP_OFFSET  = offsetof(hyrisc_t, internal.flags.op);
+    const int FLAGS_RES_OFFSET = offsetof(hyrisc_t, internal.flags.res);
+    const int FLAGS_A_OFFSET   = offsetof(hyrisc_t, internal.flags.a);
+    const int FLAGS_B_OFFSET   = offsetof(hyrisc_t, internal.flags.b);
+    const int RETIRED_OFFSET   = offsetof(hyrisc_t, internal.retired);
+
+    struct emitter_t {
+        hyu8_t* p;
+
+        // Pending jumps to the epilogue
+        std::vector <hyu8_t*> exits;
+    };
+
+    inline void emit8(emitter_t* e, hyu8_t b) { *e->p++ = b; }
+
+    inline void emit32(emitter_t* e, hyu32_t v) {
+        std::memcpy(e->p, &v, 4);
+
+        e->p += 4;
+    }
+
+    inline void emit64(emitter_t* e, hyu64_t v) {
+        std::memcpy(e->p, &v, 8);
+
+        e->p += 8;
+    }
+
+    inline void emit(emitter_t* e, std::initializer_list <hyu8_t> bytes) {
+        for (hyu8_t b : bytes) emit8(e, b);
+    }
+
+    // mov reg, [rbx + r*4]
+    inline void load_reg(emitter_t* e, reg_t reg, hyu8_t r) {
+        emit(e, { 0x8b, (hyu8_t)(0x43 | (reg << 3)), (hyu8_t)(r << 2) });
+    }
+
+    // mov [rbx + r*4], reg
+    inline void store_reg(emitter_t* e, hyu8_t r, reg_t reg) {
+        // Writes to r0 are dropped at the end of every instruction
+        if (r == r0) return;
+
+        emit(e, { 0x89, (hyu8_t)(0x43 | (reg << 3)), (hyu8_t)(r << 2) });
+    }
+
+    // mov dword [rbx + r*4], imm32
+    inline void store_imm(emitter_t* e, hyu8_t r, hyu32_t imm) {
+        if (r == r0) return;
+
+        emit(e, { 0xc7, 0x43, (hyu8_t)(r << 2) });
+        emit32(e, imm);
+    }
+
+    // mov reg, imm32
+    inline void load_imm(emitter_t* e, reg_t reg, hyu32_t imm) {
+        emit8(e, 0xb8 + reg);
+        emit32(e, imm);
+    }
+
+    // <op> dst, src (op is the "r/m32, r32" form opcode)
+    inline void alu_rr(emitter_t* e, hyu8_t op, reg_t dst, reg_t src) {
+        emit(e, { op, (hyu8_t)(0xc0 | (src << 3) | dst) });
+    }
+
+    // mov rax, imm64; call rax
+    inline void call(emitter_t* e, const void* fn) {
+        emit(e, { 0x48, 0xb8 });
+        emit64(e, (hyu64_t)fn);
+        emit(e, { 0xff, 0xd0 });
+    }
+
+    // retired = entry count + n, before calls that may access devices
+    inline void sync_retired(emitter_t* e, hyu64_t n) {
+        emit(e, { 0x48, 0x8d, 0x85 });              // lea rax, [rbp + n]
+        emit32(e, n);
+        emit(e, { 0x49, 0x89, 0x84, 0x24 });        // mov [r12 + retired], rax
+        emit32(e, RETIRED_OFFSET);
+    }
+
+    // Leaves the block after instruction n, optionally setting PC
+    inline void exit_block(emitter_t* e, hyu64_t n, bool set_pc, hyu32_t addr) {
+        if (set_pc) store_imm(e, pc, addr);
+
+        load_imm(e, EAX, n);
+
+        // jmp epilogue
+        emit8(e, 0xe9);
+
+        e->exits.push_back(e->p);
+
+        emit32(e, 0);
+    }
+
+    // test al, al; jnz over; <exit>
+    inline void exit_on_false(emitter_t* e, hyu64_t n, bool set_pc, hyu32_t addr) {
+        emit(e, { 0x84, 0xc0, 0x75, 0x00 });
+
+        hyu8_t* patch = e->p - 1;
+
+        exit_block(e, n, set_pc, addr);
+
+        *patch = e->p - (patch + 1);
+    }
+
+    inline void load_src(emitter_t* e, reg_t reg, const hyrisc_decoder_t& d, src_t src) {
+        switch (src) {
+            case SRC_X   : load_reg(e, reg, d.fieldx); break;
+            case SRC_Y   : load_reg(e, reg, d.fieldy); break;
+            case SRC_Z   : load_reg(e, reg, d.fieldz); break;
+            case SRC_I8  : load_imm(e, reg, d.imm8  ); break;
+            case SRC_I16 : load_imm(e, reg, d.imm16 ); break;
+            case SRC_ZERO: load_imm(e, reg, 0       ); break;
+        }
+    }
+
+    // mov [r12 + offset], reg
+    inline void store_state(emitter_t* e, int offset, reg_t reg) {
+        emit(e, { 0x41, 0x89, (hyu8_t)(0x84 | (reg << 3)), 0x24 });
+        emit32(e, offset);
+    }
+
+    // Records the operation for hyrisc_get_flags, with the result
+    // in eax. Operands were recorded before running it if needed
+    inline void defer_flags(emitter_t* e, hyu8_t op) {
+        store_state(e, FLAGS_RES_OFFSET, EAX);
+
+        // mov byte [r12 + op], imm8
+        emit(e, { 0x41, 0xc6, 0x84, 0x24 });
+        emit32(e, FLAGS_OP_OFFSET);
+        emit8(e, op);
+    }
+
+    inline void emit_alu(emitter_t* e, const hyrisc_decoder_t& d, alu_t op, src_t src1, src_t src2) {
+        hyu8_t flags = HY_FLAGS_LOGIC;
+
+        switch (op) {
+            case ALU_ADD: case ALU_INC: flags = HY_FLAGS_ADD; break;
+            case ALU_SUB: case ALU_DEC:
+            case ALU_CMP: case ALU_CMPB: flags = HY_FLAGS_SUB; break;
+            case ALU_MUL: flags = HY_FLAGS_MUL; break;
+            case ALU_SHL: flags = HY_FLAGS_SHL; break;
+            default: break;
+        }
+
+        // Operands go to eax and ecx
+        switch (op) {
+            case ALU_INC: case ALU_DEC: {
+                load_reg(e, EAX, d.fieldx);
+                load_imm(e, ECX, 1 << d.size);
+            } break;
+
+            case ALU_CMP: case ALU_CMPB: {
+                load_reg(e, EAX, d.fieldx);
+
+                if (src1 == SRC_Y) {
+                    load_reg(e, ECX, d.fieldy);
+
+                    if (op == ALU_CMPB) emit(e, { 0x0f, 0xb6, 0xc9 }); // movzx ecx, cl
+                } else {
+                    hyu32_t imm = (src1 == SRC_I16) ? d.imm16 : 0;
+
+                    load_imm(e, ECX, (op == ALU_CMPB) ? (imm & 0xff) : imm);
+                }
+            } break;
+
+            case ALU_TST: {
+                load_reg(e, EAX, d.fieldx);
+            } break;
+
+            default: {
+                load_src(e, EAX, d, src1);
+                load_src(e, ECX, d, src2);
+            } break;
+        }
+
+        if (flags != HY_FLAGS_LOGIC) {
+            store_state(e, FLAGS_A_OFFSET, EAX);
+            store_state(e, FLAGS_B_OFFSET, ECX);
+        }
+
+        switch (op) {
+            case ALU_ADD: case ALU_INC: alu_rr(e, 0x01, EAX, ECX); break;
+            case ALU_SUB: case ALU_DEC:
+            case ALU_CMP: case ALU_CMPB: alu_rr(e, 0x29, EAX, ECX); break;
+            case ALU_AND: alu_rr(e, 0x21, EAX, ECX); break;
+            case ALU_OR : alu_rr(e, 0x09, EAX, ECX); break;
+            case ALU_XOR: alu_rr(e, 0x31, EAX, ECX); break;
+            case ALU_MUL: emit(e, { 0x0f, 0xaf, 0xc1 }); break; // imul eax, ecx
+            case ALU_SHL: emit(e, { 0xd3, 0xe0 }); break;       // shl eax, cl
+            case ALU_SHR: emit(e, { 0xd3, 0xe8 }); break;       // shr eax, cl
+            case ALU_NOT: emit(e, { 0xf7, 0xd0 }); break;       // not eax
+
+            case ALU_TST: {
+                // and eax, imm32
+                emit8(e, 0x25);
+                emit32(e, 1u << (d.fieldy & 31));
+            } break;
+        }
+
+        defer_flags(e, flags);
+
+        switch (op) {
+            case ALU_TST: case ALU_CMP: case ALU_CMPB: break;
+
+            default: {
+                store_reg(e, d.fieldx, EAX);
+            } break;
+        }
+    }
+
+    // Leaves the effective address in eax
+    inline void emit_address(emitter_t* e, const hyrisc_decoder_t& d, addr_t mode) {
+        load_reg(e, EAX, d.fieldy);
+
+        switch (mode) {
+            case ADDR_M: {
+                load_reg(e, ECX, d.fieldz);
+
+                // imul ecx, ecx, imm32
+                emit(e, { 0x69, 0xc9 });
+                emit32(e, d.fieldw);
+
+                alu_rr(e, 0x01, EAX, ECX);
+            } break;
+
+            case ADDR_S: {
+                load_reg(e, ECX, d.fieldz);
+
+                // shl ecx, imm8
+                emit(e, { 0xc1, 0xe1, d.fieldw });
+
+                alu_rr(e, 0x01, EAX, ECX);
+            } break;
+
+            case ADDR_FA: case ADDR_FS: {
+                // add/sub eax, imm32
+                emit8(e, (mode == ADDR_FA) ? 0x05 : 0x2d);
+                emit32(e, d.fieldz | (d.fieldw << 5));
+            } break;
+        }
+    }
+
+    // Sets CF if the condition holds for the current flags
+    inline void emit_condition(emitter_t* e, hyu8_t cc) {
+        emit(e, { 0x4c, 0x89, 0xe7 });   // mov rdi, r12
+        call(e, (const void*)hyrisc_get_flags);
+        emit(e, { 0x83, 0xe0, 0x0f });   // and eax, 0xf
+        load_imm(e, ECX, hyrisc_condition_table[cc & 31]);
+        emit(e, { 0x0f, 0xa3, 0xc1 });   // bt ecx, eax
+    }
+
+    // pc = CF ? edx : next
+    inline void emit_select_pc(emitter_t* e, hyu32_t next) {
+        load_imm(e, EAX, next);
+
+        emit(e, { 0x0f, 0x42, 0xc2 }); // cmovc eax, edx
+
+        store_reg(e, pc, EAX);
+    }
+}
+
+// Called from translated code, same semantics as the load
+// handlers running through hyrisc_execute_op
+inline bool hyrisc_jit_load(hyrisc_t* proc, hyu32_t addr, hyint_t size, hyu32_t* dst) {
+    hyrisc_init_read(proc, addr, size);
+
+    if (!hyrisc_bus_access(proc)) return false;
+
+    *dst = proc->ext.bci.d;
+
+    return true;
+}
+
+inline bool hyrisc_jit_store(hyrisc_t* proc, hyu32_t addr, hyu32_t value, hyint_t size, hyrisc_block_t* block) {
+    hyrisc_init_write(proc, addr, value, size);
+
+    return hyrisc_bus_access(proc) && block->valid;
+}
+
+inline bool hyrisc_jit_interpret(hyrisc_t* proc, const hyrisc_predecoded_t* op, hyrisc_block_t* block) {
+    return hyrisc_execute_op(proc, op, block);
+}
+
+// Instructions reading PC see the address of the next instruction,
+// translated code only keeps PC up to date when it's needed
+inline bool hyrisc_jit_reads_pc(const hyrisc_decoder_t& d) {
+    return (d.fieldx == pc) || (d.fieldy == pc) ||
+           (d.fieldz == pc) || (d.fieldw == pc);
+}
+
+inline void* hyrisc_jit_translate(hyrisc_jit_t* jit, hyrisc_block_t* block) {
+    using namespace x64;
+
+    emitter_t e;
+
+    e.p = jit->buf + jit->used;
+
+    hyu8_t* start = e.p;
+
+    // push rbx; push r12; push rbp
+    emit(&e, { 0x53, 0x41, 0x54, 0x55 });
+
+    // mov r12, rdi; lea rbx, [rdi + r]
+    emit(&e, { 0x49, 0x89, 0xfc, 0x48, 0x8d, 0x9f });
+    emit32(&e, R_OFFSET);
+
+    // mov rbp, [r12 + retired]
+    emit(&e, { 0x49, 0x8b, 0xac, 0x24 });
+    emit32(&e, RETIRED_OFFSET);
+
+    // Whether the last instruction left PC pointing to the next block
+    bool pc_set = false;
+
+    hyu64_t n = 0;
+
+    for (const hyrisc_predecoded_t& op : block->ops) {
+        const hyrisc_decoder_t& d = op.decoder;
+
+        hyu32_t next = op.pc + 4;
+
+        n++;
+        pc_set = false;
+
+        bool branch = true;
+
+        // Branches don't use fieldx as a register
+        switch (d.opcode) {
+            case HY_BCCS    : case HY_BCCU  :
+            case HY_JALCCI16: case HY_JALCCM: case HY_JALCCS:
+            case HY_RTLCC   :
+                break;
+
+            default: {
+                branch = false;
+            } break;
+        }
+
+        bool native = branch || (d.fieldx != pc);
+
+        if (native && hyrisc_jit_reads_pc(d)) store_imm(&e, pc, next);
+
+#define ALU(opcode, kind, src1, src2) \
+    case opcode: { emit_alu(&e, d, kind, src1, src2); } break;
+
+        if (native) switch (d.opcode) {
+            case HY_MOV: {
+                load_reg(&e, EAX, d.fieldy);
+                store_reg(&e, d.fieldx, EAX);
+            } break;
+
+            case HY_LI : { store_imm(&e, d.fieldx, d.imm16      ); } break;
+            case HY_LUI: { store_imm(&e, d.fieldx, d.imm16 << 16); } break;
+            case HY_RSTS: { store_imm(&e, d.fieldx, 0); } break;
+            case HY_NOP: break;
+
+            case HY_LEAM : case HY_LEAS :
+            case HY_LEAFA: case HY_LEAFS: {
+                addr_t mode = (d.opcode == HY_LEAM) ? ADDR_M :
+                              (d.opcode == HY_LEAS) ? ADDR_S :
+                              (d.opcode == HY_LEAFA) ? ADDR_FA : ADDR_FS;
+
+                emit_address(&e, d, mode);
+                store_reg(&e, d.fieldx, EAX);
+            } break;
+
+            case HY_LOADM : case HY_LOADS :
+            case HY_LOADFA: case HY_LOADFS: {
+                addr_t mode = (d.opcode == HY_LOADM) ? ADDR_M :
+                              (d.opcode == HY_LOADS) ? ADDR_S :
+                              (d.opcode == HY_LOADFA) ? ADDR_FA : ADDR_FS;
+
+                emit_address(&e, d, mode);
+
+                emit(&e, { 0x89, 0xc6 });             // mov esi, eax
+                emit(&e, { 0x4c, 0x89, 0xe7 });       // mov rdi, r12
+                load_imm(&e, EDX, d.size);
+                emit(&e, { 0x48, 0x8d, 0x4b, (hyu8_t)(d.fieldx << 2) }); // lea rcx, [rbx + x*4]
+                sync_retired(&e, n - 1);
+                call(&e, (const void*)hyrisc_jit_load);
+                exit_on_false(&e, n, true, next);
+
+                // The load wrote straight to r0, clear it again
+                if (d.fieldx == r0) {
+                    emit(&e, { 0xc7, 0x03 }); // mov dword [rbx], 0
+                    emit32(&e, 0);
+                }
+            } break;
+
+            case HY_STOREM : case HY_STORES :
+            case HY_STOREFA: case HY_STOREFS: {
+                addr_t mode = (d.opcode == HY_STOREM) ? ADDR_M :
+                              (d.opcode == HY_STORES) ? ADDR_S :
+                              (d.opcode == HY_STOREFA) ? ADDR_FA : ADDR_FS;
+
+                emit_address(&e, d, mode);
+
+                emit(&e, { 0x89, 0xc6 });             // mov esi, eax
+                emit(&e, { 0x4c, 0x89, 0xe7 });       // mov rdi, r12
+                load_reg(&e, EDX, d.fieldx);
+                load_imm(&e, ECX, d.size);
+                emit(&e, { 0x49, 0xb8 });             // mov r8, block
+                emit64(&e, (hyu64_t)block);
+                sync_retired(&e, n - 1);
+                call(&e, (const void*)hyrisc_jit_store);
+                exit_on_false(&e, n, true, next);
+            } break;
+
+            ALU(HY_ADDR   , ALU_ADD , SRC_Y, SRC_Z  )
+            ALU(HY_ADDUI8 , ALU_ADD , SRC_Y, SRC_I8 )
+            ALU(HY_ADDUI16, ALU_ADD , SRC_X, SRC_I16)
+            ALU(HY_ADDSI8 , ALU_ADD , SRC_Y, SRC_I8 )
+            ALU(HY_ADDSI16, ALU_ADD , SRC_X, SRC_I16)
+            ALU(HY_SUBR   , ALU_SUB , SRC_Y, SRC_Z  )
+            ALU(HY_SUBUI8 , ALU_SUB , SRC_Y, SRC_I8 )
+            ALU(HY_SUBUI16, ALU_SUB , SRC_X, SRC_I16)
+            ALU(HY_SUBSI8 , ALU_SUB , SRC_Y, SRC_I8 )
+            ALU(HY_SUBSI16, ALU_SUB , SRC_X, SRC_I16)
+            ALU(HY_MULR   , ALU_MUL , SRC_Y, SRC_Z  )
+            ALU(HY_MULUI8 , ALU_MUL , SRC_Y, SRC_I8 )
+            ALU(HY_MULUI16, ALU_MUL , SRC_X, SRC_I16)
+            ALU(HY_MULSI8 , ALU_MUL , SRC_Y, SRC_I8 )
+            ALU(HY_MULSI16, ALU_MUL , SRC_X, SRC_I16)
+            ALU(HY_CMPZ   , ALU_CMP , SRC_ZERO, SRC_ZERO)
+            ALU(HY_CMPR   , ALU_CMP , SRC_Y, SRC_ZERO)
+            ALU(HY_CMPI8  , ALU_CMPB, SRC_I16, SRC_ZERO)
+            ALU(HY_CMPI16 , ALU_CMP , SRC_I16, SRC_ZERO)
+            ALU(HY_ANDR   , ALU_AND , SRC_Y, SRC_Z  )
+            ALU(HY_ANDI8  , ALU_AND , SRC_Y, SRC_I8 )
+            ALU(HY_ANDI16 , ALU_AND , SRC_X, SRC_I16)
+            ALU(HY_ORR    , ALU_OR  , SRC_Y, SRC_Z  )
+            ALU(HY_ORI8   , ALU_OR  , SRC_Y, SRC_I8 )
+            ALU(HY_ORI16  , ALU_OR  , SRC_X, SRC_I16)
+            ALU(HY_XORR   , ALU_XOR , SRC_Y, SRC_Z  )
+            ALU(HY_XORI8  , ALU_XOR , SRC_Y, SRC_I8 )
+            ALU(HY_XORI16 , ALU_XOR , SRC_X, SRC_I16)
+            ALU(HY_NOT    , ALU_NOT , SRC_Y, SRC_ZERO)
+            ALU(HY_NEG    , ALU_NOT , SRC_Y, SRC_ZERO)
+            ALU(HY_INC    , ALU_INC , SRC_X, SRC_ZERO)
+            ALU(HY_DEC    , ALU_DEC , SRC_X, SRC_ZERO)
+            ALU(HY_TST    , ALU_TST , SRC_X, SRC_ZERO)
+            ALU(HY_LSLR   , ALU_SHL , SRC_Y, SRC_Z  )
+            ALU(HY_LSLI16 , ALU_SHL , SRC_X, SRC_I16)
+            ALU(HY_LSRR   , ALU_SHR , SRC_Y, SRC_Z  )
+            ALU(HY_LSRI16 , ALU_SHR , SRC_X, SRC_I16)
+            ALU(HY_ASLR   , ALU_SHL , SRC_Y, SRC_Z  )
+            ALU(HY_ASLI16 , ALU_SHL , SRC_X, SRC_I16)
+            ALU(HY_ASRR   , ALU_SHR , SRC_Y, SRC_Z  )
+            ALU(HY_ASRI16 , ALU_SHR , SRC_X, SRC_I16)
+
+            case HY_BCCS: case HY_BCCU: case HY_JALCCI16: {
+                hyu32_t target;
+
+                switch (d.opcode) {
+                    case HY_BCCS: target = next + (hyi32_t)(hyi16_t)d.imm16; break;
+                    case HY_BCCU: target = next + (hyu32_t)d.imm16; break;
+                    default     : target = (next & 0xffff0000) | d.imm16; break;
+                }
+
+                emit_condition(&e, d.fieldx);
+                load_imm(&e, EDX, target);
+                emit_select_pc(&e, next);
+
+                pc_set = true;
+            } break;
+
+            case HY_RTLCC: {
+                emit_condition(&e, d.fieldx);
+                load_reg(&e, EDX, lr);
+                emit_select_pc(&e, next);
+
+                pc_set = true;
+            } break;
+
+            case HY_JALCCM: case HY_JALCCS: {
+                store_imm(&e, pc, next);
+
+                emit_condition(&e, d.fieldx);
+
+                // jnc done
+                emit(&e, { 0x0f, 0x83 });
+
+                hyu8_t* patch = e.p;
+
+                emit32(&e, 0);
+
+                store_imm(&e, lr, next);
+                emit_address(&e, d, (d.opcode == HY_JALCCM) ? ADDR_M : ADDR_S);
+                store_reg(&e, pc, EAX);
+
+                hyi32_t rel = e.p - (patch + 4);
+
+                std::memcpy(patch, &rel, 4);
+
+                pc_set = true;
+            } break;
+
+            default: {
+                native = false;
+            } break;
+        }
+
+#undef ALU
+
+        if (native) continue;
+
+        // Let the interpreter run anything else
+        emit(&e, { 0x4c, 0x89, 0xe7 });   // mov rdi, r12
+        emit(&e, { 0x48, 0xbe });         // mov rsi, op
+        emit64(&e, (hyu64_t)&op);
+        emit(&e, { 0x48, 0xba });         // mov rdx, block
+        emit64(&e, (hyu64_t)block);
+        sync_retired(&e, n - 1);
+        call(&e, (const void*)hyrisc_jit_interpret);
+        exit_on_false(&e, n, false, 0);
+
+        pc_set = true;
+    }
+
+    if (!pc_set) store_imm(&e, pc, block->end);
+
+    load_imm(&e, EAX, n);
+
+    hyu8_t* epilogue = e.p;
+
+    // lea rcx, [rbp + rax]; mov [r12 + retired], rcx
+    emit(&e, { 0x48, 0x8d, 0x4c, 0x05, 0x00, 0x49, 0x89, 0x8c, 0x24 });
+    emit32(&e, RETIRED_OFFSET);
+
+    // pop rbp; pop r12; pop rbx; ret
+    emit(&e, { 0x5d, 0x41, 0x5c, 0x5b, 0xc3 });
+
+    for (hyu8_t* exit : e.exits) {
+        hyi32_t rel = epilogue - (exit + 4);
+
+        std::memcpy(exit, &rel, 4);
+    }
+
+    jit->used += e.p - start;
+    jit->translated++;
+
+    return start;
+}
+
+// Differential checking
+// Translated code runs first with its bus accesses recorded, then
+// the interpreter runs the same block on a copy of the CPU taken
+// before, with the recorded accesses played back to it instead of
+// reaching the devices again. Both must end up in the same state.
+struct hyrisc_jit_access_t {
+    hyu32_t  addr;
+    hyu32_t  data;
+    hybool_t rw;
+    hyint_t  size;
+    hybool_t ack;
+};
+
+struct hyrisc_jit_log_t {
+    hyrisc_fbus_t                      target;
+    std::vector <hyrisc_jit_access_t> accesses;
+    size_t                             replayed;
+    hybool_t                           mismatch;
+};
+
+inline bool hyrisc_jit_record_access(void* udata, hyu32_t addr, hyu32_t* data, hybool_t rw, hyint_t size) {
+    hyrisc_jit_log_t* log = (hyrisc_jit_log_t*)udata;
+
+    bool ack = log->target.access(log->target.udata, addr, data, rw, size);
+
+    log->accesses.push_back({ addr, *data, rw, size, ack });
+
+    return ack;
+}
+
+inline bool hyrisc_jit_replay_access(void* udata, hyu32_t addr, hyu32_t* data, hybool_t rw, hyint_t size) {
+    hyrisc_jit_log_t* log = (hyrisc_jit_log_t*)udata;
+
+    if (log->replayed == log->accesses.size()) {
+        log->mismatch = true;
+
+        return false;
+    }
+
+    const hyrisc_jit_access_t& access = log->accesses[log->replayed++];
+
+    if ((access.addr != addr) || (access.rw != rw) || (access.size != size))
+        log->mismatch = true;
+
+    if (rw) {
+        if (access.data != *data) log->mismatch = true;
+    } else {
+        *data = access.data;
+    }
+
+    return access.ack;
+}
+
+inline bool hyrisc_jit_same_state(hyrisc_t* a, hyrisc_t* b) {
+    const hyrisc_bci_t& x = a->ext.bci;
+    const hyrisc_bci_t& y = b->ext.bci;
+
+    return !std::memcmp(a->internal.r, b->internal.r, sizeof(a->internal.r)) &&
+           (a->internal.retired == b->internal.retired) &&
+           (hyrisc_get_flags(a) == hyrisc_get_flags(b)) &&
+           (x.a == y.a) && (x.d == y.d) && (x.s == y.s) && (x.rw == y.rw) &&
+           (x.busreq == y.busreq) && (x.busack == y.busack) && (x.be == y.be) &&
+           (a->ext.pic.irq == b->ext.pic.irq) && (a->ext.pic.v == b->ext.pic.v);
+}
+
+inline hyu64_t hyrisc_jit_verify(hyrisc_t* proc, hyrisc_block_t* block) {
+    hyrisc_t ref = *proc;
+
+    hyrisc_jit_log_t log;
+
+    log.target   = proc->fbus;
+    log.replayed = 0;
+    log.mismatch = false;
+
+    // Accesses hitting the TLB or fastmem would skip the log
+    hyrisc_tlb_t*     tlb     = proc->tlb;
+    hyrisc_fastmem_t* fastmem = proc->fastmem;
+
+    proc->tlb         = nullptr;
+    proc->fastmem     = nullptr;
+    proc->fbus.access = hyrisc_jit_record_access;
+    proc->fbus.udata  = &log;
+
+    hyu64_t count = ((hyrisc_jit_code_t)block->code)(proc);
+
+    proc->fbus    = log.target;
+    proc->tlb     = tlb;
+    proc->fastmem = fastmem;
+
+    // Self-modifying blocks can't be played back
+    if (!block->valid) return count;
+
+    ref.cache   = nullptr;
+    ref.tlb     = nullptr;
+    ref.fastmem = nullptr;
+    ref.jit_run = nullptr;
+
+    ref.fbus.access = hyrisc_jit_replay_access;
+    ref.fbus.udata  = &log;
+
+    hyu64_t ref_count = hyrisc_execute_block(&ref, block, block->ops.size());
+
+    if ((ref_count == count) && !log.mismatch &&
+        (log.replayed == log.accesses.size()) &&
+        hyrisc_jit_same_state(proc, &ref)) {
+        proc->jit->verified++;
+
+        return count;
+    }
+
+    _log(error, "Translated block at %08x diverged from the interpreter", block->pc);
+    _log(error, "Retired %llu instructions, interpreter retired %llu",
+        (unsigned long long)count,
+        (unsigned long long)ref_count
+    );
+
+    for (int r = 0; r < 32; r++)
+        if (proc->internal.r[r] != ref.internal.r[r])
+            _log(error, "%s: %08x, interpreter: %08x",
+                hyrisc_register_names[r],
+                proc->internal.r[r],
+                ref.internal.r[r]
+            );
+
+    if (hyrisc_get_flags(proc) != hyrisc_get_flags(&ref))
+        _log(error, "st: %02x, interpreter: %02x", proc->internal.st, ref.internal.st);
+
+    if (log.mismatch || (log.replayed != log.accesses.size()))
+        _log(error, "Bus accesses don't match");
+
+    std::abort();
+}
+
+// Makes the pages holding [start, start + size) writable, or
+// executable again
+inline bool hyrisc_jit_protect(hyu8_t* start, size_t size, bool writable) {
+#ifdef HYRISC_JIT_X64
+    uintptr_t page  = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)start & ~(page - 1);
+    uintptr_t last  = ((uintptr_t)start + size + (page - 1)) & ~(page - 1);
+
+    return !mprotect((void*)first, last - first, writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC));
+#else
+    return false;
+#endif
+}
+
+// Block translator hook, see hyrisc_t::jit_run
+inline hyu64_t hyrisc_jit_run(hyrisc_t* proc, hyrisc_block_t* block, hyu64_t budget) {
+    hyrisc_jit_t* jit = proc->jit;
+
+    if (!block->code) {
+        if (++block->hits < HYRISC_JIT_THRESHOLD) return 0;
+
+        // Every block translated before the last flush is gone
+        if (jit->generation != proc->cache->generation) {
+            jit->generation = proc->cache->generation;
+            jit->used       = 0;
+        }
+
+        size_t room = (block->ops.size() + 1) * HYRISC_JIT_MAX_OP_SIZE;
+
+        // Out of space, have the run loop free all blocks
+        if ((jit->size - jit->used) < room) {
+            proc->cache->flush_pending = true;
+
+            return 0;
+        }
+
+        hyu8_t* at = jit->buf + jit->used;
+
+        // The host won't let the buffer change, interpret from now on
+        if (!hyrisc_jit_protect(at, room, true)) {
+            proc->jit_run = nullptr;
+
+            return 0;
+        }
+
+        block->code = hyrisc_jit_translate(jit, block);
+
+        if (!hyrisc_jit_protect(at, room, false)) {
+            block->code   = nullptr;
+            proc->jit_run = nullptr;
+
+            return 0;
+        }
+    }
+
+    // Translated code always runs whole blocks
+    if (budget < block->ops.size()) return 0;
+
+    if (jit->verify) return hyrisc_jit_verify(proc, block);
+
+    return ((hyrisc_jit_code_t)block->code)(proc);
+}
+
+// Sets up the recompiler for a CPU, returns false if it isn't
+// supported on this host. Needs the block cache.
+inline bool hyrisc_jit_init(hyrisc_t* proc, bool verify = false) {
+#ifdef HYRISC_JIT_X64
+    if (!proc->cache) return false;
+
+    void* buf = mmap(
+        nullptr,
+        HYRISC_JIT_BUFFER_SIZE,
+        PROT_READ | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0
+    );
+
+    if (buf == MAP_FAILED) return false;
+
+    hyrisc_jit_t* jit = new hyrisc_jit_t;
+
+    jit->buf        = (hyu8_t*)buf;
+    jit->size       = HYRISC_JIT_BUFFER_SIZE;
+    jit->used       = 0;
+    jit->generation = proc->cache->generation;
+    jit->verify     = verify;
+    jit->translated = 0;
+    jit->verified   = 0;
+
+    // Previously built blocks are safe to translate
+    proc->jit     = jit;
+    proc->jit_run = hyrisc_jit_run;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline void hyrisc_jit_destroy(hyrisc_t* proc) {
+#ifdef HYRISC_JIT_X64
+    if (!proc->jit) return;
+
+    // Translated code is referenced by cached blocks
+    if (proc->cache) hyrisc_cache_flush_blocks(proc->cache);
+
+    munmap(proc->jit->buf, proc->jit->size);
+
+    delete proc->jit;
+#endif
+
+    proc->jit     = nullptr;
+    proc->jit_run = nullptr;
+}
\ No newline at end of file
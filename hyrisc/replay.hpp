@@ -0,0 +1,240 @@
+#pragma once
+
+#include "types.hpp"
+
+#include "../log.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Input recording
+// Everything but host input is deterministic, so a run can be played
+// back from its inputs alone. Each input event is logged with the
+// number of instructions retired when the guest asked for it
+// (hyrisc_int_t::retired), and played back at that same point.
+//
+// The log starts with a header (magic, version, a key for the images
+// the board was running and the instruction count recording started
+// at), followed by events: the instruction count delta since the last
+// event and the value as LEB128 varints, with the source in between.
+//
+// When the board can go back in time (see dev/reverse.hpp), events
+// are also kept in memory, and inputs at points already run are
+// served from there.
+
+#define HYRISC_REPLAY_MAGIC   0x50525948 // "HYRP"
+#define HYRISC_REPLAY_VERSION 1
+
+enum hyrisc_input_source_t : hyu8_t {
+    HYRISC_INPUT_TERMINAL
+};
+
+typedef int (*hyrisc_input_t)();
+
+class hyrisc_replay_t {
+    std::ofstream out;
+    std::ifstream in;
+
+    const hyu64_t* clock = nullptr;
+
+    // Instruction counts of the last event written and read
+    hyu64_t recorded_at = 0;
+    hyu64_t played_at = 0;
+
+    // Next event to play back
+    bool    pending = false;
+    hyu64_t next_at;
+    hyu8_t  next_source;
+    hyu32_t next_value;
+
+    struct event_t {
+        hyu64_t at;
+        hyu8_t  source;
+        int     value;
+    };
+
+    bool rewindable = false;
+
+    std::vector <event_t> seen;
+
+    void put(hyu64_t value) {
+        do {
+            hyu8_t b = value & 0x7f;
+
+            value >>= 7;
+
+            out.put(value ? (b | 0x80) : b);
+        } while (value);
+    }
+
+    bool get(hyu64_t& value) {
+        value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            int b = in.get();
+
+            if (b == EOF) return false;
+
+            value |= (hyu64_t)(b & 0x7f) << shift;
+
+            if (!(b & 0x80)) return true;
+        }
+
+        return false;
+    }
+
+    void put_raw(hyu64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++)
+            out.put((value >> (i * 8)) & 0xff);
+    }
+
+    bool get_raw(hyu64_t& value, int bytes) {
+        value = 0;
+
+        for (int i = 0; i < bytes; i++) {
+            int b = in.get();
+
+            if (b == EOF) return false;
+
+            value |= (hyu64_t)b << (i * 8);
+        }
+
+        return true;
+    }
+
+    void fetch() {
+        hyu64_t delta, source, value;
+
+        pending = get(delta) && get(source) && get(value);
+
+        if (!pending) {
+            in.close();
+
+            _log(info, "Input log ended at instruction %llu, taking live input",
+                (unsigned long long)*clock
+            );
+
+            return;
+        }
+
+        next_at     = played_at + delta;
+        next_source = source;
+        next_value  = value;
+    }
+
+public:
+    // Inputs can be served to re-executed code without a log, so
+    // clock is all that's needed in that case
+    void set_rewindable(const hyu64_t* clock) {
+        this->clock = clock;
+
+        rewindable = true;
+    }
+
+    // clock points to the counter events are timed with, key tells
+    // apart logs recorded on different images
+    bool record(const std::string& path, const hyu64_t* clock, hyu64_t key) {
+        out.open(path, std::ios::binary | std::ios::trunc);
+
+        if (!out.is_open()) return false;
+
+        this->clock = clock;
+
+        recorded_at = *clock;
+
+        put_raw(HYRISC_REPLAY_MAGIC, 4);
+        put_raw(HYRISC_REPLAY_VERSION, 4);
+        put_raw(key, 8);
+        put_raw(recorded_at, 8);
+
+        out.flush();
+
+        return out.good();
+    }
+
+    // Playback has to start from the same state and images recording
+    // did, mismatches are reported but don't stop it
+    bool replay(const std::string& path, const hyu64_t* clock, hyu64_t key) {
+        in.open(path, std::ios::binary);
+
+        if (!in.is_open()) return false;
+
+        this->clock = clock;
+
+        hyu64_t magic, version, recorded_key;
+
+        if (!get_raw(magic, 4) || !get_raw(version, 4) || !get_raw(recorded_key, 8) || !get_raw(played_at, 8))
+            return false;
+
+        if ((magic != HYRISC_REPLAY_MAGIC) || (version > HYRISC_REPLAY_VERSION))
+            return false;
+
+        if (recorded_key != key)
+            _log(warning, "Input log was recorded on different images");
+
+        if (played_at != *clock)
+            _log(warning, "Input log starts at instruction %llu, board is at %llu",
+                (unsigned long long)played_at,
+                (unsigned long long)*clock
+            );
+
+        fetch();
+
+        return true;
+    }
+
+    // Reads an input, from the log if playing one back. Events are
+    // flushed as they're recorded, so a crash loses none of them
+    int input(hyrisc_input_source_t source, hyrisc_input_t live) {
+        if (rewindable && !seen.empty() && (*clock <= seen.back().at)) {
+            auto it = std::lower_bound(seen.begin(), seen.end(), *clock,
+                [](const event_t& e, hyu64_t at) { return e.at < at; }
+            );
+
+            if ((it != seen.end()) && (it->at == *clock) && (it->source == source))
+                return it->value;
+
+            _log(error, "Re-execution diverged at instruction %llu", (unsigned long long)*clock);
+        }
+
+        if (pending && ((next_at != *clock) || (next_source != source))) {
+            _log(error, "Replay diverged at instruction %llu, expected an input at %llu",
+                (unsigned long long)*clock,
+                (unsigned long long)next_at
+            );
+
+            pending = false;
+
+            in.close();
+        }
+
+        int value;
+
+        if (pending) {
+            value = (int)next_value;
+
+            played_at = next_at;
+
+            fetch();
+        } else {
+            value = live();
+        }
+
+        if (out.is_open()) {
+            put(*clock - recorded_at);
+            put(source);
+            put((hyu32_t)value);
+
+            out.flush();
+
+            recorded_at = *clock;
+        }
+
+        if (rewindable && (seen.empty() || (*clock > seen.back().at)))
+            seen.push_back({ *clock, source, value });
+
+        return value;
+    }
+};
\ No newline at end of file
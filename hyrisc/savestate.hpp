@@ -0,0 +1,298 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+// Save-states
+// A stream starts with a header (magic and format version) and
+// holds one or more saves. Each save is a run of chunks, ending on
+// an END chunk, and is applied on top of the ones before it, so
+// checkpoints can be appended as incremental saves to the same
+// stream. Chunks are a 4 character tag, a version and a payload
+// size, followed by the payload. Everything is little-endian.
+//
+// Chunk order within a save follows the board, readers skip chunks
+// they don't know about.
+
+#define HYRISC_STATE_MAGIC   0x53535948 // "HYSS"
+#define HYRISC_STATE_VERSION 1
+#define HYRISC_STATE_PIECE   0x100000 // Chunks are read this much at a time
+
+#define HYRISC_STATE_TAG(s) \
+    ((hyu32_t)(s)[0] | ((hyu32_t)(s)[1] << 8) | ((hyu32_t)(s)[2] << 16) | ((hyu32_t)(s)[3] << 24))
+
+class hyrisc_state_writer_t {
+    std::ostream* out = nullptr;
+
+    std::vector <hyu8_t> payload;
+
+    hyu32_t tag;
+    hyu32_t version;
+
+    bool incremental = false;
+
+    void put(hyu64_t value, int bytes, std::vector <hyu8_t>& dst) {
+        for (int i = 0; i < bytes; i++)
+            dst.push_back((value >> (i * 8)) & 0xff);
+    }
+
+public:
+    // Writes the stream header, skipped when appending to a stream
+    bool open(std::ostream& out, bool append = false) {
+        this->out = &out;
+
+        if (!append) {
+            std::vector <hyu8_t> header;
+
+            put(HYRISC_STATE_MAGIC, 4, header);
+            put(HYRISC_STATE_VERSION, 4, header);
+
+            out.write((const char*)header.data(), header.size());
+        }
+
+        return out.good();
+    }
+
+    // Incremental saves only hold what changed since the last one,
+    // devices without a notion of that save everything anyway
+    void set_incremental(bool incremental) {
+        this->incremental = incremental;
+    }
+
+    bool is_incremental() const {
+        return incremental;
+    }
+
+    void begin(const char* tag, hyu32_t version) {
+        this->tag     = HYRISC_STATE_TAG(tag);
+        this->version = version;
+
+        payload.clear();
+    }
+
+    void end() {
+        std::vector <hyu8_t> header;
+
+        put(tag, 4, header);
+        put(version, 4, header);
+        put(payload.size(), 8, header);
+
+        out->write((const char*)header.data(), header.size());
+        out->write((const char*)payload.data(), payload.size());
+    }
+
+    // Closes a save
+    bool finish() {
+        begin("END ", 1);
+        end();
+
+        out->flush();
+
+        return out->good();
+    }
+
+    void u8 (hyu8_t  value) { put(value, 1, payload); }
+    void u16(hyu16_t value) { put(value, 2, payload); }
+    void u32(hyu32_t value) { put(value, 4, payload); }
+    void u64(hyu64_t value) { put(value, 8, payload); }
+
+    void f32(hyfloat_t value) {
+        hyu32_t raw;
+
+        std::memcpy(&raw, &value, sizeof(raw));
+
+        u32(raw);
+    }
+
+    void bytes(const void* data, size_t size) {
+        const hyu8_t* src = (const hyu8_t*)data;
+
+        payload.insert(payload.end(), src, src + size);
+    }
+
+    bool good() const {
+        return out && out->good();
+    }
+};
+
+class hyrisc_state_reader_t {
+    std::istream* in = nullptr;
+
+    std::vector <hyu8_t> payload;
+
+    size_t pos = 0;
+
+    hyu32_t tag = 0;
+    hyu32_t version = 0;
+
+    // Next chunk header, read ahead by peek()
+    bool    pending = false;
+    hyu32_t pending_tag;
+    hyu32_t pending_version;
+    hyu64_t pending_size;
+
+    bool failed = false;
+
+    hyu64_t get(int bytes) {
+        if ((pos + bytes) > payload.size()) {
+            failed = true;
+
+            return 0;
+        }
+
+        hyu64_t value = 0;
+
+        for (int i = 0; i < bytes; i++)
+            value |= (hyu64_t)payload[pos++] << (i * 8);
+
+        return value;
+    }
+
+    bool read_header() {
+        if (pending) return true;
+
+        hyu8_t header[16];
+
+        in->read((char*)header, sizeof(header));
+
+        if (in->gcount() != sizeof(header)) return false;
+
+        pending_tag     = 0;
+        pending_version = 0;
+        pending_size    = 0;
+
+        for (int i = 0; i < 4; i++) pending_tag     |= (hyu32_t)header[i] << (i * 8);
+        for (int i = 0; i < 4; i++) pending_version |= (hyu32_t)header[4 + i] << (i * 8);
+        for (int i = 0; i < 8; i++) pending_size    |= (hyu64_t)header[8 + i] << (i * 8);
+
+        pending = true;
+
+        return true;
+    }
+
+public:
+    // Checks the stream header, returns false if it isn't a
+    // save-state stream or it's from a newer format
+    bool open(std::istream& in) {
+        this->in = &in;
+
+        hyu8_t header[8];
+
+        in.read((char*)header, sizeof(header));
+
+        if (in.gcount() != sizeof(header)) return false;
+
+        hyu32_t magic = 0, format = 0;
+
+        for (int i = 0; i < 4; i++) magic  |= (hyu32_t)header[i] << (i * 8);
+        for (int i = 0; i < 4; i++) format |= (hyu32_t)header[4 + i] << (i * 8);
+
+        return (magic == HYRISC_STATE_MAGIC) && (format <= HYRISC_STATE_VERSION);
+    }
+
+    // True if there's another chunk, and it has this tag
+    bool peek(const char* tag) {
+        return read_header() && (pending_tag == HYRISC_STATE_TAG(tag));
+    }
+
+    // True if the stream has no more saves
+    bool at_end() {
+        return !read_header();
+    }
+
+    // Reads chunks up to one with this tag, skipping everything else.
+    // Doesn't go past the end of the current save
+    bool expect(const char* tag) {
+        while (read_header()) {
+            pending = false;
+
+            if (pending_tag != HYRISC_STATE_TAG(tag)) {
+                if (pending_tag == HYRISC_STATE_TAG("END ")) {
+                    pending = true;
+
+                    return false;
+                }
+
+                if (pending_size > (hyu64_t)std::numeric_limits <std::streamsize>::max()) return false;
+
+                in->ignore(pending_size);
+
+                if (in->gcount() != (std::streamsize)pending_size) return false;
+
+                continue;
+            }
+
+            this->tag = pending_tag;
+            version   = pending_version;
+
+            pos = 0;
+
+            payload.clear();
+
+            // Sizes come from the file, a corrupt one mustn't allocate
+            // more than the stream actually holds
+            for (hyu64_t left = pending_size; left;) {
+                size_t piece = (left < HYRISC_STATE_PIECE) ? left : HYRISC_STATE_PIECE;
+                size_t at = payload.size();
+
+                payload.resize(at + piece);
+
+                in->read((char*)payload.data() + at, piece);
+
+                if (in->gcount() != (std::streamsize)piece) return false;
+
+                left -= piece;
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    hyu32_t chunk_version() const {
+        return version;
+    }
+
+    hyu8_t  u8 () { return get(1); }
+    hyu16_t u16() { return get(2); }
+    hyu32_t u32() { return get(4); }
+    hyu64_t u64() { return get(8); }
+
+    hyfloat_t f32() {
+        hyu32_t raw = u32();
+
+        hyfloat_t value;
+
+        std::memcpy(&value, &raw, sizeof(value));
+
+        return value;
+    }
+
+    void bytes(void* data, size_t size) {
+        if ((pos + size) > payload.size()) {
+            failed = true;
+
+            return;
+        }
+
+        std::memcpy(data, payload.data() + pos, size);
+
+        pos += size;
+    }
+
+    // Bytes left in the current chunk
+    size_t remaining() const {
+        return payload.size() - pos;
+    }
+
+    // False if a chunk was shorter than what was read from it
+    bool good() const {
+        return !failed;
+    }
+};
\ No newline at end of file
@@ -51,6 +51,25 @@ struct hyrisc_decoder_t {
     // hyu8_t   shift_mul;      // Shift/multiply (Bitfield W)
 };
 
+// Kinds of flag-setting operations
+enum hyrisc_flags_op_t : hyu8_t {
+    HY_FLAGS_NONE,      // st is up to date
+    HY_FLAGS_ADD,
+    HY_FLAGS_SUB,
+    HY_FLAGS_MUL,
+    HY_FLAGS_SHL,
+    HY_FLAGS_LOGIC      // Only Z and N depend on the result
+};
+
+// Last flag-setting operation, st is only built from this when
+// something reads it (see hyrisc_get_flags)
+struct hyrisc_flags_t {
+    hyu8_t  op;
+    hyu32_t res;        // Result
+    hyu32_t a;          // Operands
+    hyu32_t b;
+};
+
 // Internal data and latches
 struct hyrisc_int_t {
     hyint_t          cycle;          // Cycle counter
@@ -59,8 +78,52 @@ struct hyrisc_int_t {
     hyint_t          last_cycles;    // Last cycles latch
     hyfloat_t        f[32];          // FPRs and FPCSR
     hyu8_t           st;             // State register
+    hyrisc_flags_t   flags;          // Pending flags
     hybool_t         rw;             // Access type flag
     hyrisc_decoder_t decoder;
+    hyu64_t          retired;        // Instructions retired since reset
+};
+
+struct hyrisc_t;
+struct hyrisc_cache_t;
+struct hyrisc_block_t;
+struct hyrisc_jit_t;
+struct hyrisc_tlb_t;
+struct hyrisc_fastmem_t;
+
+// Instruction handler, returns false when waiting for I/O
+typedef bool (*hyrisc_handler_t)(hyrisc_t*, hyint_t);
+
+// Predecoded instruction
+struct hyrisc_predecoded_t {
+    hyu32_t          pc;             // Physical address tag
+    hyu32_t          instruction;    // Raw instruction word
+    hybool_t         valid;
+    hyrisc_decoder_t decoder;
+    hyrisc_handler_t handler;
+};
+
+// Functional bus interface, lets the CPU access the device owning
+// an address directly instead of going through the BCI handshake.
+// Returns false if no device decoded the address (Open Bus)
+typedef bool (*hyrisc_bus_access_t)(void* udata, hyu32_t addr, hyu32_t* data, hybool_t rw, hyint_t size);
+
+// Returns a host pointer backing [addr, addr + size) if it's plain
+// memory, or nullptr if the range has to go through access (MMIO)
+typedef hyu8_t* (*hyrisc_bus_map_t)(void* udata, hyu32_t addr, hyu32_t size);
+
+// Block translator hook, runs a cached block and returns the number
+// of instructions retired, or 0 to let the interpreter run it
+typedef hyu64_t (*hyrisc_jit_run_t)(hyrisc_t*, hyrisc_block_t*, hyu64_t);
+
+// Called by the debug opcode and illegal instructions, returns false
+// to raise the signal as usual
+typedef bool (*hyrisc_debug_t)(hyrisc_t*);
+
+struct hyrisc_fbus_t {
+    hyrisc_bus_access_t access = nullptr;
+    hyrisc_bus_map_t    map    = nullptr;
+    void*               udata  = nullptr;
 };
 
 struct hyrisc_t {
@@ -70,4 +133,21 @@ struct hyrisc_t {
 
     hyrisc_int_t internal;
     hyrisc_ext_t ext;
+
+    // Host-side acceleration structures (not part of the CPU state)
+    hyrisc_cache_t*   cache   = nullptr;
+    hyrisc_tlb_t*     tlb     = nullptr;
+    hyrisc_fastmem_t* fastmem = nullptr;
+    hyrisc_fbus_t     fbus;
+    hyrisc_jit_t*     jit     = nullptr;
+    hyrisc_jit_run_t  jit_run = nullptr;
+    hyrisc_debug_t    debug   = nullptr;
+    hyrisc_debug_t    illegal = nullptr;
+
+    // Whatever the hooks need to find their owner
+    void*             udata   = nullptr;
+
+    // Edge coverage map and the last block's hash, see coverage.hpp
+    hyu8_t*           coverage      = nullptr;
+    hyu32_t           coverage_prev = 0;
 };
\ No newline at end of file
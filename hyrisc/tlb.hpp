@@ -0,0 +1,90 @@
+#pragma once
+
+#include "types.hpp"
+#include "state.hpp"
+#include "cache.hpp"
+
+#include <cstring>
+
+// Software TLB
+// Direct-mapped cache of host pointers to guest pages backed by
+// plain memory, filled through proc->fbus.map on a miss. Accesses
+// hitting it become single host loads and stores, MMIO pages are
+// cached too, as null entries, and always take the device path.
+// Entries have to be flushed whenever the bus mapping changes.
+
+#define HYRISC_TLB_SIZE    0x100
+#define HYRISC_TLB_MASK    (HYRISC_TLB_SIZE - 1)
+#define HYRISC_TLB_INVALID 0xffffffff
+
+struct hyrisc_tlb_entry_t {
+    hyu32_t page;
+    hyu8_t* host;
+};
+
+struct hyrisc_tlb_t {
+    hyrisc_tlb_entry_t entry[HYRISC_TLB_SIZE];
+};
+
+inline void hyrisc_tlb_flush(hyrisc_t* proc) {
+    if (!proc->tlb) return;
+
+    for (hyrisc_tlb_entry_t& entry : proc->tlb->entry) {
+        entry.page = HYRISC_TLB_INVALID;
+        entry.host = nullptr;
+    }
+}
+
+inline void hyrisc_tlb_init(hyrisc_t* proc) {
+    // Guest memory is little-endian, host pointers can only be
+    // used as is on little-endian hosts
+    if (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__) return;
+
+    if (!proc->tlb) proc->tlb = new hyrisc_tlb_t;
+
+    hyrisc_tlb_flush(proc);
+}
+
+inline void hyrisc_tlb_destroy(hyrisc_t* proc) {
+    delete proc->tlb;
+
+    proc->tlb = nullptr;
+}
+
+inline hyu8_t* hyrisc_tlb_lookup(hyrisc_t* proc, hyu32_t addr) {
+    hyu32_t page = addr >> HYRISC_PAGE_SHIFT;
+
+    hyrisc_tlb_entry_t& entry = proc->tlb->entry[page & HYRISC_TLB_MASK];
+
+    if (entry.page != page) {
+        entry.page = page;
+        entry.host = proc->fbus.map ?
+            proc->fbus.map(proc->fbus.udata, page << HYRISC_PAGE_SHIFT, HYRISC_PAGE_SIZE) :
+            nullptr;
+    }
+
+    return entry.host ? (entry.host + (addr & (HYRISC_PAGE_SIZE - 1))) : nullptr;
+}
+
+// Performs an access of 1, 2 or 4 bytes if it hits memory, returns
+// false if it has to go through the devices instead
+inline bool hyrisc_tlb_access(hyrisc_t* proc, hyu32_t addr, hyu32_t* data, hybool_t rw, hyu32_t bytes) {
+    if (!proc->tlb) return false;
+
+    // Accesses crossing into the next page aren't worth handling
+    if (((addr & (HYRISC_PAGE_SIZE - 1)) + bytes) > HYRISC_PAGE_SIZE) return false;
+
+    hyu8_t* host = hyrisc_tlb_lookup(proc, addr);
+
+    if (!host) return false;
+
+    if (rw) {
+        std::memcpy(host, data, bytes);
+    } else {
+        *data = 0;
+
+        std::memcpy(data, host, bytes);
+    }
+
+    return true;
+}
\ No newline at end of file
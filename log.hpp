@@ -16,7 +16,7 @@
 #define ESCAPE(seq) _ESCAPE_SEQ "[" #seq "m"
 
 namespace _log {
-    const char* colors_low[] = {
+    inline const char* colors_low[] = {
         ESCAPE(30), // Black
         ESCAPE(31), // Red
         ESCAPE(32), // Green
@@ -27,7 +27,7 @@ namespace _log {
         ESCAPE(37)  // White
     };
     
-    const char* colors_high[] = {
+    inline const char* colors_high[] = {
         ESCAPE(30;1),
         ESCAPE(31;1),
         ESCAPE(32;1),
@@ -49,7 +49,7 @@ namespace _log {
         WHITE
     };
 
-    unsigned int color_indexes[] = {
+    inline unsigned int color_indexes[] = {
         WHITE, BLUE, GREEN, CYAN, MAGENTA, RED 
     };
 
@@ -67,7 +67,7 @@ namespace _log {
         mask_all     = 0b00111111
     };
 
-    const char* type_text[] = {
+    inline const char* type_text[] = {
         "none",
         "debug",
         "ok",
@@ -76,17 +76,17 @@ namespace _log {
         "error"
     };
 
-    bool disable_logs = false;
+    inline bool disable_logs = false;
 
     namespace settings {
-        bool disable_escape = false;
-        bool bright_colors = true;
-        type_mask_t mask = mask_all;
-        std::string app_name;
-        std::ofstream file;
+        inline bool disable_escape = false;
+        inline bool bright_colors = true;
+        inline type_mask_t mask = mask_all;
+        inline std::string app_name;
+        inline std::ofstream file;
     }
 
-    bool is_allowed(int type) {
+    inline bool is_allowed(int type) {
         switch (type) {
             case none   : return settings::mask & mask_none;
             case debug  : return settings::mask & mask_debug;
@@ -99,11 +99,11 @@ namespace _log {
         return false;
     }
 
-    void disable() {
+    inline void disable() {
         disable_logs = true;
     }
 
-    void enable() {
+    inline void enable() {
         disable_logs = false;
     }
 
@@ -111,7 +111,7 @@ namespace _log {
         if (disable_logs) return;
         if (!is_allowed(type)) return;
 
-        static char buf[0x400];
+        static thread_local char buf[0x400];
 
         std::sprintf(buf, text.c_str(), args...);
 
@@ -128,7 +128,7 @@ namespace _log {
         }
     }
 
-    void init(std::string app_name, std::string file_name = "", bool bright = true, bool no_escape = false) {
+    inline void init(std::string app_name, std::string file_name = "", bool bright = true, bool no_escape = false) {
         _log::settings::app_name = app_name;
         _log::settings::file.open(app_name);
         _log::settings::bright_colors = bright;
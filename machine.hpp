@@ -0,0 +1,688 @@
+#pragma once
+
+#include "hyrisc/hyrisc.hpp"
+#include "hyrisc/jit.hpp"
+#include "hyrisc/replay.hpp"
+
+#include "dev/bus.hpp"
+#include "dev/terminal.hpp"
+#include "dev/memory.hpp"
+#include "dev/bios.hpp"
+#include "dev/iobus.hpp"
+#include "dev/iobus/pci.hpp"
+#include "dev/iobus/ata.hpp"
+#include "dev/smp.hpp"
+
+#include "log.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Machines
+// A board (CPU, bus and devices) with nothing shared between
+// instances, so any number of them can be created in a process and
+// run on different threads at the same time. Debug opcodes and
+// illegal instructions stop run() instead of raising signals.
+//
+// Devices and the CPU are reachable as members for anything the
+// machine doesn't wrap. Machines can't be moved, devices point to
+// each other.
+//
+// Multicore
+// Boards with more than one core run in functional mode, every core
+// but the first on a host thread of its own. All of them start at
+// the reset vector, and tell each other apart through the SMP
+// device (see dev/smp.hpp). RAM is accessed directly by every core,
+// device accesses are serialized. Cores run a quantum of
+// instructions at a time and then wait for each other, which is when
+// code written by one core is dropped from the others' caches. IRQs
+// only go to the first core.
+//
+// Deterministic boards run every core on the calling thread instead,
+// a quantum each in turn, so runs always interleave the same way.
+// A non-zero seed shuffles the order of every round, the same way
+// for the same seed. Where a run stops doesn't change the schedule,
+// and save-states carry it.
+
+#define MACHINE_BIOS_SIZE 0x1000
+#define MACHINE_SMP_BASE  0xa0001000
+#define MACHINE_QUANTUM   0x10000
+
+struct machine_config_t {
+    std::string bios_image = "a.out";
+    std::string ata_image  = "test.img";
+
+    // Used instead of reading bios_image if set, shared with every
+    // other machine using it
+    dev_bios_image_t bios_rom;
+
+    // RAM always ends at 0x80000000, and can take everything up to
+    // the BIOS page
+    hyu64_t memory_size = 0x10000;
+
+    // Functional mode runs whole instructions and accesses devices
+    // directly, pin-accurate mode clocks the CPU and the bus. The
+    // others only work in functional mode
+    bool functional = false;
+    bool fastmem    = false;
+    bool jit        = false;
+    bool jit_verify = false;
+
+    // Instructions each core runs between syncs, with more than one
+    unsigned cores   = 1;
+    hyu64_t  quantum = MACHINE_QUANTUM;
+
+    bool    deterministic = false;
+    hyu64_t seed          = 0;
+};
+
+// FNV-1a
+inline hyu64_t machine_hash_file(std::string path, hyu64_t hash) {
+    std::ifstream file(path, std::ios::binary);
+
+    std::vector <char> buf(0x10000);
+
+    while (file) {
+        file.read(buf.data(), buf.size());
+
+        for (std::streamsize i = 0; i < file.gcount(); i++) {
+            hash ^= (hyu8_t)buf[i];
+            hash *= 0x100000001b3ull;
+        }
+    }
+
+    return hash;
+}
+
+// Anything that changes how the board boots
+inline hyu64_t machine_key(const machine_config_t& config) {
+    hyu64_t key = 0xcbf29ce484222325ull;
+
+    key = machine_hash_file(config.bios_image, key);
+    key = machine_hash_file(config.ata_image, key);
+
+    key ^= config.memory_size * 0x100000001b3ull;
+
+    // Keeps single core keys as they were, the quantum decides how
+    // cores interleave
+    if (config.cores > 1) key = (key ^ config.cores) * 0x100000001b3ull;
+    if (config.cores > 1) key = (key ^ config.quantum) * 0x100000001b3ull;
+    if (config.cores > 1) key = (key ^ (config.deterministic ? (config.seed + 1) : 0)) * 0x100000001b3ull;
+
+    return key;
+}
+
+enum machine_stop_t {
+    MACHINE_BUDGET,  // Ran the whole budget
+    MACHINE_DEBUG,   // Ran a debug opcode
+    MACHINE_ILLEGAL  // Ran an illegal instruction
+};
+
+class machine_t {
+    // Released after RAM is unmapped from it
+    struct fastmem_region_t {
+        hyu8_t* base = nullptr;
+
+        // Pages RAM is mapped to
+        std::vector <hyu32_t> mapped;
+
+        ~fastmem_region_t() {
+            hyrisc_fastmem_release(base);
+        }
+    } region;
+
+    bool functional = false;
+
+    // Set by whichever core stops first
+    std::atomic <machine_stop_t> stop { MACHINE_BUDGET };
+    std::atomic <hyrisc_t*>      stopped { nullptr };
+
+    // What a core's accesses go through, with more than one
+    struct port_t {
+        machine_t* machine;
+        hyu32_t    core;
+    };
+
+    // Every core but the first
+    std::vector <std::unique_ptr <hyrisc_t>> secondary;
+    std::vector <hyrisc_t*>                  cores;
+    std::vector <port_t>                     ports;
+    std::vector <std::thread>                threads;
+
+    std::unique_ptr <hyrisc_code_share_t> code;
+
+    hyu64_t quantum = MACHINE_QUANTUM;
+
+    // Guards every device access with more than one core
+    std::mutex device_lock;
+
+    // Quanta are handed out to the threads by bumping round, the last
+    // one to finish it wakes the first core up
+    std::mutex              sync_lock;
+    std::condition_variable sync_start;
+    std::condition_variable sync_done;
+
+    hyu64_t  round = 0;
+    hyu64_t  round_budget = 0;
+    unsigned running = 0;
+    bool     quit = false;
+
+    // Deterministic schedule, the core on turn in order has left
+    // instructions of its quantum to go
+    bool deterministic = false;
+
+    std::vector <hyu32_t> order;
+
+    hyu32_t turn = 0;
+    hyu64_t left = 0;
+    hyu64_t seed = 0;
+
+    static bool stop_on(hyrisc_t* proc, machine_stop_t reason) {
+        machine_t* machine = (machine_t*)proc->udata;
+
+        hyrisc_t* first = nullptr;
+
+        if (machine->stopped.compare_exchange_strong(first, proc)) machine->stop = reason;
+
+        // Block execution stops right after the op
+        proc->ext.freeze = true;
+
+        return true;
+    }
+
+    static bool on_debug(hyrisc_t* proc) {
+        return stop_on(proc, MACHINE_DEBUG);
+    }
+
+    static bool on_illegal(hyrisc_t* proc) {
+        return stop_on(proc, MACHINE_ILLEGAL);
+    }
+
+    static bool bus_access(void* udata, hyu32_t addr, hyu32_t* data, hybool_t rw, hyint_t size) {
+        return ((dev_bus_t*)udata)->access(addr, *data, rw, size);
+    }
+
+    static hyu8_t* bus_map(void* udata, hyu32_t addr, hyu32_t size) {
+        return ((dev_bus_t*)udata)->host_pointer(addr, size);
+    }
+
+    static bool port_access(void* udata, hyu32_t addr, hyu32_t* data, hybool_t rw, hyint_t size) {
+        port_t* port = (port_t*)udata;
+
+        std::lock_guard <std::mutex> guard(port->machine->device_lock);
+
+        port->machine->smp.set_core(port->core);
+
+        return port->machine->bus.access(addr, *data, rw, size);
+    }
+
+    // Devices may move their backing memory on access (the BIOS does)
+    static hyu8_t* port_map(void* udata, hyu32_t addr, hyu32_t size) {
+        port_t* port = (port_t*)udata;
+
+        std::lock_guard <std::mutex> guard(port->machine->device_lock);
+
+        return port->machine->bus.host_pointer(addr, size);
+    }
+
+    // Stops early if the core gets frozen. Pending FPU exceptions are
+    // folded in on the thread that raised them, cores may run on
+    // another one next or go away
+    static void run_core(hyrisc_t* proc, hyu64_t budget) {
+        hyu64_t start = proc->internal.retired;
+
+        while (((proc->internal.retired - start) < budget) && !proc->ext.freeze)
+            if (!hyrisc_run(proc, budget - (proc->internal.retired - start))) break;
+
+        fpu::sync(proc);
+    }
+
+    void worker(hyrisc_t* proc) {
+        hyu64_t seen = 0;
+
+        for (;;) {
+            hyu64_t budget;
+
+            {
+                std::unique_lock <std::mutex> guard(sync_lock);
+
+                sync_start.wait(guard, [&]() { return quit || (round != seen); });
+
+                if (quit) return;
+
+                seen   = round;
+                budget = round_budget;
+            }
+
+            run_core(proc, budget);
+
+            std::lock_guard <std::mutex> guard(sync_lock);
+
+            if (!--running) sync_done.notify_one();
+        }
+    }
+
+    // Every core runs up to a quantum, then the first waits for the
+    // others and brings their code caches up to date
+    machine_stop_t run_cores(hyu64_t budget) {
+        hyu64_t start = cpu.internal.retired;
+
+        while (((cpu.internal.retired - start) < budget) && (stop == MACHINE_BUDGET)) {
+            hyu64_t slice = budget - (cpu.internal.retired - start);
+
+            if (slice > quantum) slice = quantum;
+
+            {
+                std::lock_guard <std::mutex> guard(sync_lock);
+
+                round_budget = slice;
+                running      = threads.size();
+
+                round++;
+            }
+
+            sync_start.notify_all();
+
+            hyu64_t before = cpu.internal.retired;
+
+            run_core(&cpu, slice);
+
+            {
+                std::unique_lock <std::mutex> guard(sync_lock);
+
+                sync_done.wait(guard, [&]() { return !running; });
+            }
+
+            hyrisc_code_share_sync(code.get(), cores.data(), cores.size());
+
+            // The first core can't go on
+            if (cpu.internal.retired == before) break;
+        }
+
+        if (stop != MACHINE_BUDGET)
+            for (hyrisc_t* proc : cores) proc->ext.freeze = false;
+
+        return stop;
+    }
+
+    // New order for the next round, xorshift picks it
+    void shuffle() {
+        for (hyu32_t core = 0; core < order.size(); core++)
+            order[core] = core;
+
+        if (!seed) return;
+
+        for (size_t i = order.size() - 1; i; i--) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+
+            std::swap(order[i], order[seed % (i + 1)]);
+        }
+    }
+
+    // Runs cores in turn until the first core has run budget
+    // instructions. Other cores always finish their quantum
+    machine_stop_t run_turns(hyu64_t budget) {
+        hyu64_t start = cpu.internal.retired;
+
+        while (((cpu.internal.retired - start) < budget) && (stop == MACHINE_BUDGET)) {
+            if (!left) {
+                if (++turn >= order.size()) {
+                    turn = 0;
+
+                    shuffle();
+                }
+
+                left = quantum;
+            }
+
+            hyrisc_t* proc = cores[order[turn]];
+
+            hyu64_t slice = left;
+
+            if ((proc == &cpu) && (slice > (budget - (cpu.internal.retired - start))))
+                slice = budget - (cpu.internal.retired - start);
+
+            hyu64_t before = proc->internal.retired;
+
+            run_core(proc, slice);
+
+            hyu64_t ran = proc->internal.retired - before;
+
+            left -= ran;
+
+            hyrisc_code_share_sync(code.get(), cores.data(), cores.size());
+
+            if ((ran == slice) || (stop != MACHINE_BUDGET)) continue;
+
+            // Frozen, its turn is over
+            left = 0;
+
+            // The first core can't go on
+            if (proc == &cpu) break;
+        }
+
+        if (stop != MACHINE_BUDGET)
+            for (hyrisc_t* proc : cores) proc->ext.freeze = false;
+
+        return stop;
+    }
+
+    // Sets up a core's caches and functional bus, the first core's
+    // devices are already set up
+    void init_core(hyrisc_t* proc, hyu32_t core, const machine_config_t& config) {
+        hyrisc_set_cpuid(proc, core ? nullptr : "main-cpu", core);
+        hyrisc_cache_init(proc);
+        hyrisc_pulse_reset(proc, 0x00000000);
+
+        proc->udata   = this;
+        proc->debug   = on_debug;
+        proc->illegal = on_illegal;
+
+        proc->ext.bci.busirq = false;
+        proc->ext.vcc = 1.0f;
+
+        if (!functional) return;
+
+        if (cores.size() > 1) {
+            proc->cache->shared = code.get();
+
+            proc->fbus.access = port_access;
+            proc->fbus.map    = port_map;
+            proc->fbus.udata  = &ports[core];
+        } else {
+            proc->fbus.access = bus_access;
+            proc->fbus.map    = bus_map;
+            proc->fbus.udata  = &bus;
+        }
+
+        hyrisc_tlb_init(proc);
+
+        if (region.base && !hyrisc_fastmem_init(proc, region.base, region.mapped.data())) {
+            if (!core) _log(warning, "Couldn't install the fastmem fault handler, using bounds checked accesses");
+        }
+
+        if ((config.jit || config.jit_verify) && !hyrisc_jit_init(proc, config.jit_verify)) {
+            if (!core) _log(warning, "Dynamic recompiler not supported on this host, interpreting");
+        }
+    }
+
+    static void destroy_core(hyrisc_t* proc) {
+        fpu::release(proc);
+
+        hyrisc_jit_destroy(proc);
+        hyrisc_fastmem_destroy(proc);
+        hyrisc_tlb_destroy(proc);
+        hyrisc_cache_destroy(proc);
+    }
+
+public:
+    hyrisc_t cpu;
+
+    dev_bus_t       bus;
+    dev_bios_t      bios;
+    dev_memory_t    memory;
+    dev_terminal_t  terminal;
+    dev_iobus_t     iobus;
+    iobus_dev_pci_t pci;
+    iobus_dev_ata_t ide;
+    dev_smp_t       smp;
+
+    // Host input goes through here once recording or playback is set
+    // up on it (see attach_replay)
+    hyrisc_replay_t replay;
+
+    machine_t() = default;
+    machine_t(const machine_t&) = delete;
+    machine_t& operator=(const machine_t&) = delete;
+
+    ~machine_t() {
+        {
+            std::lock_guard <std::mutex> guard(sync_lock);
+
+            quit = true;
+        }
+
+        sync_start.notify_all();
+
+        for (std::thread& thread : threads)
+            thread.join();
+
+        destroy_core(&cpu);
+
+        for (std::unique_ptr <hyrisc_t>& proc : secondary)
+            destroy_core(proc.get());
+    }
+
+    // Builds the board and resets the CPU. Returns false if the
+    // board can't be built, features the host doesn't support are
+    // left out with a warning
+    bool create(const machine_config_t& config) {
+        if ((config.memory_size & 0xfff) || !config.memory_size || (config.memory_size > 0x7ffff000)) {
+            _log(error, "RAM size has to be a non-zero multiple of 4 KiB, up to 0x7ffff000 bytes");
+
+            return false;
+        }
+
+        if (!config.cores || !config.quantum) {
+            _log(error, "Boards need at least one core, and a non-zero quantum");
+
+            return false;
+        }
+
+        hyu32_t memory_base = 0x80000000 - config.memory_size;
+
+        functional = config.functional || config.jit || config.jit_verify || config.fastmem || (config.cores > 1);
+
+        bus.init(&cpu.ext);
+
+        bios.create(MACHINE_BIOS_SIZE, 0x00000000);
+        bios.init(&cpu.ext);
+
+        if (!config.bios_rom || !bios.attach_image(config.bios_rom))
+            bios.load(config.bios_image, false);
+
+        bus.map(&bios, 0x00000000, MACHINE_BIOS_SIZE);
+
+        // RAM has to be placed in the guest address space reservation
+        // for fastmem
+        region.base = config.fastmem ? hyrisc_fastmem_reserve() : nullptr;
+
+        if (config.fastmem && !region.base) {
+            _log(warning, "Fastmem not supported on this host, using bounds checked accesses");
+        }
+
+        if (!memory.create(config.memory_size, memory_base, region.base ? (region.base + memory_base) : nullptr)) {
+            _log(error, "Couldn't reserve %llu bytes of host memory for RAM", (unsigned long long)config.memory_size);
+
+            return false;
+        }
+
+        if (region.base) {
+            region.mapped.assign(HYRISC_FASTMEM_PAGES / 32, 0);
+
+            hyrisc_fastmem_mark(region.mapped.data(), memory_base, config.memory_size);
+        }
+
+        memory.init(&cpu.ext);
+        bus.map(&memory, memory_base, config.memory_size);
+
+        terminal.create(0xa0000000);
+        terminal.init(&cpu.ext);
+        bus.map(&terminal, 0xa0000000, 0x2);
+
+        /*           a0000000    fffffffe
+        System bus -----+------------+-
+                        |            |        1f0   cf8
+                        terminal     iobus ----+-----+--------
+                                               |     |
+                                               ide   pci -+-----------
+                                               |          |
+                                               +--------> bus 0, device 0
+        */
+
+        iobus.init(&cpu.ext);
+        iobus.attach_device(&pci);
+        iobus.attach_device(&ide);
+        pci.register_device(ide.get_pci_desc(), 0, 0);
+        bus.map(&iobus, IOBUS_PORT, 0x2);
+
+        if (!ide.attach_drive(config.ata_image, ATA_PRI_MASTER)) {
+            _log(error, "Couldn't attach drive with image \"%s\" to ATA channel", config.ata_image.c_str());
+        }
+
+        quantum = config.quantum;
+
+        cores.push_back(&cpu);
+
+        for (unsigned core = 1; core < config.cores; core++) {
+            secondary.emplace_back(new hyrisc_t);
+
+            cores.push_back(secondary.back().get());
+        }
+
+        if (cores.size() > 1) {
+            smp.create(MACHINE_SMP_BASE, cores.size());
+            smp.init(&cpu.ext);
+            bus.map(&smp, MACHINE_SMP_BASE, SMP_SIZE);
+
+            code.reset(new hyrisc_code_share_t);
+
+            hyrisc_code_share_init(code.get());
+
+            for (hyu32_t core = 0; core < cores.size(); core++)
+                ports.push_back({ this, core });
+        }
+
+        for (hyu32_t core = 0; core < cores.size(); core++)
+            init_core(cores[core], core, config);
+
+        deterministic = config.deterministic;
+
+        if (deterministic) {
+            order.resize(cores.size());
+
+            seed = config.seed;
+            turn = order.size() - 1;
+            left = 0;
+
+            return true;
+        }
+
+        for (size_t core = 1; core < cores.size(); core++)
+            threads.emplace_back(&machine_t::worker, this, cores[core]);
+
+        return true;
+    }
+
+    bool is_functional() const {
+        return functional;
+    }
+
+    // Terminal input is recorded to or played back from the input
+    // log, timed by this machine's instruction count
+    void attach_replay() {
+        terminal.attach_replay(&replay);
+    }
+
+    // Runs up to budget instructions, or until the guest runs a debug
+    // opcode or an illegal instruction. Running again picks up right
+    // after it
+    machine_stop_t run(hyu64_t budget) {
+        hyu64_t start = cpu.internal.retired;
+
+        stop    = MACHINE_BUDGET;
+        stopped = nullptr;
+
+        if (cores.size() > 1) return deterministic ? run_turns(budget) : run_cores(budget);
+
+        while (((cpu.internal.retired - start) < budget) && !cpu.ext.freeze) {
+            if (functional) {
+                if (!hyrisc_run(&cpu, budget - (cpu.internal.retired - start))) break;
+            } else {
+                hyrisc_clock(&cpu);
+
+                bus.update();
+            }
+        }
+
+        fpu::sync(&cpu);
+
+        if (stop != MACHINE_BUDGET) cpu.ext.freeze = false;
+
+        return stop;
+    }
+
+    // Instructions retired by the first core
+    hyu64_t retired() const {
+        return cpu.internal.retired;
+    }
+
+    size_t core_count() const {
+        return cores.size();
+    }
+
+    // Core that stopped the last run, the first core if it ran its
+    // whole budget
+    hyrisc_t* stopped_core() {
+        hyrisc_t* proc = stopped;
+
+        return proc ? proc : &cpu;
+    }
+
+    hyrisc_t* get_core(size_t core) {
+        return cores[core];
+    }
+
+    // Other cores follow the devices, and the schedule follows them
+    // on deterministic boards
+    void save(hyrisc_state_writer_t& w) {
+        hyrisc_save_state(&cpu, w);
+
+        bus.save(w);
+
+        for (size_t core = 1; core < cores.size(); core++)
+            hyrisc_save_state(cores[core], w);
+
+        if (!deterministic || (cores.size() < 2)) return;
+
+        w.begin("SCHD", 1);
+        w.u64(quantum);
+        w.u32(turn);
+        w.u64(left);
+        w.u64(seed);
+
+        for (hyu32_t core : order)
+            w.u32(core);
+
+        w.end();
+    }
+
+    bool load(hyrisc_state_reader_t& r) {
+        if (!hyrisc_load_state(&cpu, r) || !bus.load(r)) return false;
+
+        for (size_t core = 1; core < cores.size(); core++)
+            if (!hyrisc_load_state(cores[core], r)) return false;
+
+        if (!deterministic || (cores.size() < 2)) return true;
+
+        // Turns from another quantum wouldn't replay the same way
+        if (!r.expect("SCHD") || (r.u64() != quantum)) return false;
+
+        turn = r.u32();
+        left = r.u64();
+        seed = r.u64();
+
+        for (hyu32_t& core : order)
+            core = r.u32();
+
+        return r.good() && (turn < order.size());
+    }
+};
\ No newline at end of file
@@ -1,20 +1,24 @@
-#include "hyrisc/hyrisc.hpp"
+#include "machine.hpp"
+#include "batch.hpp"
+#include "forkserver.hpp"
+#include "fuzz.hpp"
 
+#include <cctype>
+#include <chrono>
 #include <csignal>
+#include <fstream>
 #include <iomanip>
+#include <set>
+#include <sstream>
 #include <string>
 
 #include "log.hpp"
+#include "cli.hpp"
 
-#include "dev/flash.hpp"
-#include "dev/terminal.hpp"
-#include "dev/memory.hpp"
-#include "dev/bios.hpp"
-#include "dev/iobus.hpp"
-#include "dev/iobus/pci.hpp"
-#include "dev/iobus/ata.hpp"
+#include "dev/reverse.hpp"
 
-hyrisc_t* cpu = new hyrisc_t;
+// The one machine this frontend runs, signal handlers report on it
+machine_t* machine = new machine_t;
 
 const char* bus_error_codes[] = {
     "HY_EOK", // EPERM
@@ -148,7 +152,7 @@ const char* bus_error_codes[] = {
     "HY_ENOTRECOVERABLE"
 };
 
-void print_cpu_status_main() {
+void print_cpu_status_main(hyrisc_t* cpu) {
     _log(info, "State:\nMain registers:");
 
     for (int r = 0; r < 32; r++) {
@@ -162,18 +166,20 @@ void print_cpu_status_main() {
                   << "0x" << std::setw(8) << std::setfill('0') << std::hex << cpu->internal.r[r] << "  ";
     }
 
+    hyu8_t st = hyrisc_get_flags(cpu);
+
     std::cout << "\nFlags      : ----"
-              << ((cpu->internal.st & 0b00001000) ? 'C' : 'c')
-              << ((cpu->internal.st & 0b00000100) ? 'V' : 'v')
-              << ((cpu->internal.st & 0b00000010) ? 'N' : 'n')
-              << ((cpu->internal.st & 0b00000001) ? 'Z' : 'z')
+              << ((st & 0b00001000) ? 'C' : 'c')
+              << ((st & 0b00000100) ? 'V' : 'v')
+              << ((st & 0b00000010) ? 'N' : 'n')
+              << ((st & 0b00000001) ? 'Z' : 'z')
               << std::endl;
     std::cout << "Cycle      : " << std::dec << (int)cpu->internal.cycle << std::endl;
     std::cout << "Instruction: " << std::setw(8) << std::setfill('0') << std::hex << cpu->internal.instruction << std::endl;
     //std::cout << "Link level : " << std::dec << cpu->internal.link_level << std::endl;
 }
 
-void print_cpu_status() {
+void print_cpu_status(hyrisc_t* cpu) {
     _log(info, "State:\nMain registers:");
 
     for (int r = 0; r < 32; r++) {
@@ -187,11 +193,13 @@ void print_cpu_status() {
                   << "0x" << std::setw(8) << std::setfill('0') << std::hex << cpu->internal.r[r] << "  ";
     }
 
+    hyu8_t st = hyrisc_get_flags(cpu);
+
     std::cout << "\nFlags      : ----"
-              << ((cpu->internal.st & 0b00001000) ? 'C' : 'c')
-              << ((cpu->internal.st & 0b00000100) ? 'V' : 'v')
-              << ((cpu->internal.st & 0b00000010) ? 'N' : 'n')
-              << ((cpu->internal.st & 0b00000001) ? 'Z' : 'z')
+              << ((st & 0b00001000) ? 'C' : 'c')
+              << ((st & 0b00000100) ? 'V' : 'v')
+              << ((st & 0b00000010) ? 'N' : 'n')
+              << ((st & 0b00000001) ? 'Z' : 'z')
               << std::endl;
     std::cout << "Cycle      : " << std::dec << cpu->internal.cycle << std::endl;
     std::cout << "Instruction: " << std::setw(8) << std::setfill('0') << std::hex << cpu->internal.instruction << std::endl;
@@ -199,6 +207,9 @@ void print_cpu_status() {
 
     std::cout << "\nFloating Point registers:\n";
 
+    // Pick up exceptions still pending on the host
+    fpu::sync(cpu);
+
     std::cout.precision(7);
     
     for (int f = 0; f < 32; f++) {
@@ -257,66 +268,317 @@ void print_cpu_status() {
     std::cout << "VCC   : " << cpu->ext.vcc << std::endl;
 }
 
-void sigill_handler(int signal) {
+// Save-states
+// --save-state writes the board when the guest stops. With
+// --checkpoint-every, it's written once before running, and then
+// only what changed is appended every so many instructions
+std::ofstream state_file;
+hyrisc_state_writer_t state_writer;
+bool state_checkpoints = false;
+
+void save_machine(bool incremental) {
+    if (!state_file.is_open()) return;
+
+    state_writer.set_incremental(incremental);
+
+    machine->save(state_writer);
+
+    if (!state_writer.finish()) {
+        _log(error, "Couldn't write save-state");
+    }
+}
+
+// Saves are applied in order, later ones may be incremental
+bool load_machine(std::string path) {
+    std::ifstream file(path, std::ios::binary);
+
+    hyrisc_state_reader_t reader;
+
+    if (!file.is_open() || !reader.open(file)) return false;
+
+    if (reader.at_end()) return false;
+
+    while (!reader.at_end()) {
+        if (!machine->load(reader)) return false;
+        if (!reader.expect("END ")) return false;
+    }
+
+    return true;
+}
+
+// Boot snapshot cache
+// With --boot-cache, the first debug opcode the guest runs marks the
+// end of its initialization. The board is saved to the cache right
+// after it, keyed by a hash of the BIOS and drive images, and the
+// guest keeps running. Later runs with the same images start from
+// the snapshot.
+std::string boot_cache_path;
+bool boot_cache_pending = false;
+
+void boot_cache_save() {
+    boot_cache_pending = false;
+
+    // Written to a temporary file first, so other runs never see
+    // half a snapshot
+    std::string temp = boot_cache_path + ".tmp";
+
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+
+    hyrisc_state_writer_t writer;
+
+    bool saved = file.is_open() && writer.open(file);
+
+    if (saved) {
+        machine->save(writer);
+
+        saved = writer.finish();
+    }
+
+    file.close();
+
+    if (saved && !std::rename(temp.c_str(), boot_cache_path.c_str())) {
+        _log(info, "Saved boot snapshot to \"%s\"", boot_cache_path.c_str());
+    } else {
+        std::remove(temp.c_str());
+
+        _log(warning, "Couldn't save boot snapshot to \"%s\"", boot_cache_path.c_str());
+    }
+}
+
+// Reverse debugging
+// With --reverse, the guest runs under dev_reverse_t and drops to a
+// prompt on debug opcodes, breakpoints and Ctrl-C instead of stopping.
+// Debug opcodes act as breakpoints on themselves, the guest stops
+// right before running them.
+dev_reverse_t reverse;
+bool reverse_enabled = false;
+
+volatile std::sig_atomic_t break_requested = 0;
+
+std::set <hyu32_t> breakpoints;
+
+// Where the guest was resumed from, a debug opcode there was already
+// stopped at. Steps and re-execution run over debug opcodes
+bool    continuing = false;
+hyu64_t resume_at = 0;
+bool    debug_hit = false;
+hyu64_t debug_at = 0;
+
+// Freezes the CPU, the run loop stops at the end of the block
+bool reverse_debug(hyrisc_t* proc) {
+    if (continuing && !debug_hit && (proc->internal.retired != resume_at)) {
+        debug_hit = true;
+        debug_at  = proc->internal.retired;
+
+        proc->ext.freeze = true;
+    }
+
+    return true;
+}
+
+bool at_stop(hyrisc_t* proc) {
+    hyu32_t addr = proc->internal.r[pc];
+
+    if (breakpoints.count(addr)) return true;
+
+    hyu8_t* host = machine->bus.host_pointer(addr, 4);
+
+    if (!host) return false;
+
+    hyu32_t word;
+
+    std::memcpy(&word, host, sizeof(word));
+
+    hyrisc_decoder_t decoder;
+
+    hyrisc_decode_word(&decoder, word);
+
+    return decoder.opcode == HY_DEBUG;
+}
+
+void reverse_continue() {
+    continuing      = true;
+    resume_at       = machine->cpu.internal.retired;
+    debug_hit       = false;
+    break_requested = 0;
+
+    while (!break_requested) {
+        // Breakpoints have to be checked after every instruction
+        if (breakpoints.size()) {
+            if (!reverse.run(1) || at_stop(&machine->cpu)) break;
+        } else {
+            if (!reverse.run(0x100000)) break;
+        }
+    }
+
+    continuing = false;
+
+    // Went past it, back to right before it
+    if (debug_hit) {
+        machine->cpu.ext.freeze = false;
+
+        reverse.seek(debug_at);
+    }
+}
+
+void reverse_prompt() {
+    std::string line;
+
+    while (true) {
+        _log(info, "Instruction %llu, pc=%08x (%zu checkpoints, %llu KiB)",
+            (unsigned long long)machine->cpu.internal.retired,
+            machine->cpu.internal.r[pc],
+            reverse.checkpoints(),
+            (unsigned long long)(reverse.memory_used() >> 10)
+        );
+
+        std::cout << "(hyrisc) " << std::flush;
+
+        if (!std::getline(std::cin, line)) return;
+
+        std::istringstream args(line);
+
+        std::string cmd;
+
+        args >> cmd;
+
+        auto start = std::chrono::steady_clock::now();
+
+        if ((cmd == "s") || (cmd == "rs")) {
+            hyu64_t count = 1;
+
+            args >> count;
+
+            hyu64_t now = machine->cpu.internal.retired;
+            hyu64_t target = now + count;
+
+            if (cmd == "rs") {
+                target = ((now - reverse.first()) < count) ? reverse.first() : (now - count);
+            }
+
+            if (!reverse.seek(target))
+                _log(warning, "Couldn't reach instruction %llu", (unsigned long long)target);
+        } else if (cmd == "c") {
+            reverse_continue();
+        } else if (cmd == "rc") {
+            if (!reverse.seek_back(at_stop))
+                _log(info, "No breakpoint or debug opcode before, at the start of history");
+        } else if (cmd == "b") {
+            std::string arg;
+
+            args >> arg;
+
+            hyu32_t addr = std::strtoul(arg.c_str(), nullptr, 16);
+
+            if (breakpoints.erase(addr)) {
+                _log(info, "Removed breakpoint at %08x", addr);
+            } else {
+                breakpoints.insert(addr);
+
+                _log(info, "Breakpoint at %08x", addr);
+            }
+        } else if (cmd == "r") {
+            print_cpu_status_main(&machine->cpu);
+        } else if (cmd == "q") {
+            return;
+        } else if (cmd.size()) {
+            _log(info, "s/rs [n]: step n instructions forward/back, c/rc: continue forward/back, b <addr>: toggle breakpoint, r: registers, q: quit");
+
+            continue;
+        }
+
+        if ((cmd == "s") || (cmd == "rs") || (cmd == "c") || (cmd == "rc")) {
+            auto ns = std::chrono::duration_cast <std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start
+            ).count();
+
+            _log(debug, "Took %.1f ms", ns / 1000.0);
+        }
+    }
+}
+
+// The guest ran an illegal instruction
+void stop_illegal() {
+    hyrisc_t* cpu = machine->stopped_core();
+
     if (cpu->id) {
         _log(info, "%s executed an illegal instruction!", cpu->id);
     } else {
         _log(info, "CPU%u executed an illegal instruction!", cpu->core);
     }
 
-    print_cpu_status();
+    print_cpu_status(cpu);
+}
+
+// The guest ran a debug opcode or was interrupted, reports the core
+// that stopped on boards with more than one
+void stop_debug() {
+    hyrisc_t* cpu = machine->stopped_core();
+
+    if (machine->core_count() > 1) {
+        _log(debug, "CPU%u a0=%u (%08x)", cpu->core, cpu->internal.r[24], cpu->internal.r[24]);
+    } else {
+        _log(debug, "a0=%u (%08x)", cpu->internal.r[24], cpu->internal.r[24]);
+    }
+
+    save_machine(state_checkpoints);
+}
+
+void sigill_handler(int signal) {
+    stop_illegal();
 
     std::exit(1);
 }
 
 void sigint_handler(int signal) {
-    _log(debug, "a0=%u (%08x)", cpu->internal.r[24], cpu->internal.r[24]);
+    // Drop to the prompt instead
+    if (reverse_enabled) {
+        break_requested = 1;
+
+        return;
+    }
+
+    stop_debug();
 
-    // if (cpu->id) {
-    //     _log(info, "%s killed!", cpu->id);
+    // if (machine->cpu.id) {
+    //     _log(info, "%s killed!", machine->cpu.id);
     // } else {
-    //     _log(info, "CPU%u killed!", cpu->core);
+    //     _log(info, "CPU%u killed!", machine->cpu.core);
     // }
 
-    // print_cpu_status_main();
+    // print_cpu_status_main(&machine->cpu);
 
     std::exit(0);
 }
 
 #ifdef _WIN32
 void sigbreak_handler(int signal) {
-    _log(debug, "a0=%u (%08x)", cpu->internal.r[24], cpu->internal.r[24]);
+    _log(debug, "a0=%u (%08x)", machine->cpu.internal.r[24], machine->cpu.internal.r[24]);
 
-    if (cpu->id) {
-        _log(info, "Break requested by %s!", cpu->id);
+    if (machine->cpu.id) {
+        _log(info, "Break requested by %s!", machine->cpu.id);
     } else {
-        _log(info, "Break requested by CPU%u!", cpu->core);
+        _log(info, "Break requested by CPU%u!", machine->cpu.core);
     }
 
-    print_cpu_status_main();
+    print_cpu_status_main(&machine->cpu);
 
     std::exit(0);
 }
 #endif
 
 void sigfpe_handler(int signal) {
-    if (cpu->id) {
-        _log(info, "%s triggered a floating point exception!", cpu->id);
+    if (machine->cpu.id) {
+        _log(info, "%s triggered a floating point exception!", machine->cpu.id);
     } else {
-        _log(info, "CPU%u triggered a floating point exception!", cpu->core);
+        _log(info, "CPU%u triggered a floating point exception!", machine->cpu.core);
     }
 
-    print_cpu_status();
+    print_cpu_status(&machine->cpu);
 
     std::exit(0);
 }
 
-std::vector <device_t*> hardware;
-
-void add_hardware(device_t* dev) {
-    hardware.push_back(dev);
-};
-
 int main(int argc, const char* argv[]) {
     std::signal(SIGFPE, sigfpe_handler);
     std::signal(SIGINT, sigint_handler);
@@ -328,78 +590,298 @@ int main(int argc, const char* argv[]) {
 
     _log::init("hyrisc");
 
-    dev_terminal_t terminal;
-    dev_memory_t memory;
-    dev_bios_t bios;
-
-    bios.create(0x1000, 0x00000000);
-    bios.init(&cpu->ext);
-    bios.load("a.out", false);
-
-    memory.create(0x10000, 0x7fff0000);
-    memory.init(&cpu->ext);
-
-    // flash.create(0x10000, 0x90000000);
-    // flash.init(&cpu->ext);
-    // flash.load("program.bin");
-
-    terminal.create(0xa0000000);
-    terminal.init(&cpu->ext);
-
-    dev_iobus_t iobus;
-    iobus_dev_pci_t pci;
-    iobus_dev_ata_t ide;
-
-    /*           a0000000    fffffffe
-    System bus -----+------------+-
-                    |            |        1f0   cf8
-                    terminal     iobus ----+-----+--------
-                                           |     |
-                                           ide   pci -+-----------
-                                           |          |
-                                           +--------> bus 0, device 0
-    */
-
-    iobus.init(&cpu->ext);
-    iobus.attach_device(&pci);
-    iobus.attach_device(&ide);
-    pci.register_device(ide.get_pci_desc(), 0, 0);
-
-    if (!ide.attach_drive("test.img", ATA_PRI_MASTER)) {
-        _log(error, "Couldn't attach drive with image \"%s\" to ATA channel", "test.img");
+    hs::cli_parser_t cli;
+
+    cli.init(argc, argv);
+    cli.parse();
+
+    // Numbers are parsed where they're used, check them all before
+    // anything starts up. The injection target is in hex
+    static const hs::cli_setting_t numbers[] = {
+        hs::ST_MEMORY_SIZE, hs::ST_CORES, hs::ST_QUANTUM, hs::ST_SCHEDULE_SEED,
+        hs::ST_THREADS, hs::ST_CASE_LIMIT, hs::ST_FUZZ_CASES, hs::ST_CHECKPOINT_INTERVAL,
+        hs::ST_REVERSE_BUDGET, hs::ST_INJECT
+    };
+
+    for (hs::cli_setting_t st : numbers) {
+        if (!cli.is_set(st)) continue;
+
+        try {
+            hs::parse_size(cli.get_setting(st), (st == hs::ST_INJECT) ? 16 : 0);
+        } catch (const std::exception&) {
+            _log(error, "Bad value \"%s\" for %s", cli.get_setting(st).c_str(), cli.get_name(st).c_str());
+
+            return 1;
+        }
+    }
+
+    machine_config_t config;
+
+    if (cli.is_set(hs::ST_BIOS)) config.bios_image = cli.get_setting(hs::ST_BIOS);
+    if (cli.is_set(hs::ST_ATA_DRIVE)) config.ata_image = cli.get_setting(hs::ST_ATA_DRIVE);
+    if (cli.is_set(hs::ST_MEMORY_SIZE)) config.memory_size = hs::parse_size(cli.get_setting(hs::ST_MEMORY_SIZE));
+    if (cli.is_set(hs::ST_CORES)) config.cores = hs::parse_size(cli.get_setting(hs::ST_CORES));
+    if (cli.is_set(hs::ST_QUANTUM)) config.quantum = hs::parse_size(cli.get_setting(hs::ST_QUANTUM));
+    if (cli.is_set(hs::ST_SCHEDULE_SEED)) config.seed = hs::parse_size(cli.get_setting(hs::ST_SCHEDULE_SEED));
+
+    // Reverse debugging needs functional mode too
+    config.functional = cli.get_switch(hs::SW_FUNCTIONAL) || cli.get_switch(hs::SW_REVERSE);
+    config.fastmem    = cli.get_switch(hs::SW_FASTMEM);
+    config.jit        = cli.get_switch(hs::SW_JIT);
+    config.jit_verify = cli.get_switch(hs::SW_JIT_VERIFY);
+
+    // A schedule seed only makes sense for a deterministic schedule
+    config.deterministic = cli.get_switch(hs::SW_DETERMINISTIC) || cli.is_set(hs::ST_SCHEDULE_SEED);
+
+    // Jobs take the board settings above as defaults
+    if (cli.is_set(hs::ST_BATCH)) {
+        batch_t batch;
+
+        if (!batch.load(cli.get_setting(hs::ST_BATCH), config)) {
+            _log(error, "Couldn't read job manifest \"%s\"", cli.get_setting(hs::ST_BATCH).c_str());
+
+            return 1;
+        }
+
+        std::ofstream file;
+
+        if (cli.is_set(hs::ST_RESULTS)) {
+            file.open(cli.get_setting(hs::ST_RESULTS), std::ios::trunc);
+
+            if (!file.is_open()) {
+                _log(error, "Couldn't open \"%s\" for writing", cli.get_setting(hs::ST_RESULTS).c_str());
+
+                return 1;
+            }
+        }
+
+        unsigned threads = cli.is_set(hs::ST_THREADS) ? hs::parse_size(cli.get_setting(hs::ST_THREADS)) : 0;
+
+        auto begin = std::chrono::steady_clock::now();
+
+        batch.run(file.is_open() ? file : std::cout, threads);
+
+        _log(info, "Ran %zu jobs in %.3f s", batch.size(),
+            std::chrono::duration <double>(std::chrono::steady_clock::now() - begin).count()
+        );
+
+        return 0;
+    }
+
+    // Neither can follow more than one core
+    if ((config.cores > 1) && (cli.get_switch(hs::SW_REVERSE) || cli.is_set(hs::ST_FORK_SERVER) || cli.is_set(hs::ST_FUZZ))) {
+        _log(error, "Reverse debugging, the fork server and fuzzing only work on single core boards");
+
+        return 1;
+    }
+
+    if (!machine->create(config)) return 1;
+
+    if (cli.is_set(hs::ST_LOAD_STATE)) {
+        if (!load_machine(cli.get_setting(hs::ST_LOAD_STATE))) {
+            _log(error, "Couldn't load state from \"%s\"", cli.get_setting(hs::ST_LOAD_STATE).c_str());
+
+            return 1;
+        }
+    } else if (cli.is_set(hs::ST_BOOT_CACHE)) {
+        hyu64_t key = machine_key(config) ^ HYRISC_STATE_VERSION;
+
+        char name[32];
+
+        std::snprintf(name, sizeof(name), "%016llx.hys", (unsigned long long)key);
+
+        boot_cache_path = cli.get_setting(hs::ST_BOOT_CACHE) + "/" + name;
+
+        std::ifstream cached(boot_cache_path, std::ios::binary);
+
+        if (!cached.is_open()) {
+            boot_cache_pending = true;
+        } else if (!load_machine(boot_cache_path)) {
+            _log(error, "Couldn't load boot snapshot \"%s\", delete it to boot again", boot_cache_path.c_str());
+
+            return 1;
+        }
+    }
+
+    // Runs from wherever the board was loaded to the next debug opcode
+    if (cli.is_set(hs::ST_FORK_SERVER) || cli.is_set(hs::ST_FUZZ)) {
+        fork_server_t server;
+
+        bool fuzz = cli.is_set(hs::ST_FUZZ);
+
+        // Fuzzed guests stuck in a loop would stall every case after
+        hyu64_t limit = cli.is_set(hs::ST_CASE_LIMIT) ? hs::parse_size(cli.get_setting(hs::ST_CASE_LIMIT)) : (fuzz ? 0x1000000 : 0);
+
+        // The fuzzer's mailbox is only shared with its children
+        std::string mailbox = fuzz ? "" : cli.get_setting(hs::ST_FORK_SERVER);
+
+        if (!server.init(machine, mailbox, limit)) {
+            _log(error, "Couldn't map mailbox \"%s\"", mailbox.c_str());
+
+            return 1;
+        }
+
+        if (cli.is_set(hs::ST_INJECT))
+            server.set_ram_target(hs::parse_size(cli.get_setting(hs::ST_INJECT), 16));
+
+#ifndef HYRISC_COVERAGE
+        if (fuzz) {
+            _log(error, "Fuzzing needs a build with coverage, rebuild with COVERAGE=1");
+
+            return 1;
+        }
+
+        if (cli.is_set(hs::ST_COVERAGE)) {
+            _log(warning, "Built without coverage, the coverage map will stay empty");
+        }
+#endif
+
+        if ((fuzz || cli.is_set(hs::ST_COVERAGE)) && !server.set_coverage(cli.get_setting(hs::ST_COVERAGE))) {
+            _log(error, "Couldn't map coverage map \"%s\"", cli.get_setting(hs::ST_COVERAGE).c_str());
+
+            return 1;
+        }
+
+        if (fuzz) {
+            fuzzer_t fuzzer;
+
+            hyu64_t cases = cli.is_set(hs::ST_FUZZ_CASES) ? hs::parse_size(cli.get_setting(hs::ST_FUZZ_CASES)) : 0;
+
+            if (!fuzzer.init(&server, cli.get_setting(hs::ST_FUZZ))) {
+                _log(error, "Couldn't set up corpus directory \"%s\"", cli.get_setting(hs::ST_FUZZ).c_str());
+
+                return 1;
+            }
+
+            if (!fuzzer.run(cases)) {
+                _log(error, "Fuzzing stopped, the guest has to reach a debug opcode");
+
+                return 1;
+            }
+
+            return 0;
+        }
+
+        if (!server.serve()) {
+            _log(error, "Fork server stopped, the guest has to reach a debug opcode and the client has to be on fds %u and %u",
+                FORKSRV_CTL_FD, FORKSRV_STATUS_FD
+            );
+
+            return 1;
+        }
+
+        return 0;
     }
 
-    add_hardware(&terminal);
-    add_hardware(&iobus);
-    add_hardware(&bios);
-    add_hardware(&memory);
+    if (cli.is_set(hs::ST_SAVE_STATE)) {
+        state_file.open(cli.get_setting(hs::ST_SAVE_STATE), std::ios::binary | std::ios::trunc);
 
-    hyrisc_set_cpuid(cpu, "main-cpu", 0);
-    hyrisc_pulse_reset(cpu, 0x00000000);
+        if (!state_file.is_open() || !state_writer.open(state_file)) {
+            _log(error, "Couldn't open \"%s\" for writing", cli.get_setting(hs::ST_SAVE_STATE).c_str());
 
-    cpu->ext.bci.busirq = false;
-    cpu->ext.vcc = 1.0f;
+            return 1;
+        }
+    }
+
+    hyrisc_replay_t& replay = machine->replay;
 
-    int instructions = 150;
+    // Input events are timed by the instruction count, so recording
+    // and playback start from wherever the board was loaded
+    if (cli.is_set(hs::ST_RECORD) || cli.is_set(hs::ST_REPLAY)) {
+        hyu64_t key = machine_key(config);
 
-    while (instructions) {
-        // if (!cpu->internal.cycle) {
-        //     _log(debug, "PC=%08x, SP=%08x, FP=%08x, R1=%08x, R2=%08x",
-        //         cpu->internal.r[pc],
-        //         cpu->internal.r[sp],
-        //         cpu->internal.r[29],
-        //         cpu->internal.r[1],
-        //         cpu->internal.r[2]
-        //     );
+        if (cli.is_set(hs::ST_REPLAY) && !replay.replay(cli.get_setting(hs::ST_REPLAY), &machine->cpu.internal.retired, key)) {
+            _log(error, "Couldn't play back input log \"%s\"", cli.get_setting(hs::ST_REPLAY).c_str());
 
-        //     instructions--;
-        // }
+            return 1;
+        }
 
-        hyrisc_clock(cpu);
+        if (cli.is_set(hs::ST_RECORD) && !replay.record(cli.get_setting(hs::ST_RECORD), &machine->cpu.internal.retired, key)) {
+            _log(error, "Couldn't open \"%s\" for writing", cli.get_setting(hs::ST_RECORD).c_str());
 
-        for (device_t* dev : hardware)
-            dev->update();
+            return 1;
+        }
+
+        machine->attach_replay();
     }
 
-    print_cpu_status_main();
+    hyu64_t checkpoint_interval = cli.is_set(hs::ST_CHECKPOINT_INTERVAL) ?
+        hs::parse_size(cli.get_setting(hs::ST_CHECKPOINT_INTERVAL)) : 0;
+
+    // Re-executed code has to see the same input again
+    if (cli.get_switch(hs::SW_REVERSE)) {
+        reverse_enabled = true;
+
+        replay.set_rewindable(&machine->cpu.internal.retired);
+
+        machine->attach_replay();
+
+        // Both would move the RAM snapshot under the checkpoints
+        if (boot_cache_pending) {
+            _log(warning, "Boot snapshots aren't saved while reverse debugging");
+        }
+
+        if (checkpoint_interval) {
+            _log(warning, "Save-state checkpoints aren't taken while reverse debugging");
+        }
+
+        // Illegal instructions still end the session
+        machine->cpu.debug   = reverse_debug;
+        machine->cpu.illegal = nullptr;
+
+        hyu64_t budget = cli.is_set(hs::ST_REVERSE_BUDGET) ?
+            hs::parse_size(cli.get_setting(hs::ST_REVERSE_BUDGET)) : (256 << 20);
+
+        if (!reverse.init(&machine->cpu, &machine->bus, &machine->memory, budget)) {
+            _log(error, "Reverse debugging needs copy-on-write RAM, not supported on this host");
+
+            return 1;
+        }
+
+        // Stop at the first instruction
+        reverse_prompt();
+
+        save_machine(false);
+
+        return 0;
+    }
+
+    if (checkpoint_interval && state_file.is_open()) {
+        save_machine(false);
+
+        state_checkpoints = true;
+    }
+
+    hyu64_t since_checkpoint = 0;
+
+    while (true) {
+        hyu64_t start = machine->retired();
+
+        machine_stop_t stop = machine->run(0x100000);
+
+        since_checkpoint += machine->retired() - start;
+
+        if (stop == MACHINE_ILLEGAL) {
+            stop_illegal();
+
+            return 1;
+        }
+
+        if (stop == MACHINE_DEBUG) {
+            // The first one marks the end of boot
+            if (!boot_cache_pending) {
+                stop_debug();
+
+                return 0;
+            }
+
+            boot_cache_save();
+        }
+
+        if (state_checkpoints && (since_checkpoint >= checkpoint_interval)) {
+            save_machine(true);
+
+            since_checkpoint = 0;
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "../batch.hpp"
+
+#include "test.hpp"
+
+#include <sstream>
+
+// Guest divisions the host can't do. A job dividing by zero, or
+// INT_MIN by -1, used to raise SIGFPE and take every other job in
+// the batch down with it
+
+int main() {
+    _log::disable_logs = true;
+
+    // a0 = 42
+    std::string ok = test_write_guest("divide-ok.bin", {
+        enc1(HY_LI, 24, 42),
+        enc0(HY_DEBUG)
+    });
+
+    // a0 = (7 / 0) + (INT_MIN / -1) + (9 / 0 immediate)
+    std::string divide = test_write_guest("divide-zero.bin", {
+        enc1(HY_LI    , 1 , 7),
+        enc1(HY_LI    , 2 , 0),
+        enc3(HY_DIVR  , 24, 1, 2),
+        enc1(HY_LUI   , 3 , 0x8000),
+        enc3(HY_NOT   , 4 , 2),
+        enc3(HY_DIVR  , 5 , 3, 4),
+        enc3(HY_ADDR  , 24, 24, 5),
+        enc1(HY_LI    , 6 , 9),
+        enc1(HY_DIVSI16, 6, 0),
+        enc3(HY_ADDR  , 24, 24, 6),
+        enc0(HY_DEBUG)
+    });
+
+    std::string manifest = test_path("divide-jobs.txt");
+
+    std::ofstream(manifest) <<
+        ok     << "\n" <<
+        divide << "\n" <<
+        divide << "\n" <<
+        ok     << "\n";
+
+    machine_config_t base;
+
+    base.functional = true;
+    base.ata_image  = "";
+
+    batch_t batch;
+
+    TEST_CHECK(batch.load(manifest, base), "couldn't load manifest");
+
+    std::ostringstream results;
+
+    batch.run(results, 2);
+
+    std::istringstream lines(results.str());
+
+    std::string line;
+
+    size_t count = 0;
+
+    while (std::getline(lines, line)) {
+        count++;
+
+        TEST_CHECK(line.find("stop=debug") != std::string::npos, "%s", line.c_str());
+
+        bool divides = (line.find("job=2 ") == 0) || (line.find("job=3 ") == 0);
+
+        // All ones twice, INT_MIN / -1 is 0 as unsigned
+        TEST_CHECK(line.find(divides ? "a0=0xfffffffe" : "a0=0x0000002a") != std::string::npos, "%s", line.c_str());
+    }
+
+    TEST_CHECK(count == 4, "%zu results", count);
+
+    return test_result("batch_divide");
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "../batch.hpp"
+
+#include "test.hpp"
+
+#include <sstream>
+
+// FPU jobs on one worker thread, one after the other. Exceptions a
+// job leaves pending on the host must end up in its own FPCSR, never
+// in the next job's (or in a freed CPU)
+
+// f3 = 1.0 / 3.0, raises inexact
+static std::vector <hyu32_t> divide() {
+    return {
+        enc1(HY_LI, 1, 1),
+        enc1(HY_LI, 2, 3),
+        enc3(HY_FMVRF, 1, 1),
+        enc3(HY_FMVRF, 2, 2),
+        enc3(HY_FCVTF, 1, 1),
+        enc3(HY_FCVTF, 2, 2),
+        enc3(HY_FDIV , 3, 1, 2)
+    };
+}
+
+int main() {
+    _log::disable_logs = true;
+
+    // Stops with the exception still pending
+    std::vector <hyu32_t> pending = divide();
+
+    pending.push_back(enc0(HY_DEBUG));
+
+    // a0 = FPCSR before and after dividing
+    std::vector <hyu32_t> reads = { enc3(HY_FMVFR, 4, 31) };
+
+    for (hyu32_t word : divide()) reads.push_back(word);
+
+    reads.push_back(enc3(HY_FMVFR, 24, 31));
+    reads.push_back(enc3(HY_ORR, 24, 24, 4));
+    reads.push_back(enc0(HY_DEBUG));
+
+    std::string pending_path = test_write_guest("fpu-pending.bin", pending);
+    std::string reads_path   = test_write_guest("fpu-reads.bin", reads);
+
+    std::string manifest = test_path("fpu-jobs.txt");
+
+    std::ofstream(manifest) <<
+        pending_path << "\n" <<
+        pending_path << "\n" <<
+        reads_path   << "\n" <<
+        pending_path << "\n";
+
+    machine_config_t base;
+
+    base.functional = true;
+    base.ata_image  = "";
+
+    batch_t batch;
+
+    TEST_CHECK(batch.load(manifest, base), "couldn't load manifest");
+
+    std::ostringstream results;
+
+    batch.run(results, 1);
+
+    std::istringstream lines(results.str());
+
+    std::string line;
+
+    size_t count = 0;
+
+    while (std::getline(lines, line)) {
+        count++;
+
+        TEST_CHECK(line.find("stop=debug") != std::string::npos, "%s", line.c_str());
+
+        // Only its own inexact
+        if (line.find("job=3 ") == 0)
+            TEST_CHECK(line.find("a0=0x00000002") != std::string::npos, "%s", line.c_str());
+    }
+
+    TEST_CHECK(count == 4, "%zu results", count);
+
+    // Nothing left pending for a machine that's gone
+    {
+        machine_t machine;
+
+        machine_config_t config = base;
+
+        config.bios_image = pending_path;
+
+        TEST_CHECK(machine.create(config), "couldn't create machine");
+        TEST_CHECK(machine.run(0x1000) == MACHINE_DEBUG, "didn't stop");
+        TEST_CHECK(fpu::flags_owner == nullptr, "exceptions still pending after run");
+        TEST_CHECK(fpu::get_fpcsr(&machine.cpu) == 0x2, "FPCSR %08x", fpu::get_fpcsr(&machine.cpu));
+    }
+
+    return test_result("batch_fpu");
+}
@@ -0,0 +1,70 @@
+#include "../dev/bus.hpp"
+
+#include "test.hpp"
+
+// Routing through the two-level page table has to match a flat one,
+// with mappings covering whole regions, parts of them and several
+// at once, and later mappings taking over
+
+static hyu64_t rng = 0x853c49e6748fea9bull;
+
+static hyu32_t below(hyu64_t n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+
+    return (rng >> 16) % n;
+}
+
+int main() {
+    device_t devices[8];
+
+    dev_bus_t bus;
+
+    bus.init(nullptr);
+
+    std::vector <device_t*> flat(1 << (32 - BUS_PAGE_SHIFT), nullptr);
+
+    for (int i = 0; i < 64; i++) {
+        device_t* dev = &devices[i % 8];
+
+        hyu32_t base, size;
+
+        switch (below(3)) {
+            // A few pages
+            case 0: base = below(1ull << 32) & ~0xfff; size = (1 + below(16)) << BUS_PAGE_SHIFT; break;
+
+            // Regions, aligned or not
+            case 1: base = below(1ull << 32) & ~0xfff; size = (1 + below(8)) << BUS_REGION_SHIFT; break;
+            case 2: base = below(1ull << 32) & ~((1 << BUS_REGION_SHIFT) - 1); size = (1 + below(8)) << BUS_REGION_SHIFT; break;
+        }
+
+        // Up to the end of the address space
+        if (base && (size > (0 - base))) size = 0 - base;
+
+        bus.map(dev, base, size);
+
+        for (hyu64_t page = base >> BUS_PAGE_SHIFT; page <= ((base + (size - 1)) >> BUS_PAGE_SHIFT); page++)
+            flat[page] = dev;
+    }
+
+    // Last page of the address space
+    bus.map(&devices[0], 0xfffff000, 0x1000);
+
+    flat.back() = &devices[0];
+
+    size_t mismatches = 0;
+
+    // First and last byte of every page
+
+    for (hyu64_t page = 0; page < flat.size(); page++) {
+        hyu32_t addr = page << BUS_PAGE_SHIFT;
+
+        if (bus.decode(addr) != flat[page]) mismatches++;
+        if (bus.decode(addr | 0xfff) != flat[page]) mismatches++;
+    }
+
+    TEST_CHECK(!mismatches, "%zu addresses routed to the wrong device", mismatches);
+
+    return test_result("bus_decode");
+}
\ No newline at end of file
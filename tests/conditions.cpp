@@ -0,0 +1,41 @@
+#include "../hyrisc/hyrisc.hpp"
+
+#include "test.hpp"
+
+// Unsigned conditions after comparisons and additions, C is a carry
+// out (no borrow on subtraction)
+
+#define CC_CS 2
+#define CC_CC 3
+#define CC_HI 8
+#define CC_LS 9
+
+static bool holds(hyu8_t op, hyu32_t a, hyu32_t b, hyu32_t res, int cc) {
+    hyrisc_t proc;
+
+    proc.internal.st = 0;
+
+    hyrisc_defer_flags(&proc, op, res, a, b);
+
+    return hyrisc_test_condition(&proc, cc);
+}
+
+int main() {
+    const hyu32_t values[] = { 0, 1, 3, 5, 0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff };
+
+    for (hyu32_t a : values) {
+        for (hyu32_t b : values) {
+            hyu32_t diff = a - b;
+            hyu32_t sum  = a + b;
+
+            TEST_CHECK(holds(HY_FLAGS_SUB, a, b, diff, CC_CS) == (a >= b), "cmp %08x, %08x: cs", a, b);
+            TEST_CHECK(holds(HY_FLAGS_SUB, a, b, diff, CC_CC) == (a <  b), "cmp %08x, %08x: cc", a, b);
+            TEST_CHECK(holds(HY_FLAGS_SUB, a, b, diff, CC_HI) == (a >  b), "cmp %08x, %08x: hi", a, b);
+            TEST_CHECK(holds(HY_FLAGS_SUB, a, b, diff, CC_LS) == (a <= b), "cmp %08x, %08x: ls", a, b);
+
+            TEST_CHECK(holds(HY_FLAGS_ADD, a, b, sum, CC_CS) == (sum < a), "add %08x, %08x: cs", a, b);
+        }
+    }
+
+    return test_result("conditions");
+}
@@ -0,0 +1,47 @@
+#include "../machine.hpp"
+
+#include "test.hpp"
+
+// Host FP code run between calls to hyrisc_run (the reverse
+// debugger's and the batch runner's timing) must never raise
+// exceptions in the guest's FPCSR
+
+int main() {
+    _log::disable_logs = true;
+
+    // f3 = 1.0 + 1.0, exact, then a0 = FPCSR
+    std::string path = test_write_guest("fpu-host-flags.bin", {
+        enc1(HY_LI, 1, 1),
+        enc3(HY_FMVRF, 1, 1),
+        enc3(HY_FCVTF, 1, 1),
+        enc3(HY_FADD , 3, 1, 1),
+        enc3(HY_FMVFR, 24, 31),
+        enc0(HY_DEBUG)
+    });
+
+    {
+        machine_t machine;
+
+        machine_config_t config;
+
+        config.functional = true;
+        config.ata_image  = "";
+        config.bios_image = path;
+
+        TEST_CHECK(machine.create(config), "couldn't create machine");
+
+        hyrisc_t* cpu = &machine.cpu;
+
+        TEST_CHECK(hyrisc_run(cpu, 4) == 4, "didn't run the add");
+
+        volatile double a = 1.0, b = 3.0;
+        volatile double c = a / b;
+
+        (void)c;
+
+        TEST_CHECK(hyrisc_run(cpu, 1) == 1, "didn't run the read");
+        TEST_CHECK(cpu->internal.r[24] == 0, "FPCSR %08x", cpu->internal.r[24]);
+    }
+
+    return test_result("fpu_host_flags");
+}
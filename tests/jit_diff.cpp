@@ -0,0 +1,167 @@
+#include "../machine.hpp"
+
+#include "test.hpp"
+
+// Differential test of the recompiler
+// Random loops of ALU operations, loads, stores and short branches
+// run on the interpreter, on translated code, and on translated code
+// checked against the interpreter block by block (which aborts on a
+// mismatch). All three have to end up in the same state.
+
+#define JIT_DIFF_PROGRAMS 40
+#define JIT_DIFF_LENGTH   60
+
+static hyu64_t rng = 0x2545f4914f6cdd1dull;
+
+static hyu32_t below(hyu32_t n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+
+    return (rng >> 32) % n;
+}
+
+template <class T, size_t size> static T pick(const T (&list)[size]) {
+    return list[below(size)];
+}
+
+// r3 points at RAM, r26 is scratch for addresses and r28 counts
+// iterations
+static const hyu32_t dst[] = {
+    0, 1, 2, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25
+};
+
+static const hyu32_t src[] = {
+    0, 1, 2, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 3, 28, 29, 31
+};
+
+static const hyu8_t imm16_ops[] = {
+    HY_LI, HY_LUI, HY_ADDUI16, HY_ADDSI16, HY_SUBUI16, HY_SUBSI16, HY_MULUI16, HY_MULSI16,
+    HY_CMPI8, HY_CMPI16, HY_ANDI16, HY_ORI16, HY_XORI16
+};
+
+static const hyu8_t shift_ops[] = {
+    HY_LSLI16, HY_LSRI16, HY_ASLI16, HY_ASRI16
+};
+
+static const hyu8_t imm8_ops[] = {
+    HY_ADDUI8, HY_ADDSI8, HY_SUBUI8, HY_SUBSI8, HY_MULUI8, HY_MULSI8, HY_DIVUI8,
+    HY_ANDI8, HY_ORI8, HY_XORI8
+};
+
+static const hyu8_t reg_ops[] = {
+    HY_MOV, HY_LEAM, HY_LEAS, HY_LEAFA, HY_LEAFS, HY_ADDR, HY_SUBR, HY_MULR, HY_CMPZ,
+    HY_CMPR, HY_ANDR, HY_ORR, HY_XORR, HY_NOT, HY_NEG, HY_SEXT, HY_RSTS, HY_INC, HY_DEC,
+    HY_TST, HY_LSLR, HY_LSRR, HY_ASLR, HY_ASRR, HY_NOP
+};
+
+static const hyu8_t memory_ops[] = {
+    HY_LOADFA, HY_STOREFA, HY_LOADFS, HY_STOREFS, HY_LOADM, HY_STOREM, HY_LOADS, HY_STORES
+};
+
+static bool is_load(hyu8_t op) {
+    return (op == HY_LOADFA) || (op == HY_LOADFS) || (op == HY_LOADM) || (op == HY_LOADS);
+}
+
+static std::vector <hyu32_t> generate() {
+    std::vector <hyu32_t> words = {
+        enc1(HY_LUI, 3, 0x7fff),
+        enc1(HY_LI, 28, 0)
+    };
+
+    size_t loop = words.size();
+
+    for (int i = 0; i < JIT_DIFF_LENGTH; i++) {
+        hyu32_t kind = below(100);
+
+        // Skip up to two instructions forward
+        if ((kind < 8) && ((JIT_DIFF_LENGTH - i) > 4)) {
+            words.push_back(enc1(below(2) ? HY_BCCS : HY_BCCU, below(16), 4 * below(3)));
+
+            continue;
+        }
+
+        if (kind < 20) {
+            hyu8_t op = pick(memory_ops);
+            hyu32_t x = is_load(op) ? pick(dst) : pick(src);
+
+            if ((op == HY_LOADFS) || (op == HY_STOREFS)) {
+                // Far enough into RAM to subtract from
+                words.push_back(enc3(HY_LEAFA, 26, 3, 0, 16, 0));
+                words.push_back(enc3(op, x, 26, below(32), below(16), below(3)));
+            } else if ((op == HY_LOADFA) || (op == HY_STOREFA)) {
+                words.push_back(enc3(op, x, 3, below(32), below(16), below(3)));
+            } else {
+                words.push_back(enc3(op, x, 3, 0, below(32), below(3)));
+            }
+
+            continue;
+        }
+
+        switch (below(4)) {
+            case 0: words.push_back(enc1(pick(imm16_ops), pick(dst), below(0x10000))); break;
+            case 1: words.push_back(enc1(pick(shift_ops), pick(dst), below(40))); break;
+            case 2: words.push_back(enc2(pick(imm8_ops), pick(dst), pick(src), 1 + below(255))); break;
+            case 3: words.push_back(enc3(pick(reg_ops), pick(dst), pick(src), pick(src), below(32), below(4))); break;
+        }
+    }
+
+    // 300 iterations, plenty for every block to get translated
+    words.push_back(enc1(HY_ADDUI16, 28, 1));
+    words.push_back(enc1(HY_CMPI16, 28, 300));
+    words.push_back(enc_branch(1, words.size(), loop));
+
+    // Sum everything into a0
+    for (hyu32_t x : dst)
+        if (x != 24) words.push_back(enc3(HY_ADDR, 24, 24, x));
+
+    words.push_back(enc0(HY_DEBUG));
+
+    return words;
+}
+
+int main() {
+    _log::disable_logs = true;
+
+    for (int program = 0; program < JIT_DIFF_PROGRAMS; program++) {
+        std::string path = test_write_guest("jit-diff.bin", generate());
+
+        hyu32_t r[3][32];
+        hyu64_t retired[3];
+
+        for (int mode = 0; mode < 3; mode++) {
+            machine_t machine;
+
+            machine_config_t config;
+
+            config.ata_image  = "";
+            config.bios_image = path;
+            config.functional = true;
+            config.jit        = mode == 1;
+            config.jit_verify = mode == 2;
+
+            TEST_CHECK(machine.create(config), "couldn't create machine");
+
+            machine.run(0x1000000);
+
+            if (mode) TEST_CHECK(machine.cpu.jit && machine.cpu.jit->translated, "program %d: nothing translated", program);
+
+            std::memcpy(r[mode], machine.cpu.internal.r, sizeof(r[mode]));
+
+            retired[mode] = machine.cpu.internal.retired;
+        }
+
+        for (int mode = 1; mode < 3; mode++) {
+            TEST_CHECK(retired[mode] == retired[0], "program %d, mode %d: retired %llu, interpreter %llu",
+                program, mode, (unsigned long long)retired[mode], (unsigned long long)retired[0]);
+
+            for (int reg = 0; reg < 32; reg++)
+                TEST_CHECK(r[mode][reg] == r[0][reg], "program %d, mode %d: r%d %08x, interpreter %08x",
+                    program, mode, reg, r[mode][reg], r[0][reg]);
+        }
+    }
+
+    return test_result("jit_diff");
+}
\ No newline at end of file
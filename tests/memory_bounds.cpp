@@ -0,0 +1,53 @@
+#include "../machine.hpp"
+
+#include "test.hpp"
+
+// Accesses running past the end of RAM or the BIOS only reach the
+// bytes in range, and every execution mode has to agree on them
+
+int main() {
+    _log::disable_logs = true;
+
+    std::string path = test_write_guest("memory-bounds.bin", {
+        enc1(HY_LI     , 2, 0x1234),
+        enc1(HY_LUI    , 1, 0x8000),
+
+        // Last 2 bytes of RAM
+        enc3(HY_STOREFS, 2, 1, 2, 0, AS_SHORT),
+        enc3(HY_LOADFS , 4, 1, 2, 0, AS_LONG),
+        enc1(HY_LI     , 3, 0x4321),
+        enc3(HY_STOREFS, 3, 1, 2, 0, AS_LONG),
+        enc3(HY_LOADFS , 5, 1, 2, 0, AS_SHORT),
+
+        // Last 2 bytes of the BIOS
+        enc1(HY_LI     , 6, MACHINE_BIOS_SIZE),
+        enc3(HY_STOREFS, 2, 6, 2, 0, AS_SHORT),
+        enc3(HY_LOADFS , 7, 6, 2, 0, AS_LONG),
+        enc0(HY_DEBUG)
+    });
+
+    const char* modes[] = { "pin", "functional", "fastmem", "jit" };
+
+    for (int mode = 0; mode < 4; mode++) {
+        machine_t machine;
+
+        machine_config_t config;
+
+        config.ata_image  = "";
+        config.bios_image = path;
+        config.functional = mode == 1;
+        config.fastmem    = mode == 2;
+        config.jit        = mode == 3;
+
+        TEST_CHECK(machine.create(config), "couldn't create machine");
+        TEST_CHECK(machine.run(0x100) == MACHINE_DEBUG, "%s: didn't stop", modes[mode]);
+
+        hyu32_t* r = machine.cpu.internal.r;
+
+        TEST_CHECK(r[4] == 0x1234, "%s: RAM long read %08x", modes[mode], r[4]);
+        TEST_CHECK(r[5] == 0x4321, "%s: RAM short read %08x", modes[mode], r[5]);
+        TEST_CHECK(r[7] == 0x1234, "%s: BIOS long read %08x", modes[mode], r[7]);
+    }
+
+    return test_result("memory_bounds");
+}
@@ -0,0 +1,89 @@
+#include "../machine.hpp"
+
+#include "test.hpp"
+
+#include <sstream>
+
+// The quantum decides how the cores of a deterministic board
+// interleave, boards with another one can't share boot snapshots or
+// pick up each other's schedules
+
+static bool save(machine_t& machine, std::stringstream& stream) {
+    hyrisc_state_writer_t writer;
+
+    if (!writer.open(stream)) return false;
+
+    machine.save(writer);
+
+    return writer.finish();
+}
+
+static bool load(machine_t& machine, std::stringstream& stream) {
+    hyrisc_state_reader_t reader;
+
+    if (!reader.open(stream)) return false;
+
+    return machine.load(reader) && reader.expect("END ");
+}
+
+int main() {
+    _log::disable_logs = true;
+
+    std::string path = test_write_guest("schedule-quantum.bin", {
+        enc2(HY_ADDUI8, 1, 1, 1),
+        enc_branch(14, 1, 0)
+    });
+
+    machine_config_t config;
+
+    config.ata_image     = "";
+    config.bios_image    = path;
+    config.cores         = 2;
+    config.deterministic = true;
+    config.quantum       = 0x100;
+
+    machine_config_t other = config;
+
+    other.quantum = 0x200;
+
+    TEST_CHECK(machine_key(config) != machine_key(other), "quantum isn't part of the key");
+
+    // Single core boards don't have a schedule
+    machine_config_t single = config, single_other = other;
+
+    single.cores = single_other.cores = 1;
+
+    TEST_CHECK(machine_key(single) == machine_key(single_other), "single core keys depend on the quantum");
+
+    std::stringstream stream;
+
+    {
+        machine_t machine;
+
+        TEST_CHECK(machine.create(config), "couldn't create machine");
+        TEST_CHECK(machine.run(0x1234) == MACHINE_BUDGET, "stopped early");
+        TEST_CHECK(save(machine, stream), "couldn't save");
+    }
+
+    std::string state = stream.str();
+
+    {
+        machine_t machine;
+
+        std::stringstream in(state);
+
+        TEST_CHECK(machine.create(config), "couldn't create machine");
+        TEST_CHECK(load(machine, in), "couldn't load with the same quantum");
+    }
+
+    {
+        machine_t machine;
+
+        std::stringstream in(state);
+
+        TEST_CHECK(machine.create(other), "couldn't create machine");
+        TEST_CHECK(!load(machine, in), "loaded with another quantum");
+    }
+
+    return test_result("schedule_quantum");
+}
@@ -0,0 +1,83 @@
+#include "../machine.hpp"
+
+#include "test.hpp"
+
+#include <sstream>
+
+// Corrupt and truncated save-states have to fail to load, not take
+// the process down. Chunk sizes come from the file
+
+static bool load(const std::string& data, const char* tag = nullptr) {
+    std::stringstream stream(data);
+
+    machine_t machine;
+
+    machine_config_t config;
+
+    config.ata_image  = "";
+    config.bios_image = test_path("state-corrupt.bin");
+
+    if (!machine.create(config)) return false;
+
+    hyrisc_state_reader_t reader;
+
+    if (!reader.open(stream)) return false;
+
+    // Skips everything up to a chunk that isn't there
+    if (tag) return reader.expect(tag);
+
+    return machine.load(reader) && reader.expect("END ");
+}
+
+// Chunk sizes are at 8 in their header, after the stream's own
+static std::string with_size(std::string data, hyu64_t size) {
+    for (int i = 0; i < 8; i++) data[16 + i] = (char)(size >> (i * 8));
+
+    return data;
+}
+
+int main() {
+    _log::disable_logs = true;
+
+    test_write_guest("state-corrupt.bin", {
+        enc1(HY_LI, 24, 42),
+        enc0(HY_DEBUG)
+    });
+
+    std::stringstream stream;
+
+    {
+        machine_t machine;
+
+        machine_config_t config;
+
+        config.ata_image  = "";
+        config.bios_image = test_path("state-corrupt.bin");
+
+        TEST_CHECK(machine.create(config), "couldn't create machine");
+
+        machine.run(0x100);
+
+        hyrisc_state_writer_t writer;
+
+        TEST_CHECK(writer.open(stream), "couldn't open writer");
+
+        machine.save(writer);
+
+        TEST_CHECK(writer.finish(), "couldn't save");
+    }
+
+    std::string data = stream.str();
+
+    TEST_CHECK(load(data), "intact state doesn't load");
+
+    for (hyu64_t size : { (hyu64_t)0xffffffffffffffffull, (hyu64_t)0x7fffffffffffffffull, (hyu64_t)0x100000000ull, (hyu64_t)data.size() }) {
+        TEST_CHECK(!load(with_size(data, size)), "chunk of %llx bytes loaded", (unsigned long long)size);
+        TEST_CHECK(!load(with_size(data, size), "NONE"), "chunk of %llx bytes skipped", (unsigned long long)size);
+    }
+
+    for (size_t cut : { (size_t)12, (size_t)24, data.size() / 2, data.size() - 1 })
+        TEST_CHECK(!load(data.substr(0, cut)), "state cut at %zu bytes loaded", cut);
+
+    return test_result("state_corrupt");
+}
\ No newline at end of file
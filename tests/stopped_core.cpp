@@ -0,0 +1,62 @@
+#include "../batch.hpp"
+
+#include "test.hpp"
+
+#include <sstream>
+
+// The core running a debug opcode is the one reported, not always
+// the first one
+
+int main() {
+    _log::disable_logs = true;
+
+    // Core 0 spins, the others stop with a0 = 0x77
+    std::string path = test_write_guest("stopped-core.bin", {
+        enc1(HY_LUI    , 1, 0xa000),
+        enc1(HY_ADDUI16, 1, 0x1000),
+        enc3(HY_LOADFA , 2, 1, 0, 0, AS_LONG),
+        enc2(HY_SUBUI8 , 3, 2, 0),
+        enc_branch(0, 4, 4),
+        enc1(HY_LI     , 24, 0x77),
+        enc0(HY_DEBUG)
+    });
+
+    for (bool deterministic : { false, true }) {
+        machine_t machine;
+
+        machine_config_t config;
+
+        config.ata_image     = "";
+        config.bios_image    = path;
+        config.cores         = 2;
+        config.deterministic = deterministic;
+
+        TEST_CHECK(machine.create(config), "couldn't create machine");
+        TEST_CHECK(machine.run(0x100000) == MACHINE_DEBUG, "didn't stop");
+
+        hyrisc_t* cpu = machine.stopped_core();
+
+        TEST_CHECK(cpu->core == 1, "core %u stopped, deterministic=%d", cpu->core, deterministic);
+        TEST_CHECK(cpu->internal.r[24] == 0x77, "a0=%08x, deterministic=%d", cpu->internal.r[24], deterministic);
+    }
+
+    std::string manifest = test_path("stopped-core.txt");
+
+    std::ofstream(manifest) << path << " cores=2 instructions=1M\n";
+
+    machine_config_t base;
+
+    base.ata_image = "";
+
+    batch_t batch;
+
+    TEST_CHECK(batch.load(manifest, base), "couldn't load manifest");
+
+    std::ostringstream results;
+
+    batch.run(results, 1);
+
+    TEST_CHECK(results.str().find("stop=debug a0=0x00000077") != std::string::npos, "%s", results.str().c_str());
+
+    return test_result("stopped_core");
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "../hyrisc/types.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Test helpers
+// Guests are assembled from words built with the encoders below, in
+// the order of the encoding's fields, and written out as raw BIOS
+// images. Failed checks are reported and make the test exit with 1.
+
+inline int test_failures = 0;
+
+#define TEST_CHECK(cond, ...) \
+    if (!(cond)) { std::fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); std::fprintf(stderr, __VA_ARGS__); std::fprintf(stderr, "\n"); test_failures++; }
+
+inline int test_result(const char* name) {
+    std::fprintf(stderr, "%s: %s\n", name, test_failures ? "FAIL" : "ok");
+
+    return test_failures ? 1 : 0;
+}
+
+inline hyu32_t enc0(hyu8_t op) {
+    return op;
+}
+
+inline hyu32_t enc1(hyu8_t op, hyu32_t x, hyu32_t i16) {
+    return op | (1 << 8) | (x << 10) | ((i16 & 0xffff) << 15);
+}
+
+inline hyu32_t enc2(hyu8_t op, hyu32_t x, hyu32_t y, hyu32_t i8) {
+    return op | (2 << 8) | (x << 10) | (y << 15) | ((i8 & 0xff) << 20);
+}
+
+inline hyu32_t enc3(hyu8_t op, hyu32_t x, hyu32_t y, hyu32_t z = 0, hyu32_t w = 0, hyu32_t s = 0) {
+    return op | (3 << 8) | (x << 10) | (y << 15) | (z << 20) | (w << 25) | (s << 30);
+}
+
+// Short branch from word at to word target
+inline hyu32_t enc_branch(hyu32_t cc, size_t at, size_t target) {
+    return enc1(0xaf, cc, (target * 4) - (at * 4 + 4));
+}
+
+// Files tests write go to a scratch directory
+inline std::string test_path(const std::string& name) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "hyrisc-tests";
+
+    std::filesystem::create_directories(dir);
+
+    return (dir / name).string();
+}
+
+// Returns the path it was written to
+inline std::string test_write_guest(const std::string& name, const std::vector <hyu32_t>& words) {
+    std::string path = test_path(name);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    for (hyu32_t word : words) {
+        hyu8_t bytes[4] = { (hyu8_t)word, (hyu8_t)(word >> 8), (hyu8_t)(word >> 16), (hyu8_t)(word >> 24) };
+
+        file.write((const char*)bytes, 4);
+    }
+
+    return path;
+}